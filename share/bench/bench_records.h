@@ -0,0 +1,95 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Synthetic changelog records for the benchmarks, resembling the stream of a
+ * metadata intensive job: files created, closed, their attributes set, then
+ * removed, within a few directories, with FIDs allocated in sequence and a
+ * handful of jobids.
+ */
+
+#ifndef BENCH_RECORDS_H
+#define BENCH_RECORDS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <lustre/lustreapi.h>
+#include <lustre/lustre_user.h>
+
+/* Directories the files are spread over */
+#define BENCH_DIRS      16
+
+/* Bytes a bench record may take, name included */
+#define BENCH_REC_MAX   (sizeof(struct changelog_rec) + \
+                         sizeof(struct changelog_ext_jobid) + 32)
+
+/**
+ * Write record \a index to \a buff and return its size, name included.
+ */
+static inline size_t bench_record(void *buff, long long index)
+{
+    static const enum changelog_rec_type types[] = {
+        CL_CREATE, CL_CLOSE, CL_SETATTR, CL_UNLINK
+    };
+    struct changelog_rec    *rec = (struct changelog_rec *)buff;
+    long long                file = index / 4;
+
+    memset(rec, 0, sizeof(*rec) + sizeof(struct changelog_ext_jobid));
+    rec->cr_flags = CLF_VERSION | CLF_JOBID;
+    rec->cr_type  = types[index % 4];
+    rec->cr_index = index;
+    /* A record every 10 usec, packed as seconds and nanoseconds */
+    rec->cr_time  = ((uint64_t)(1500000000 + index / 100000) << 30) |
+                    (uint64_t)(index % 100000) * 10000;
+
+    rec->cr_tfid.f_seq = 0x200000400ULL + file / 100000;
+    rec->cr_tfid.f_oid = file % 100000 + 1;
+
+    snprintf(changelog_rec_jobid(rec)->cr_jobid, LUSTRE_JOBID_SIZE, "dd.%d",
+             500 + (int)(file % 4));
+
+    if (rec->cr_type == CL_CREATE || rec->cr_type == CL_UNLINK) {
+        rec->cr_pfid.f_seq = 0x200000007ULL;
+        rec->cr_pfid.f_oid = 1 + file % BENCH_DIRS;
+        rec->cr_namelen = sprintf(changelog_rec_name(rec), "file.%lld", file);
+    }
+
+    return changelog_rec_size(rec) + rec->cr_namelen;
+}
+
+/**
+ * Fill \a buff with \a count records from \a first on, and return their size.
+ * \a buff must be able to hold count * BENCH_REC_MAX bytes.
+ */
+static inline size_t bench_records(void *buff, long long first, int count)
+{
+    size_t  len = 0;
+    int     i;
+
+    for (i = 0; i < count; i++)
+        len += bench_record((char *)buff + len, first + i);
+
+    return len;
+}
+
+#endif /* BENCH_RECORDS_H */
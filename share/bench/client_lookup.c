@@ -0,0 +1,183 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Per-RPC cost of finding the state of the requesting client, from 1 to 10,000
+ * registered clients. The reader is built in, so that its very lookup is timed:
+ * clients get registered under random 5-byte identities, as ZMQ_ROUTER sockets
+ * assign, then looked up in random order. A linear scan of the same clients, as
+ * done before they were hashed, is timed alongside.
+ *
+ * Usage: run.sh client_lookup [lookups per count]
+ */
+
+
+#include "reader.c"
+
+#include <stdio.h>
+
+#define DEFAULT_LOOKUPS (1 << 22)
+
+/* Defined by lcapd.c, which is not built in */
+int TerminateSig;
+
+static const int ClientCounts[] = {1, 10, 100, 1000, 10000};
+
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct conn_id *bench_ident(void)
+{
+    struct conn_id  *cid;
+    uint32_t         id = random();
+
+    cid = malloc(sizeof(*cid) + 5);
+    if (cid == NULL)
+        return NULL;
+
+    cid->ci_length  = 5;
+    cid->ci_data[0] = 0;
+    memcpy(cid->ci_data + 1, &id, sizeof(id));
+    return cid;
+}
+
+/**
+ * The lookup clients went through before being hashed.
+ */
+static struct client_state *bench_scan(struct client_state **clients,
+                                       int count, const struct conn_id *cid)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!cid_compare(clients[i]->cs_ident, cid))
+            return clients[i];
+    }
+
+    return NULL;
+}
+
+static int bench_count(int count, long lookups)
+{
+    struct reader_env        env;
+    struct client_state    **clients;
+    struct client_state     *cs;
+    int                     *order;
+    long                     scans;
+    long                     i;
+    long                     misses = 0;
+    double                   start;
+    double                   table;
+    double                   list;
+    int                      rc;
+
+    memset(&env, 0, sizeof(env));
+    rc = client_table_init(&env.re_clients, CLIENT_TABLE_MIN_SIZE);
+    if (rc)
+        return rc;
+
+    clients = calloc(count, sizeof(*clients));
+    order   = calloc(lookups, sizeof(*order));
+    if (clients == NULL || order == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < count; i++) {
+        cs = calloc(1, sizeof(*cs));
+        if (cs == NULL)
+            return -ENOMEM;
+
+        cs->cs_ident = bench_ident();
+        if (cs->cs_ident == NULL)
+            return -ENOMEM;
+
+        cs->cs_hash = conn_id_hash(cs->cs_ident);
+        rc = client_table_insert(&env.re_clients, cs);
+        if (rc)
+            return rc;
+
+        clients[i] = cs;
+    }
+
+    for (i = 0; i < lookups; i++)
+        order[i] = random() % count;
+
+    start = bench_now();
+    for (i = 0; i < lookups; i++) {
+        if (client_state_get(&env, clients[order[i]]->cs_ident) == NULL)
+            misses++;
+    }
+    table = (bench_now() - start) / lookups;
+
+    /* As many comparisons as lookups for the others */
+    scans = lookups / count > 1024 ? lookups / count : 1024;
+    if (scans > lookups)
+        scans = lookups;
+
+    start = bench_now();
+    for (i = 0; i < scans; i++) {
+        if (bench_scan(clients, count, clients[order[i]]->cs_ident) == NULL)
+            misses++;
+    }
+    list = (bench_now() - start) / scans;
+
+    printf("%6d clients: %8.1f ns/lookup hashed, %10.1f ns/lookup scanned%s\n",
+           count, table * 1e9, list * 1e9, misses ? " (MISSES)" : "");
+
+    client_table_fini(&env.re_clients);
+    free(clients);
+    free(order);
+    return misses ? -EFAULT : 0;
+}
+
+int main(int argc, char **argv)
+{
+    long    lookups = DEFAULT_LOOKUPS;
+    int     i;
+    int     rc;
+
+    if (argc > 1)
+        lookups = strtol(argv[1], NULL, 0);
+
+    if (lookups <= 0) {
+        fprintf(stderr, "Usage: %s [lookups per count]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    lcap_set_loglevel(0);
+    srandom(getpid());
+
+    for (i = 0; i < sizeof(ClientCounts) / sizeof(ClientCounts[0]); i++) {
+        rc = bench_count(ClientCounts[i], lookups);
+        if (rc) {
+            fprintf(stderr, "Cannot run with %d clients: %s\n",
+                    ClientCounts[i], strerror(-rc));
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Compression ratio and CPU cost of the encodings of ENQUEUE messages. The
+ * reader is built in, so that its very encoders are timed: rec_compress()
+ * (zlib at Z_BEST_SPEED), rec_columns(), and both, as a client asking for
+ * compressed columns gets. Decompression, which clients pay for, is timed as
+ * well. Buckets are made of the records of bench_records.h.
+ *
+ * Usage: run.sh encode [buckets per size]
+ */
+
+
+#include "reader.c"
+#include "bench_records.h"
+
+#include <stdio.h>
+
+#ifndef HAVE_LIBZ
+#error "lcapd has to be built with zlib (configure found none)"
+#endif
+
+#define DEFAULT_BUCKETS     256
+
+/* Defined by lcapd.c, which is not built in */
+int TerminateSig;
+
+/* Records per bucket: Rec_Batch_Count default, and larger settings */
+static const int BatchCounts[] = {64, 1024, 8192};
+
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Encoded size and time spent by one of the encodings, over all buckets.
+ */
+struct bench_enc {
+    const char  *be_name;
+    size_t       be_in;
+    size_t       be_out;
+    double       be_time;
+    double       be_inflate;
+};
+
+static void bench_enc_print(const struct bench_enc *enc)
+{
+    printf("    %-16s ratio %5.2f, %7.1f MB/s", enc->be_name,
+           (double)enc->be_in / enc->be_out, enc->be_in / enc->be_time / 1e6);
+    if (enc->be_inflate > 0)
+        printf(", inflated at %7.1f MB/s", enc->be_in / enc->be_inflate / 1e6);
+    printf("\n");
+}
+
+/**
+ * Time the decompression of a message compressed by rec_compress().
+ */
+static double bench_inflate(const struct bucket_wire *wire, void *buff)
+{
+    uLongf  len = wire->bw_rpc.pr_raw_len;
+    double  start = bench_now();
+
+    if (uncompress(buff, &len, wire->bw_rpc.pr_records,
+                   wire->bw_capacity) != Z_OK)
+        return -1.0;
+
+    return bench_now() - start;
+}
+
+static int bench_batch(int count, int nbkts)
+{
+    struct reader_env        env;
+    struct px_rpc_enqueue   *rpc;
+    struct bucket_wire      *zwire;
+    struct bucket_wire      *cwire;
+    struct bench_enc         zlib = { .be_name = "zlib" };
+    struct bench_enc         cols = { .be_name = "columns" };
+    struct bench_enc         both = { .be_name = "columns + zlib" };
+    size_t                   size;
+    double                   start;
+    double                   col_time;
+    double                   inflate;
+    void                    *buff;
+    int                      i;
+
+    memset(&env, 0, sizeof(env));
+
+    rpc  = malloc(sizeof(*rpc) + count * BENCH_REC_MAX);
+    buff = malloc(count * BENCH_REC_MAX);
+    if (rpc == NULL || buff == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < nbkts; i++) {
+        memset(rpc, 0, sizeof(*rpc));
+        rpc_hdr_init(&rpc->pr_hdr, RPC_OP_ENQUEUE);
+        rpc->pr_count = count;
+        size = bench_records(rpc->pr_records, (long long)i * count, count);
+
+        start = bench_now();
+        zwire = rec_compress(&env, rpc, size);
+        zlib.be_time += bench_now() - start;
+        zlib.be_in   += size;
+        zlib.be_out  += zwire != NULL ? zwire->bw_capacity : size;
+
+        start = bench_now();
+        cwire = rec_columns(&env, rpc, size);
+        col_time = bench_now() - start;
+        cols.be_time += col_time;
+        cols.be_in   += size;
+        cols.be_out  += cwire != NULL ? cwire->bw_capacity : size;
+
+        if (zwire != NULL) {
+            inflate = bench_inflate(zwire, buff);
+            if (inflate < 0)
+                return -EPROTO;
+
+            zlib.be_inflate += inflate;
+            free(zwire);
+        }
+
+        if (cwire == NULL)
+            continue;
+
+        start = bench_now();
+        zwire = rec_compress(&env, &cwire->bw_rpc, cwire->bw_capacity);
+        both.be_time += col_time + bench_now() - start;
+        both.be_in   += size;
+        both.be_out  += zwire != NULL ? zwire->bw_capacity :
+                                        cwire->bw_capacity;
+        if (zwire != NULL) {
+            inflate = bench_inflate(zwire, buff);
+            if (inflate < 0)
+                return -EPROTO;
+
+            both.be_inflate += inflate;
+            free(zwire);
+        }
+
+        free(cwire);
+    }
+
+    printf("%5d records per bucket (%zu bytes on average):\n", count,
+           zlib.be_in / nbkts);
+    bench_enc_print(&zlib);
+    bench_enc_print(&cols);
+    if (both.be_in > 0)
+        bench_enc_print(&both);
+
+    free(rpc);
+    free(buff);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int     nbkts = DEFAULT_BUCKETS;
+    int     i;
+    int     rc;
+
+    if (argc > 1)
+        nbkts = atoi(argv[1]);
+
+    if (nbkts <= 0) {
+        fprintf(stderr, "Usage: %s [buckets per size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    lcap_set_loglevel(0);
+
+    for (i = 0; i < sizeof(BatchCounts) / sizeof(BatchCounts[0]); i++) {
+        rc = bench_batch(BatchCounts[i], nbkts);
+        if (rc) {
+            fprintf(stderr, "Cannot run with %d records per bucket: %s\n",
+                    BatchCounts[i], strerror(-rc));
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Cost of a bucket delivery, with and without copying its records. Before
+ * ENQUEUE messages were built on top of the bucket arena, each delivery
+ * allocated a message, copied every record into it, and zmq_send() copied the
+ * whole message again (ZMQ allocates and copies anything beyond a few dozen
+ * bytes). Now a delivery takes a reference on the arena, dropped by the ZMQ
+ * free callback. The broker used to copy each delivery twice more, receiving
+ * then sending it; it now forwards the frames as they are, and only copies the
+ * two frames of messages to legacy clients together to read their header.
+ * Both paths are timed here, within the reader, for buckets of several sizes,
+ * over 64 MiB worth of buckets delivered in turn, so that they do not all stay
+ * in cache.
+ *
+ * Usage: run.sh enqueue_copy [deliveries per size]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "lcapd_internal.h"
+#include "bench_records.h"
+
+#define DEFAULT_DELIVERIES  100000
+#define WORKING_SET         (64 << 20)
+
+/* Records per bucket: Rec_Batch_Count default, and larger settings */
+static const int BatchCounts[] = {64, 1024, 8192};
+
+/**
+ * A bucket, as both delivery paths see it: records allocated one by one, as
+ * LLAPI hands them over, or stored inline behind the message header.
+ */
+struct bench_bucket {
+    struct changelog_rec   **bb_records;
+    int                      bb_count;
+    size_t                   bb_size;
+    int                      bb_refcount;
+    struct px_rpc_enqueue   *bb_rpc;
+};
+
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_bucket_init(struct bench_bucket *bkt, long long first,
+                             int count)
+{
+    char    rec[BENCH_REC_MAX];
+    size_t  len;
+    int     i;
+
+    bkt->bb_records = calloc(count, sizeof(*bkt->bb_records));
+    bkt->bb_rpc     = malloc(sizeof(*bkt->bb_rpc) + count * BENCH_REC_MAX);
+    if (bkt->bb_records == NULL || bkt->bb_rpc == NULL)
+        return -ENOMEM;
+
+    bkt->bb_count = count;
+    bkt->bb_size  = bench_records(bkt->bb_rpc->pr_records, first, count);
+    bkt->bb_rpc->pr_count = count;
+
+    for (i = 0; i < count; i++) {
+        len = bench_record(rec, first + i);
+        bkt->bb_records[i] = malloc(len);
+        if (bkt->bb_records[i] == NULL)
+            return -ENOMEM;
+
+        memcpy(bkt->bb_records[i], rec, len);
+    }
+
+    return 0;
+}
+
+/**
+ * Delivery as it used to be: pack the records into a new message, which
+ * zmq_send() copies.
+ */
+static int bench_deliver_copy(const struct bench_bucket *bkt)
+{
+    struct px_rpc_enqueue   *rpc;
+    size_t                   rpc_size = sizeof(*rpc) + bkt->bb_size;
+    uint8_t                 *next;
+    void                    *zmsg;
+    size_t                   len;
+    int                      i;
+
+    rpc = calloc(1, rpc_size);
+    if (rpc == NULL)
+        return -ENOMEM;
+
+    rpc_hdr_init(&rpc->pr_hdr, RPC_OP_ENQUEUE);
+    rpc->pr_count = bkt->bb_count;
+
+    next = rpc->pr_records;
+    for (i = 0; i < bkt->bb_count; i++) {
+        len = changelog_rec_size(bkt->bb_records[i]) +
+              bkt->bb_records[i]->cr_namelen;
+        memcpy(next, bkt->bb_records[i], len);
+        next += len;
+    }
+
+    /* What zmq_send() does with it */
+    zmsg = malloc(rpc_size);
+    if (zmsg == NULL) {
+        free(rpc);
+        return -ENOMEM;
+    }
+
+    memcpy(zmsg, rpc, rpc_size);
+    free(rpc);
+
+    /* Opaque to the compiler, as sending it would be */
+    __asm__ volatile("" : : "r"(zmsg) : "memory");
+    free(zmsg);
+    return 0;
+}
+
+/**
+ * Delivery as it is now: reference the arena, dropped once ZMQ is done.
+ */
+static int bench_deliver_zc(struct bench_bucket *bkt)
+{
+    __atomic_add_fetch(&bkt->bb_refcount, 1, __ATOMIC_RELAXED);
+    __asm__ volatile("" : : "r"(bkt->bb_rpc) : "memory");
+    __atomic_sub_fetch(&bkt->bb_refcount, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static int bench_batch(int count, long deliveries)
+{
+    struct bench_bucket *bkts;
+    size_t               bytes = 0;
+    double               start;
+    double               copy;
+    double               zc;
+    int                  nbkts;
+    long                 i;
+    int                  rc = 0;
+
+    nbkts = WORKING_SET / (count * BENCH_REC_MAX) + 1;
+    bkts = calloc(nbkts, sizeof(*bkts));
+    if (bkts == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < nbkts; i++) {
+        rc = bench_bucket_init(&bkts[i], i * count, count);
+        if (rc)
+            return rc;
+
+        bytes += bkts[i].bb_size;
+    }
+
+    start = bench_now();
+    for (i = 0; i < deliveries && rc == 0; i++)
+        rc = bench_deliver_copy(&bkts[i % nbkts]);
+    copy = (bench_now() - start) / deliveries;
+
+    start = bench_now();
+    for (i = 0; i < deliveries && rc == 0; i++)
+        rc = bench_deliver_zc(&bkts[i % nbkts]);
+    zc = (bench_now() - start) / deliveries;
+
+    if (rc)
+        return rc;
+
+    printf("%5d records (%7zu bytes): %9.2f usec/delivery copied "
+           "(%.2f GB/s), %6.3f usec zero-copy, %zu bytes saved\n",
+           count, bytes / nbkts, copy * 1e6,
+           2.0 * bytes / nbkts / copy / 1e9, zc * 1e6, 2 * bytes / nbkts);
+
+    for (i = 0; i < nbkts; i++) {
+        while (bkts[i].bb_count > 0)
+            free(bkts[i].bb_records[--bkts[i].bb_count]);
+        free(bkts[i].bb_records);
+        free(bkts[i].bb_rpc);
+    }
+    free(bkts);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long    deliveries = DEFAULT_DELIVERIES;
+    int     i;
+    int     rc;
+
+    if (argc > 1)
+        deliveries = strtol(argv[1], NULL, 0);
+
+    if (deliveries <= 0) {
+        fprintf(stderr, "Usage: %s [deliveries per size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < sizeof(BatchCounts) / sizeof(BatchCounts[0]); i++) {
+        rc = bench_batch(BatchCounts[i], deliveries);
+        if (rc) {
+            fprintf(stderr, "Cannot run with %d records per bucket: %s\n",
+                    BatchCounts[i], strerror(-rc));
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,274 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Bytes on the wire and cost of filtered deliveries. The reader is built in, so
+ * that buckets of bench_records.h records are sent by its very delivery paths:
+ * enqueue_rec() as a whole for clients selecting everything, and
+ * enqueue_rec_filtered() for clients with a type mask and/or a filter
+ * expression. Messages go through an inproc socket, drained by a thread.
+ *
+ * Payload bytes (ENQUEUE headers included) are reported against the ones of
+ * the unfiltered buckets, for a 25% selection (type mask), a typical 10% one
+ * (type mask and parent directory) and a 1.5% one.
+ *
+ * Usage: run.sh enqueue_filtered [records per size]
+ */
+
+
+#include "reader.c"
+#include "bench_records.h"
+
+#include <stdio.h>
+
+#define DEFAULT_RECORDS     (1 << 20)
+#define BENCH_ENDPOINT      "inproc://bench"
+
+/* Defined by lcapd.c, which is not built in */
+int TerminateSig;
+
+/* Records per bucket: Rec_Batch_Count default, and larger settings */
+static const int BatchCounts[] = {64, 1024, 8192};
+
+/**
+ * Records selected by a client: a type mask and a filter expression, either
+ * of them optional.
+ */
+struct bench_selection {
+    const char  *bs_name;
+    uint64_t     bs_type_mask;
+    const char  *bs_filter;
+};
+
+static const struct bench_selection Selections[] = {
+    { "everything", 0, NULL },
+    { "CREAT", 1ULL << CL_CREATE, NULL },
+    { "CREAT|UNLNK in 3 of 16 dirs", (1ULL << CL_CREATE) | (1ULL << CL_UNLINK),
+      "pfid in {[0x200000007:0x1:0x0], [0x200000007:0x2:0x0], "
+               "[0x200000007:0x3:0x0]}" },
+    { "CREAT in 1 of 16 dirs", 1ULL << CL_CREATE,
+      "pfid = [0x200000007:0x1:0x0]" },
+};
+
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Receive and drop whatever the reader sends, until the context terminates.
+ */
+static void *bench_drain(void *args)
+{
+    zmq_msg_t   zmsg;
+
+    zmq_msg_init(&zmsg);
+    while (zmq_msg_recv(&zmsg, args, 0) >= 0)
+        ;
+
+    zmq_msg_close(&zmsg);
+    zmq_close(args);
+    return NULL;
+}
+
+static struct lcap_rec_bucket *bench_bucket_new(long long first, int count)
+{
+    struct lcap_rec_bucket  *bkt;
+
+    bkt = calloc(1, sizeof(*bkt) + count * BENCH_REC_MAX);
+    if (bkt == NULL)
+        return NULL;
+
+    rpc_hdr_init(&bkt->lrb_wire.bw_rpc.pr_hdr, RPC_OP_ENQUEUE);
+    bkt->lrb_wire.bw_capacity     = count * BENCH_REC_MAX;
+    bkt->lrb_wire.bw_rpc.pr_count = count;
+    bkt->lrb_size      = bench_records(bkt->lrb_wire.bw_rpc.pr_records, first,
+                                       count);
+    bkt->lrb_rec_count = count;
+    bkt->lrb_max_index = first + count - 1;
+    return bkt;
+}
+
+/**
+ * Deliver \a nbkts buckets to a client selecting \a sel, and report the
+ * payload bytes sent against \a all, the bytes of the whole buckets.
+ */
+static int bench_selection(struct reader_env *env, struct client_state *cs,
+                           struct lcap_rec_bucket **bkts, int nbkts,
+                           const struct bench_selection *sel, size_t *all)
+{
+    struct reader_stats  before = env->re_stats;
+    long long            last;
+    size_t               bytes;
+    double               start;
+    double               elapsed;
+    long                 records;
+    int                  msgs = 0;
+    int                  i;
+    int                  rc = 0;
+
+    cs->cs_type_mask = sel->bs_type_mask;
+    cs->cs_filter    = NULL;
+    if (sel->bs_filter != NULL) {
+        rc = rec_filter_compile(sel->bs_filter, &cs->cs_filter);
+        if (rc)
+            return rc;
+    }
+
+    start = bench_now();
+    for (i = 0; i < nbkts && rc >= 0; i++) {
+        if (client_filter_active(cs))
+            rc = enqueue_rec_filtered(env, bkts[i], cs, &last);
+        else
+            rc = enqueue_rec(env, bkts[i], cs);
+
+        if (rc == 0)
+            msgs++;
+    }
+    elapsed = bench_now() - start;
+
+    if (cs->cs_filter != NULL)
+        rec_filter_free(cs->cs_filter);
+
+    if (rc < 0)
+        return rc;
+
+    records = env->re_stats.rs_rec_sent - before.rs_rec_sent;
+    bytes   = env->re_stats.rs_bytes_sent - before.rs_bytes_sent +
+              msgs * sizeof(struct px_rpc_enqueue);
+    if (*all == 0)
+        *all = bytes;
+
+    printf("    %-28s %5.1f%% records, %11zu bytes (%5.1f%%) in %6d "
+           "messages, %6.1f ns/record\n", sel->bs_name,
+           100.0 * records / ((double)nbkts * bkts[0]->lrb_rec_count), bytes,
+           100.0 * bytes / *all, msgs,
+           elapsed * 1e9 / ((double)nbkts * bkts[0]->lrb_rec_count));
+    return 0;
+}
+
+static int bench_batch(struct reader_env *env, struct client_state *cs,
+                       int count, long records)
+{
+    struct lcap_rec_bucket **bkts;
+    size_t                   all = 0;
+    int                      nbkts = records / count;
+    int                      i;
+    int                      rc = 0;
+
+    if (nbkts == 0)
+        nbkts = 1;
+
+    bkts = calloc(nbkts, sizeof(*bkts));
+    if (bkts == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < nbkts; i++) {
+        bkts[i] = bench_bucket_new(1 + (long long)i * count, count);
+        if (bkts[i] == NULL) {
+            rc = -ENOMEM;
+            goto out_free;
+        }
+    }
+
+    printf("%5d records per bucket, %d buckets:\n", count, nbkts);
+    for (i = 0; i < sizeof(Selections) / sizeof(Selections[0]); i++) {
+        rc = bench_selection(env, cs, bkts, nbkts, &Selections[i], &all);
+        if (rc)
+            break;
+    }
+
+out_free:
+    for (i = 0; i < nbkts && bkts[i] != NULL; i++) {
+        /* Referenced by ZMQ until the drain thread gets them */
+        while (__atomic_load_n(&bkts[i]->lrb_wire.bw_refcount,
+                               __ATOMIC_SEQ_CST) > 0)
+            usleep(1000);
+
+        free(bkts[i]);
+    }
+    free(bkts);
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    struct reader_env       env;
+    struct consumer_group   grp;
+    struct client_state    *cs;
+    pthread_t               drain;
+    void                   *pull;
+    long                    records = DEFAULT_RECORDS;
+    int                     i;
+    int                     rc = 0;
+
+    if (argc > 1)
+        records = strtol(argv[1], NULL, 0);
+
+    if (records <= 0) {
+        fprintf(stderr, "Usage: %s [records per size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    lcap_set_loglevel(0);
+
+    memset(&env, 0, sizeof(env));
+    memset(&grp, 0, sizeof(grp));
+
+    cs = calloc(1, sizeof(*cs) + sizeof(struct conn_id) + 1);
+    if (cs == NULL)
+        return EXIT_FAILURE;
+
+    cs->cs_ident = (struct conn_id *)(cs + 1);
+    cs->cs_ident->ci_length  = 1;
+    cs->cs_ident->ci_data[0] = 'c';
+    cs->cs_version = LCAP_PROTO_VERSION;
+    cs->cs_group   = &grp;
+
+    env.re_zctx = zmq_ctx_new();
+    env.re_sock = zmq_socket(env.re_zctx, ZMQ_PUSH);
+    pull = zmq_socket(env.re_zctx, ZMQ_PULL);
+    if (zmq_bind(pull, BENCH_ENDPOINT) < 0 ||
+        zmq_connect(env.re_sock, BENCH_ENDPOINT) < 0 ||
+        pthread_create(&drain, NULL, bench_drain, pull)) {
+        fprintf(stderr, "Cannot set up %s\n", BENCH_ENDPOINT);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < sizeof(BatchCounts) / sizeof(BatchCounts[0]); i++) {
+        rc = bench_batch(&env, cs, BatchCounts[i], records);
+        if (rc) {
+            fprintf(stderr, "Cannot run with %d records per bucket: %s\n",
+                    BatchCounts[i], strerror(-rc));
+            break;
+        }
+    }
+
+    zmq_close(env.re_sock);
+    zmq_ctx_destroy(env.re_zctx);
+    pthread_join(drain, NULL);
+    free(cs);
+    return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
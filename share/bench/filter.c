@@ -0,0 +1,152 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Evaluation cost of compiled filter expressions, in ns per record. A few
+ * representative expressions are compiled once, then rec_filter_match() is
+ * timed over a bucket of records of bench_records.h, as many passes as it takes
+ * to evaluate about EVALUATIONS records. The cost of walking the records alone
+ * is printed first. The share of records matching is printed along, as
+ * short-circuits make the cost depend on it.
+ *
+ * Usage: run.sh filter [records per bucket]
+ */
+
+
+#include "filter.h"
+#include "bench_records.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include <lcap_log.h>
+
+#define DEFAULT_RECORDS     8192
+#define EVALUATIONS         (1L << 24)
+
+static const char *Expressions[] = {
+    NULL,
+    "type in {CREAT, UNLNK}",
+    "jobid ^= \"dd.501\"",
+    "pfid in {[0x200000007:0x1:0x0], [0x200000007:0x5:0x0], "
+             "[0x200000007:0x9:0x0], [0x200000007:0xd:0x0]}",
+    "(type = CREAT or type = UNLNK) and not jobid = \"dd.500\" "
+        "and pfid in {[0x200000007:0x1:0x0], [0x200000007:0x2:0x0]}",
+    "not (type = CLOSE or type = SATTR) and (name ^= \"file.1\" or "
+        "jobid = \"dd.503\")",
+};
+
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Time the evaluation of \a expr over the \a count records of \a recs, or
+ * walking them only if NULL.
+ */
+static int bench_filter(const char *expr, const void *recs, int count)
+{
+    const struct changelog_rec  *rec;
+    struct rec_filter           *filter = NULL;
+    const char                  *pos;
+    double                       start;
+    double                       elapsed;
+    long                         matches = 0;
+    long                         passes;
+    long                         pass;
+    int                          i;
+    int                          rc;
+
+    if (expr != NULL) {
+        rc = rec_filter_compile(expr, &filter);
+        if (rc)
+            return rc;
+    }
+
+    passes = EVALUATIONS / count + 1;
+
+    start = bench_now();
+    for (pass = 0; pass < passes; pass++) {
+        for (i = 0, pos = recs; i < count; i++) {
+            rec = (const struct changelog_rec *)pos;
+            if (filter == NULL || rec_filter_match(filter, rec))
+                matches++;
+
+            pos += changelog_rec_size((struct changelog_rec *)rec) +
+                   rec->cr_namelen;
+        }
+    }
+    elapsed = bench_now() - start;
+
+    printf("%6.1f ns/record, %5.1f%% matching: %s\n",
+           elapsed * 1e9 / ((double)count * passes),
+           100.0 * matches / ((double)count * passes),
+           expr != NULL ? expr : "(no filter)");
+
+    if (filter != NULL)
+        rec_filter_free(filter);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int     count = DEFAULT_RECORDS;
+    void   *recs;
+    int     i;
+    int     rc;
+
+    if (argc > 1)
+        count = atoi(argv[1]);
+
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [records per bucket]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    lcap_set_loglevel(0);
+
+    recs = malloc((size_t)count * BENCH_REC_MAX);
+    if (recs == NULL) {
+        fprintf(stderr, "Cannot allocate %d records\n", count);
+        return EXIT_FAILURE;
+    }
+
+    bench_records(recs, 1, count);
+
+    for (i = 0; i < sizeof(Expressions) / sizeof(Expressions[0]); i++) {
+        rc = bench_filter(Expressions[i], recs, count);
+        if (rc) {
+            fprintf(stderr, "Cannot compile '%s': %s\n", Expressions[i],
+                    strerror(-rc));
+            return EXIT_FAILURE;
+        }
+    }
+
+    free(recs);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Time how long lcapd takes to reopen its spill log on restart, with a cold
+# page cache, with and without the index files of the segments.
+#
+# Usage: restart.sh <directory> [records] [records per bucket]
+#                   [segment size (MiB)]
+#
+# A backlog of 10M records (by default) is written to a new spill directory
+# below <directory>, which should live on the file system lcapd spills to.
+# Then the page cache is dropped before each open, which takes root; opens are
+# timed with a warm cache otherwise. The spill directory is removed afterwards.
+
+die()
+{
+    echo "$*" >&2
+    exit 1
+}
+
+[ $# -ge 1 ] || die "Usage: $0 <directory> [records] [records per bucket]" \
+                    "[segment size (MiB)]"
+
+RUN=$(dirname "$0")/run.sh
+SPILL=$1/lcap-restart.$$
+shift
+
+drop_caches()
+{
+    sync
+    if [ "$(id -u)" -eq 0 ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+    else
+        echo "Not root, the page cache is left as is" >&2
+    fi
+}
+
+trap 'rm -rf "$SPILL"' EXIT
+
+mkdir -p "$SPILL" || die "Cannot create $SPILL"
+
+"$RUN" segment_open write "$SPILL" "$@" || die "Cannot write the backlog"
+du -sh "$SPILL"
+
+for i in 1 2 3; do
+    drop_caches
+    echo -n "Indexed: "
+    "$RUN" segment_open open "$SPILL" || die "Cannot open the backlog"
+
+    # Closing the log writes the index files again
+    rm -f "$SPILL"/*.idx
+    drop_caches
+    echo -n "Scanned: "
+    "$RUN" segment_open open "$SPILL" || die "Cannot open the backlog"
+done
@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# Build one of the benchmarks of this directory along with the lcapd sources it
+# exercises, and run it.
+#
+# Usage: run.sh <benchmark> [arguments...]
+#
+# <benchmark> is the name of a source file of this directory, without its .c
+# suffix, whose header comment tells what it measures and how. The tree has to
+# be configured. CC, CFLAGS and LIBS are honored.
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2 -g}
+LIBS=${LIBS:--lzmq -llustreapi -lz -lpthread}
+
+die()
+{
+    echo "$*" >&2
+    exit 1
+}
+
+[ $# -ge 1 ] || die "Usage: $0 <benchmark> [arguments...]"
+
+BENCH=$1
+shift
+
+TOP=$(cd "$(dirname "$0")/../.." && pwd)
+SRC=$TOP/share/bench/$BENCH.c
+BIN=${TMPDIR:-/tmp}/lcap-bench-$BENCH.$$
+
+[ -f "$SRC" ] || die "No such benchmark: $BENCH"
+
+trap 'rm -f "$BIN"' EXIT
+
+$CC $CFLAGS -std=gnu99 -DHAVE_CONFIG_H -D_GNU_SOURCE \
+    -I"$TOP/src/include" -I"$TOP/src/lcapd" -o "$BIN" "$SRC" \
+    "$TOP/src/lcapd/filter.c" "$TOP/src/lcapd/segment.c" \
+    "$TOP/src/lcapd/rpc_utils.c" "$TOP/src/lcapnet/lcap_net.c" \
+    "$TOP/src/common/lcap_columns.c" "$TOP/src/common/lcap_log.c" \
+    $LIBS || die "Cannot build $BENCH"
+
+"$BIN" "$@"
@@ -0,0 +1,180 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Restart cost of the spill log: time segment_log_open() over a backlog left
+ * by a previous instance, as lcapd does on startup. See restart.sh, which
+ * builds the backlog and drops the page cache before each open.
+ *
+ * Usage: run.sh segment_open write <dir> [records] [records per bucket]
+ *                                        [segment size (MiB)]
+ *        run.sh segment_open open <dir>
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "lcapd_internal.h"
+#include "segment.h"
+
+#define DEFAULT_RECORDS     10000000L
+#define DEFAULT_PER_BUCKET  8192
+#define DEFAULT_SEG_SIZE    64  /* MiB, as Spill_Segment_Size */
+
+/* Average size of a record along with its name */
+#define REC_SIZE            128
+
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_write(const char *dir, long records, long per_bucket,
+                       size_t seg_size)
+{
+    struct segment_log   log;
+    size_t               len = per_bucket * REC_SIZE;
+    char                *recs;
+    double               start;
+    long                 count;
+    long                 i;
+    int                  rc;
+
+    recs = malloc(len);
+    if (recs == NULL)
+        return -ENOMEM;
+
+    /* Contents do not matter, but for checksums not to be trivial */
+    for (i = 0; i < len; i++)
+        recs[i] = random();
+
+    rc = segment_log_open(&log, dir, seg_size);
+    if (rc)
+        goto out_free;
+
+    if (log.sl_backlog > 0) {
+        fprintf(stderr, "%s holds a backlog already\n", dir);
+        rc = -EEXIST;
+        goto out_close;
+    }
+
+    start = bench_now();
+    for (i = 0; i < records; i += count) {
+        count = records - i < per_bucket ? records - i : per_bucket;
+        rc = segment_append(&log, recs, count * REC_SIZE, count, i + count,
+                            i, i + count);
+        if (rc)
+            goto out_close;
+    }
+
+    rc = segment_sync(&log);
+    if (rc)
+        goto out_close;
+
+    printf("Wrote %ld records in %ld buckets in %.2f s\n", records,
+           log.sl_backlog, bench_now() - start);
+
+out_close:
+    segment_log_close(&log);
+out_free:
+    free(recs);
+    return rc;
+}
+
+static int bench_open(const char *dir)
+{
+    struct segment_log   log;
+    double               start;
+    double               elapsed;
+    int                  rc;
+
+    start = bench_now();
+    rc = segment_log_open(&log, dir, DEFAULT_SEG_SIZE << 20);
+    elapsed = bench_now() - start;
+    if (rc)
+        return rc;
+
+    printf("Opened a backlog of %ld buckets (records up to %lld) in %.1f ms\n",
+           log.sl_backlog, log.sl_max_index, elapsed * 1000);
+
+    segment_log_close(&log);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s write <dir> [records] [records per bucket] "
+            "[segment size (MiB)]\n"
+            "       %s open <dir>\n", name, name);
+}
+
+int main(int argc, char **argv)
+{
+    long    records = DEFAULT_RECORDS;
+    long    per_bucket = DEFAULT_PER_BUCKET;
+    long    seg_size = DEFAULT_SEG_SIZE;
+    int     rc;
+
+    lcap_set_loglevel(0);
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(argv[1], "open") == 0) {
+        rc = bench_open(argv[2]);
+    } else if (strcmp(argv[1], "write") == 0) {
+        if (argc > 3)
+            records = strtol(argv[3], NULL, 0);
+        if (argc > 4)
+            per_bucket = strtol(argv[4], NULL, 0);
+        if (argc > 5)
+            seg_size = strtol(argv[5], NULL, 0);
+
+        if (records <= 0 || per_bucket <= 0 || seg_size <= 0 ||
+            segment_min_size(per_bucket * REC_SIZE) > (size_t)seg_size << 20) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        rc = bench_write(argv[2], records, per_bucket,
+                         (size_t)seg_size << 20);
+    } else {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (rc) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(-rc));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
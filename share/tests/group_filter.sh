@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Two members of a consumer group, one of them only asking for creations, must
+# both get every record they select.
+#
+# Usage: group_filter.sh <mdtname> <directory served by that MDT>
+#
+# Expects lcapd to be running and serving <mdtname>. The lcap tool is looked up
+# in the PATH unless LCAP is set.
+
+LCAP=${LCAP:-lcap}
+COUNT=${COUNT:-1000}
+TIMEOUT=${TIMEOUT:-60}
+
+die()
+{
+    echo "$*" >&2
+    exit 1
+}
+
+[ $# -eq 2 ] || die "Usage: $0 <mdtname> <directory>"
+
+MDT=$1
+TAG=lcaptest.$$
+DIR=$2/$TAG
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf "$OUT" "$DIR"' EXIT
+
+# 1 << CL_CREATE
+creat()
+{
+    LCAP_GROUP=$TAG LCAP_TYPE_MASK=0x2 "$LCAP" "$MDT" >> "$OUT/creat"
+}
+
+every()
+{
+    LCAP_GROUP=$TAG "$LCAP" "$MDT" >> "$OUT/every"
+}
+
+# Lines of file $1 about our records of type $2
+count()
+{
+    grep -c " $2 .* $TAG\.[0-9]*\$" "$1"
+}
+
+# Register both members, so that records are kept for them from now on
+creat || die "Cannot start filtering member"
+every || die "Cannot start regular member"
+
+mkdir "$DIR" || exit 1
+for i in $(seq $COUNT); do
+    touch "$DIR/$TAG.$i" && rm "$DIR/$TAG.$i" || exit 1
+done
+
+# Members read in turn until they got it all
+elapsed=0
+while [ $elapsed -lt $TIMEOUT ]; do
+    creat || die "Filtering member failed"
+    every || die "Regular member failed"
+
+    if [ $(count "$OUT/creat" 01CREAT) -ge $COUNT ] &&
+       [ $(count "$OUT/every" 06UNLNK) -ge $COUNT ]; then
+        break
+    fi
+
+    sleep 1
+    elapsed=$((elapsed + 1))
+done
+
+rc=0
+check()
+{
+    if [ "$3" -ne "$4" ]; then
+        echo "FAIL: $1 member got $3 $2 records, $4 expected" >&2
+        rc=1
+    fi
+}
+
+check filtering CREAT $(count "$OUT/creat" 01CREAT) $COUNT
+check filtering other $(grep -vc " 01CREAT " "$OUT/creat") 0
+check regular CREAT $(count "$OUT/every" 01CREAT) $COUNT
+check regular UNLNK $(count "$OUT/every" 06UNLNK) $COUNT
+
+[ $rc -eq 0 ] && echo "PASS"
+exit $rc
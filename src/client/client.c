@@ -22,10 +22,22 @@
 
 #include "lcap_client.h"
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 
 
 extern struct lcap_cl_operations cl_ops_null;
 extern struct lcap_cl_operations cl_ops_proxy;
+extern struct lcap_cl_operations cl_ops_merge;
+
+
+/**
+ * Whether a device name stands for several MDTs, to be read merged.
+ */
+static bool mdtname_is_set(const char *mdtname)
+{
+    return strchr(mdtname, ',') != NULL || strcmp(mdtname, LCAP_MDT_ALL) == 0;
+}
 
 
 int lcap_changelog_start(struct lcap_cl_ctx **pctx, enum lcap_cl_flags flags,
@@ -38,7 +50,9 @@ int lcap_changelog_start(struct lcap_cl_ctx **pctx, enum lcap_cl_flags flags,
     if (ctx == NULL)
         return -ENOMEM;
 
-    if (flags & LCAP_CL_DIRECT)
+    if (mdtname_is_set(mdtname))
+        ctx->ccc_ops = &cl_ops_merge;
+    else if (flags & LCAP_CL_DIRECT)
         ctx->ccc_ops = &cl_ops_null;
     else
         ctx->ccc_ops = &cl_ops_proxy;
@@ -44,7 +44,11 @@ static int lu_changelog_start(struct lcap_cl_ctx *ctx, enum lcap_cl_flags flags,
                               const char *mdtname, long long startrec)
 {
     int lu_flags;
-    
+
+    /* Lustre only knows about record indexes */
+    if (flags & LCAP_CL_START_TIME)
+        return -EOPNOTSUPP;
+
     lu_flags = flags_translate(flags);
     return llapi_changelog_start(&ctx->ccc_ptr, lu_flags, mdtname, startrec);
 }
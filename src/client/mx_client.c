@@ -0,0 +1,406 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Merged reading of several MDTs. Each one is read through a proxy context of
+ * its own, hence its own connection and credit window: readers keep serving
+ * their buckets independently while records get merged here, by a k-way merge
+ * of the next record of each MDT, ordered by cr_time.
+ *
+ * An MDT with nothing left is only asked again once the merged stream reaches
+ * the time it ran dry, since the records it gets from then on are newer.
+ */
+
+
+#include <lcap_client.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+
+/**
+ * One of the merged MDTs.
+ */
+struct mx_member {
+    struct lcap_cl_ctx      *mm_ctx;    /**< Proxy context of this MDT */
+    const char              *mm_mdt;    /**< Device name */
+    struct changelog_rec    *mm_head;   /**< Next record, if not dry */
+    bool                     mm_dry;    /**< Had nothing left when asked */
+    uint64_t                 mm_dry_since; /**< When, as a cr_time */
+    long long                mm_cursor; /**< Last record delivered, 0 if none */
+};
+
+struct mx_data {
+    char                    *mx_name;   /**< Name given on start */
+    char                    *mx_names;  /**< Device names, NUL separated */
+    struct mx_member        *mx_members;
+    int                      mx_count;
+    int                      mx_dry;    /**< Number of dry members */
+    int                     *mx_heap;   /**< Members by time of their head */
+    int                      mx_heap_len;
+    int                      mx_last;   /**< Member of the last record
+                                             delivered, -1 if none */
+    bool                     mx_refill; /**< Its head is to be replaced */
+};
+
+
+/**
+ * Current time, packed as cr_time so that both can be compared.
+ */
+static uint64_t mx_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec << 30) | ts.tv_nsec;
+}
+
+/**
+ * Whether the head of member \a a goes before the one of member \a b. Members
+ * order records of the same time, for the merge to be deterministic.
+ */
+static bool mx_before(const struct mx_data *mx, int a, int b)
+{
+    const struct changelog_rec  *rec_a = mx->mx_members[a].mm_head;
+    const struct changelog_rec  *rec_b = mx->mx_members[b].mm_head;
+
+    if (rec_a->cr_time != rec_b->cr_time)
+        return rec_a->cr_time < rec_b->cr_time;
+
+    return a < b;
+}
+
+static void mx_heap_push(struct mx_data *mx, int member)
+{
+    int i = mx->mx_heap_len++;
+    int parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!mx_before(mx, member, mx->mx_heap[parent]))
+            break;
+
+        mx->mx_heap[i] = mx->mx_heap[parent];
+        i = parent;
+    }
+
+    mx->mx_heap[i] = member;
+}
+
+static int mx_heap_pop(struct mx_data *mx)
+{
+    int top = mx->mx_heap[0];
+    int last = mx->mx_heap[--mx->mx_heap_len];
+    int i = 0;
+    int child;
+
+    if (mx->mx_heap_len == 0)
+        return top;
+
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= mx->mx_heap_len)
+            break;
+
+        if (child + 1 < mx->mx_heap_len &&
+            mx_before(mx, mx->mx_heap[child + 1], mx->mx_heap[child]))
+            child++;
+
+        if (!mx_before(mx, mx->mx_heap[child], last))
+            break;
+
+        mx->mx_heap[i] = mx->mx_heap[child];
+        i = child;
+    }
+
+    mx->mx_heap[i] = last;
+    return top;
+}
+
+/**
+ * Get the next record of a member, which is either queued by time or marked
+ * dry.
+ */
+static int mx_member_fetch(struct mx_data *mx, int idx)
+{
+    struct mx_member    *member = &mx->mx_members[idx];
+    int                  rc;
+
+    rc = lcap_changelog_recv(member->mm_ctx, &member->mm_head);
+    if (rc < 0)
+        return rc;
+
+    if (rc > 0) {
+        if (!member->mm_dry)
+            mx->mx_dry++;
+
+        member->mm_head      = NULL;
+        member->mm_dry       = true;
+        member->mm_dry_since = mx_now();
+        return 0;
+    }
+
+    if (member->mm_dry)
+        mx->mx_dry--;
+
+    member->mm_dry = false;
+    mx_heap_push(mx, idx);
+    return 0;
+}
+
+static struct mx_member *mx_member_find(struct mx_data *mx, const char *mdtname)
+{
+    int i;
+
+    for (i = 0; i < mx->mx_count; i++) {
+        if (strcmp(mx->mx_members[i].mm_mdt, mdtname) == 0)
+            return &mx->mx_members[i];
+    }
+
+    return NULL;
+}
+
+static void mx_destroy(struct mx_data *mx)
+{
+    free(mx->mx_name);
+    free(mx->mx_names);
+    free(mx->mx_members);
+    free(mx->mx_heap);
+    free(mx);
+}
+
+static int mx_changelog_fini(struct lcap_cl_ctx *ctx)
+{
+    struct mx_data  *mx = (struct mx_data *)ctx->ccc_ptr;
+    int              rc = 0;
+    int              rc2;
+    int              i;
+
+    if (mx == NULL)
+        return -EINVAL;
+
+    for (i = 0; i < mx->mx_count; i++) {
+        if (mx->mx_members[i].mm_ctx == NULL)
+            continue;
+
+        rc2 = lcap_changelog_fini(mx->mx_members[i].mm_ctx);
+        if (rc2 && rc == 0)
+            rc = rc2;
+
+        free(mx->mx_members[i].mm_ctx);
+    }
+
+    mx_destroy(mx);
+    ctx->ccc_ptr = NULL;
+    return rc;
+}
+
+static int mx_changelog_start(struct lcap_cl_ctx *ctx, enum lcap_cl_flags flags,
+                              const char *mdtname, long long startrec)
+{
+    struct mx_data  *mx;
+    const char      *names = mdtname;
+    char            *name;
+    char            *save;
+    int              count;
+    int              rc;
+
+    /* Waiting for pushed records would stall the other MDTs */
+    if (flags & LCAP_CL_STREAM)
+        return -EOPNOTSUPP;
+
+    if (flags & LCAP_CL_DIRECT)
+        return -EOPNOTSUPP;
+
+    /* Record indexes are specific to each MDT, unlike times */
+    if (startrec != 0 && !(flags & LCAP_CL_START_TIME))
+        return -EINVAL;
+
+    if (strcmp(mdtname, LCAP_MDT_ALL) == 0) {
+        names = getenv(LCAP_ENV_MDTS);
+        if (names == NULL)
+            return -EINVAL;
+    }
+
+    mx = calloc(1, sizeof(*mx));
+    if (mx == NULL)
+        return -ENOMEM;
+
+    mx->mx_last  = -1;
+    mx->mx_name  = strdup(mdtname);
+    mx->mx_names = strdup(names);
+    if (mx->mx_name == NULL || mx->mx_names == NULL) {
+        mx_destroy(mx);
+        return -ENOMEM;
+    }
+
+    for (count = 1, name = mx->mx_names; *name != '\0'; name++) {
+        if (*name == ',')
+            count++;
+    }
+
+    mx->mx_members = calloc(count, sizeof(*mx->mx_members));
+    mx->mx_heap    = calloc(count, sizeof(*mx->mx_heap));
+    if (mx->mx_members == NULL || mx->mx_heap == NULL) {
+        mx_destroy(mx);
+        return -ENOMEM;
+    }
+
+    ctx->ccc_ptr = (void *)mx;
+
+    for (name = strtok_r(mx->mx_names, ",", &save); name != NULL;
+         name = strtok_r(NULL, ",", &save)) {
+        struct mx_member    *member = &mx->mx_members[mx->mx_count++];
+
+        rc = lcap_changelog_start(&member->mm_ctx, flags, name, startrec);
+        if (rc < 0)
+            goto out_fini;
+
+        /* Asked first thing */
+        member->mm_mdt = name;
+        member->mm_dry = true;
+        mx->mx_dry++;
+    }
+
+    if (mx->mx_count == 0) {
+        rc = -EINVAL;
+        goto out_fini;
+    }
+
+    return 0;
+
+out_fini:
+    mx_changelog_fini(ctx);
+    return rc;
+}
+
+static int mx_changelog_recv(struct lcap_cl_ctx *ctx,
+                             struct changelog_rec **rec)
+{
+    struct mx_data      *mx = (struct mx_data *)ctx->ccc_ptr;
+    struct mx_member    *member;
+    int                  i;
+    int                  rc;
+
+    if (mx->mx_refill) {
+        mx->mx_refill = false;
+        rc = mx_member_fetch(mx, mx->mx_last);
+        if (rc < 0)
+            return rc;
+    }
+
+    for (i = 0; mx->mx_dry > 0 && i < mx->mx_count; i++) {
+        member = &mx->mx_members[i];
+        if (!member->mm_dry)
+            continue;
+
+        if (mx->mx_heap_len > 0 &&
+            mx->mx_members[mx->mx_heap[0]].mm_head->cr_time <
+            member->mm_dry_since)
+            continue;
+
+        rc = mx_member_fetch(mx, i);
+        if (rc < 0)
+            return rc;
+    }
+
+    if (mx->mx_heap_len == 0)
+        return 1;   /* EOF */
+
+    mx->mx_last   = mx_heap_pop(mx);
+    mx->mx_refill = true;
+
+    member = &mx->mx_members[mx->mx_last];
+    member->mm_cursor = member->mm_head->cr_index;
+    *rec = member->mm_head;
+    member->mm_head = NULL;
+    return 0;
+}
+
+static int mx_changelog_free(struct lcap_cl_ctx *ctx,
+                             struct changelog_rec **rec)
+{
+    struct mx_data  *mx = (struct mx_data *)ctx->ccc_ptr;
+
+    if (mx->mx_last < 0)
+        return -EINVAL;
+
+    return lcap_changelog_free(mx->mx_members[mx->mx_last].mm_ctx, rec);
+}
+
+/**
+ * Clear records of one of the MDTs, or of all of them up to their own cursor
+ * (the last record delivered) when named as on start.
+ */
+static int mx_changelog_clear(struct lcap_cl_ctx *ctx, const char *mdtname,
+                              const char *id, long long endrec)
+{
+    struct mx_data      *mx = (struct mx_data *)ctx->ccc_ptr;
+    struct mx_member    *member;
+    int                  rc;
+    int                  i;
+
+    if (strcmp(mdtname, mx->mx_name) != 0) {
+        member = mx_member_find(mx, mdtname);
+        if (member == NULL)
+            return -ENODEV;
+
+        return lcap_changelog_clear(member->mm_ctx, mdtname, id, endrec);
+    }
+
+    /* Indexes are specific to each MDT */
+    if (endrec != 0)
+        return -EINVAL;
+
+    for (i = 0; i < mx->mx_count; i++) {
+        member = &mx->mx_members[i];
+        if (member->mm_cursor == 0)
+            continue;
+
+        rc = lcap_changelog_clear(member->mm_ctx, member->mm_mdt, id,
+                                  member->mm_cursor);
+        if (rc < 0)
+            return rc;
+    }
+
+    return 0;
+}
+
+static int mx_changelog_origin(struct lcap_cl_ctx *ctx, const char **mdtname)
+{
+    struct mx_data  *mx = (struct mx_data *)ctx->ccc_ptr;
+
+    if (mx->mx_last < 0)
+        return -ENODATA;
+
+    *mdtname = mx->mx_members[mx->mx_last].mm_mdt;
+    return 0;
+}
+
+struct lcap_cl_operations cl_ops_merge = {
+    .cco_start  = mx_changelog_start,
+    .cco_fini   = mx_changelog_fini,
+    .cco_recv   = mx_changelog_recv,
+    .cco_free   = mx_changelog_free,
+    .cco_clear  = mx_changelog_clear,
+    .cco_origin = mx_changelog_origin
+};
@@ -21,34 +21,98 @@
 
 
 #include <lcap_client.h>
+#include <lcap_columns.h>
+#include <queue.h>
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <zmq.h>
 
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 #define DEFAULT_CACHE_SIZE  256
 
+/**
+ * Number of buckets to ask the server to let us hold at a time, unless
+ * overridden by LCAP_ENV_CREDITS.
+ */
+#define DEFAULT_CREDITS     4
+
+
+/**
+ * Reply to a pipelined DEQUEUE, received while waiting for another one.
+ */
+struct px_stashed_rep {
+    struct list_node    psr_node;
+    char               *psr_buff;
+    int                 psr_len;
+};
 
 struct px_zmq_data {
     void                     *zmq_ctx;  /**< 0MQ context */
     void                     *zmq_srv;  /**< Socket to server */
     void                     *rec_buff; /**< RPC buffer containing records */
+    size_t                    rec_len;  /**< Length of its payload */
     struct changelog_rec    **records;  /**< Undelivered (cached) records */
+    bool                      rec_columnar; /**< Payload encoded by columns,
+                                                 records rebuilt on demand */
+    void                     *rec_raw;  /**< Records rebuilt from columns */
+    void                     *col_buff; /**< Columns encoded from records */
+    bool                      col_taken; /**< Batch consumed by columns */
+    struct lcap_col_batch     cols;     /**< Columns of the current batch,
+                                             if rec_columnar or col_buff */
     long long                 rec_nxt;  /**< Next record to read */
     long long                 rec_cnt;  /**< High watermark */
     int                       rec_mdt_len;
     char                      rec_mdt[128];
+    uint32_t                  version;  /**< Protocol version of the server,
+                                             as of its last ACK */
+    bool                      stream;   /**< Records are pushed to us */
+    int                       credits;  /**< Buckets we can hold at a time */
+    int                       inflight; /**< DEQUEUE RPCs waiting for a reply */
+    struct list               stash;    /**< Replies received ahead of time */
+    long long                *held;     /**< Last record of each bucket
+                                             received and not cleared yet */
+    int                       held_cnt;
 };
 
+/**
+ * Release the buffers of the current batch.
+ */
+static void pzd_batch_release(struct px_zmq_data *pzd)
+{
+    free(pzd->rec_buff);
+    free(pzd->rec_raw);
+    free(pzd->col_buff);
+    pzd->rec_buff     = NULL;
+    pzd->rec_raw      = NULL;
+    pzd->col_buff     = NULL;
+    pzd->rec_columnar = false;
+    pzd->col_taken    = false;
+}
+
 static int pzd_destroy(struct px_zmq_data *pzd)
 {
+    struct list_node        *lnode;
+    struct px_stashed_rep   *psr;
+
     if (pzd->zmq_srv != NULL)
         zmq_close(pzd->zmq_srv);
 
     if (pzd->zmq_ctx != NULL)
         zmq_ctx_destroy(pzd->zmq_ctx);
 
-    free(pzd->rec_buff);
+    while ((lnode = list_pop_head(&pzd->stash)) != NULL) {
+        psr = list_entry(lnode, struct px_stashed_rep, psr_node);
+        free(psr->psr_buff);
+        free(psr);
+    }
+
+    pzd_batch_release(pzd);
     free(pzd->records);
+    free(pzd->held);
     memset(pzd, 0, sizeof(*pzd));
     return 0;
 }
@@ -73,7 +137,8 @@ static int pzd_init(struct px_zmq_data *pzd, const char *mdtname)
         goto err_cleanup;
     }
 
-    pzd->zmq_srv = zmq_socket(pzd->zmq_ctx, ZMQ_REQ);
+    /* Not ZMQ_REQ, so that several requests can be in flight */
+    pzd->zmq_srv = zmq_socket(pzd->zmq_ctx, ZMQ_DEALER);
     if (pzd->zmq_srv == NULL) {
         rc = -errno;
         goto err_cleanup;
@@ -109,21 +174,104 @@ static const char *px_rec_uri(void)
     //return secure_getenv(LCAP_REC_URI);
 }
 
-static int cl_start_pack(struct px_rpc_register *msg, int flags,
+/**
+ * Lease duration requested to the server, 0 to use its default.
+ */
+static uint32_t px_ack_timeout(void)
+{
+    const char  *timeout = getenv(LCAP_ENV_ACK_TIMEOUT);
+
+    if (timeout == NULL)
+        return 0;
+
+    return strtoul(timeout, NULL, 10);
+}
+
+/**
+ * Credit window requested to the server, which may grant less.
+ */
+static uint32_t px_credits(void)
+{
+    const char  *credits = getenv(LCAP_ENV_CREDITS);
+
+    if (credits == NULL)
+        return DEFAULT_CREDITS;
+
+    return strtoul(credits, NULL, 10);
+}
+
+/**
+ * Server-side filter, as a mask of record types and cr_flags. Zero (default)
+ * lets everything through.
+ */
+static uint64_t px_env_mask(const char *name)
+{
+    const char  *mask = getenv(name);
+
+    if (mask == NULL)
+        return 0;
+
+    return strtoull(mask, NULL, 0);
+}
+
+/**
+ * Consumer group to join, NULL for the default one.
+ */
+static const char *px_group(void)
+{
+    return getenv(LCAP_ENV_GROUP);
+}
+
+/**
+ * Build a START message, trailed by the filter expression if any. The message
+ * is allocated and its length stored into \a len.
+ */
+static int cl_start_pack(struct px_rpc_register **reg, size_t *len, int flags,
                          const char *mdtname, long long startrec)
 {
-    memset(msg, 0, sizeof(*msg));
-    msg->pr_hdr.op_type = RPC_OP_START;
+    struct px_rpc_register  *msg;
+    const char              *group  = px_group();
+    const char              *filter = getenv(LCAP_ENV_FILTER);
+    size_t                   filter_len = 0;
+
+    if (group != NULL && strlen(group) >= sizeof(msg->pr_group))
+        return -ENAMETOOLONG;
+
+    if (filter != NULL && *filter != '\0')
+        filter_len = strlen(filter) + 1;
+
+    msg = calloc(1, sizeof(*msg) + filter_len);
+    if (msg == NULL)
+        return -ENOMEM;
+
+    rpc_hdr_init(&msg->pr_hdr, RPC_OP_START);
     msg->pr_start = startrec;
     msg->pr_flags = flags;
+#ifndef HAVE_LIBZ
+    /* Do not get records we could not decompress */
+    msg->pr_flags &= ~LCAP_CL_COMPRESS;
+#endif
+    msg->pr_ack_timeout = px_ack_timeout();
+    msg->pr_credits = px_credits();
+    msg->pr_type_mask  = px_env_mask(LCAP_ENV_TYPE_MASK);
+    msg->pr_flags_mask = px_env_mask(LCAP_ENV_FLAGS_MASK);
     strncpy((char *)msg->pr_mdtname, mdtname, sizeof(msg->pr_mdtname));
+    if (group != NULL)
+        strcpy((char *)msg->pr_group, group);
+
+    msg->pr_filter_len = filter_len;
+    if (filter_len > 0)
+        memcpy(msg->pr_filter, filter, filter_len);
+
+    *reg = msg;
+    *len = sizeof(*msg) + filter_len;
     return 0;
 }
 
 static int cl_dequeue_pack(struct px_rpc_dequeue *msg)
 {
     memset(msg, 0, sizeof(*msg));
-    msg->pr_hdr.op_type = RPC_OP_DEQUEUE;
+    rpc_hdr_init(&msg->pr_hdr, RPC_OP_DEQUEUE);
     return 0;
 }
 
@@ -133,7 +281,7 @@ static int cl_clear_pack(struct px_rpc_clear *msg, const char *mdtname,
     size_t id_len;
     size_t dev_len;
 
-    msg->pr_hdr.op_type = RPC_OP_CLEAR;
+    rpc_hdr_init(&msg->pr_hdr, RPC_OP_CLEAR);
     msg->pr_index = endrec;
 
     id_len = strlen(id);
@@ -149,13 +297,16 @@ static int cl_clear_pack(struct px_rpc_clear *msg, const char *mdtname,
  * Send a request to the server. The request is composed of two top frames:
  * A first one identifying the targetted MDT, a second one with the actual RPC
  * body.
- * The ZMQ_REQ socket we use will add another (envelope) one, but that's server
- * business...
+ * They come after an empty delimiter frame, as a ZMQ_REQ socket would do.
  */
 static int px_rpc_send(struct px_zmq_data *pzd, char *rpc, size_t rpc_size)
 {
     int rc;
 
+    rc = zmq_send(pzd->zmq_srv, "", 0, ZMQ_SNDMORE);
+    if (rc < 0)
+        return -errno;
+
     rc = zmq_send(pzd->zmq_srv, pzd->rec_mdt, pzd->rec_mdt_len, ZMQ_SNDMORE);
     if (rc < 0)
         return -errno;
@@ -192,27 +343,145 @@ static int cl_rep_recv(struct px_zmq_data *pzd, char *buff, size_t bufflen)
     return rcvd;
 }
 
-static int cl_ack_retcode(struct px_zmq_data *pzd)
+#define RECV_BUFFER_LENGTH  8 * 1024 * 1024
+
+/**
+ * Receive the next reply from the server into a newly allocated buffer.
+ * Return its length or a negative error code.
+ */
+static int cl_rep_recv_alloc(struct px_zmq_data *pzd, char **pbuff)
+{
+    int rc;
+
+    *pbuff = (char *)malloc(RECV_BUFFER_LENGTH);
+    if (*pbuff == NULL)
+        return -ENOMEM;
+
+    rc = cl_rep_recv(pzd, *pbuff, RECV_BUFFER_LENGTH);
+    if (rc < 0) {
+        free(*pbuff);
+        *pbuff = NULL;
+    }
+
+    return rc;
+}
+
+static inline bool cl_rep_is_enqueue(const char *buff, int len)
+{
+    return len >= sizeof(struct px_rpc_hdr) &&
+           ((const struct px_rpc_hdr *)buff)->op_type == RPC_OP_ENQUEUE;
+}
+
+/**
+ * Request a reply answers: ENQUEUE for records, the operation acknowledged for
+ * an ACK. Servers predating versioning do not tell, RPC_OP_ACK then.
+ */
+static enum rpc_op_type cl_rep_op(const char *buff, int len)
+{
+    const struct px_rpc_ack *rep_ack = (const struct px_rpc_ack *)buff;
+
+    if (cl_rep_is_enqueue(buff, len))
+        return RPC_OP_ENQUEUE;
+
+    if (len < sizeof(*rep_ack) || rep_ack->pr_hdr.version == 0)
+        return RPC_OP_ACK;
+
+    return rep_ack->pr_op;
+}
+
+/**
+ * Wait for the reply to the last request sent, of operation \a op, which comes
+ * after the ones to pipelined DEQUEUE requests, or along with pushed records in
+ * streaming mode. Records received meanwhile are kept aside. Error replies to
+ * requests which are not waited for (CLEAR when streaming) are dropped.
+ */
+static int cl_ack_retcode(struct px_zmq_data *pzd, enum rpc_op_type op)
+{
+    struct px_stashed_rep   *psr;
+    struct px_rpc_ack       *rep_ack;
+    enum rpc_op_type         rep_op;
+    char                    *buff;
+    int                      rc;
+
+    for (;;) {
+        rc = cl_rep_recv_alloc(pzd, &buff);
+        if (rc < 0)
+            return rc;
+
+        /* Legacy servers reply in order */
+        rep_op = cl_rep_op(buff, rc);
+        if (rep_op == op || (rep_op == RPC_OP_ACK && pzd->inflight == 0))
+            break;
+
+        if (pzd->inflight > 0 &&
+            (rep_op == RPC_OP_ENQUEUE || rep_op == RPC_OP_DEQUEUE ||
+             rep_op == RPC_OP_ACK))
+            pzd->inflight--;
+
+        /* EOF or error replies can be dropped */
+        if (rep_op != RPC_OP_ENQUEUE) {
+            free(buff);
+            continue;
+        }
+
+        psr = malloc(sizeof(*psr));
+        if (psr == NULL) {
+            free(buff);
+            return -ENOMEM;
+        }
+
+        psr->psr_buff = buff;
+        psr->psr_len  = rc;
+        list_append(&pzd->stash, &psr->psr_node);
+    }
+
+    rep_ack = (struct px_rpc_ack *)buff;
+    if (rc < offsetof(struct px_rpc_ack, pr_op)) {
+        free(buff);
+        return -EINVAL;
+    }
+
+    pzd->version = rep_ack->pr_hdr.version < LCAP_PROTO_VERSION ?
+                   rep_ack->pr_hdr.version : LCAP_PROTO_VERSION;
+    rc = rep_ack->pr_retcode;
+    free(buff);
+    return rc;
+}
+
+/**
+ * Whether a START message asks for more than servers predating versioning can
+ * do. They would ignore it and send other records than the ones asked for, or
+ * none at all to a streaming client.
+ */
+static bool cl_start_needs_version(const struct px_rpc_register *reg)
+{
+    return (reg->pr_flags & (LCAP_CL_STREAM | LCAP_CL_BROADCAST |
+                             LCAP_CL_START_TIME)) ||
+           reg->pr_type_mask != 0 || reg->pr_flags_mask != 0 ||
+           reg->pr_group[0] != '\0' || reg->pr_filter_len > 0;
+}
+
+static int cl_fini(struct px_zmq_data *pzd)
 {
-    struct px_rpc_ack   rep_ack;
+    struct px_rpc_fini  rpc;
     int                 rc;
 
-    rc = cl_rep_recv(pzd, (char *)&rep_ack, sizeof(rep_ack));
+    memset(&rpc, 0, sizeof(rpc));
+    rpc_hdr_init(&rpc.pr_hdr, RPC_OP_FINI);
+
+    rc = px_rpc_send(pzd, (char *)&rpc, sizeof(rpc));
     if (rc < 0)
         return rc;
 
-    if (rc < sizeof(rep_ack))
-        return -EINVAL;
-
-    return rep_ack.pr_retcode;
+    return cl_ack_retcode(pzd, RPC_OP_FINI);
 }
 
 static int px_changelog_start(struct lcap_cl_ctx *ctx, enum lcap_cl_flags flags,
                               const char *mdtname, long long startrec)
 {
     struct px_zmq_data      *pzd;
-    struct px_rpc_register   reg;
-    struct px_rpc_ack        ack;
+    struct px_rpc_register  *reg;
+    size_t                   reg_len;
     int                      rc = 0;
 
     pzd = calloc(1, sizeof(*pzd));
@@ -233,26 +502,40 @@ static int px_changelog_start(struct lcap_cl_ctx *ctx, enum lcap_cl_flags flags,
         goto out_initialized;
     }
 
-    rc = cl_start_pack(&reg, flags, mdtname, startrec);
+    pzd->stream = !!(flags & LCAP_CL_STREAM);
+
+    rc = cl_start_pack(&reg, &reg_len, flags, mdtname, startrec);
     if (rc < 0)
         goto out_initialized;
 
-    rc = px_rpc_send(pzd, (char *)&reg, sizeof(reg));
+    rc = px_rpc_send(pzd, (char *)reg, reg_len);
     if (rc < 0)
-        goto out_initialized;
+        goto out_free_reg;
 
-    rc = zmq_recv(pzd->zmq_srv, &ack, sizeof(ack), 0);
-    if (rc < 0) {
-        rc = -errno;
-        goto out_initialized;
+    /* Positive return codes tell how many credits were granted */
+    rc = cl_ack_retcode(pzd, RPC_OP_START);
+    if (rc < 0)
+        goto out_free_reg;
+
+    if (pzd->version == 0 && cl_start_needs_version(reg)) {
+        cl_fini(pzd);
+        rc = -EPROTONOSUPPORT;
+        goto out_free_reg;
     }
 
-    if (rc < sizeof(ack)) {
-        rc = -EINVAL;
+    free(reg);
+
+    pzd->credits = rc > 0 ? rc : 1;
+    pzd->held = calloc(pzd->credits, sizeof(*pzd->held));
+    if (pzd->held == NULL) {
+        rc = -ENOMEM;
         goto out_initialized;
     }
 
-    return ack.pr_retcode;
+    return 0;
+
+out_free_reg:
+    free(reg);
 
 out_initialized:
     pzd_destroy(pzd);
@@ -267,20 +550,12 @@ out:
 static int px_changelog_fini(struct lcap_cl_ctx *ctx)
 {
     struct px_zmq_data  *pzd = (struct px_zmq_data *)ctx->ccc_ptr;
-    struct px_rpc_fini   rpc;
     int                  rc;
 
     if (ctx == NULL)
         return -EINVAL;
 
-    memset(&rpc, 0, sizeof(rpc));
-    rpc.pr_hdr.op_type = RPC_OP_FINI;
-
-    rc = px_rpc_send(pzd, (char *)&rpc, sizeof(rpc));
-    if (rc < 0)
-        return rc;
-
-    rc = cl_ack_retcode(pzd);
+    rc = cl_fini(pzd);
     if (rc < 0)
         return rc;
 
@@ -294,33 +569,80 @@ changelog_rec_next(struct changelog_rec *rec)
     return (struct changelog_rec *)(changelog_rec_name(rec) + rec->cr_namelen);
 }
 
-#define RECV_BUFFER_LENGTH  8 * 1024 * 1024
-static int px_dequeue_records(struct px_zmq_data *pzd)
+/**
+ * Replace a compressed ENQUEUE reply with its decompressed version. The
+ * original buffer is released upon success only.
+ */
+static int px_enqueue_inflate(char **buff, int *rcvd)
 {
-    char                    *buff;
-    struct px_rpc_dequeue    rpc;
-    struct px_rpc_hdr       *rep_hdr;
+#ifdef HAVE_LIBZ
+    struct px_rpc_enqueue   *src = (struct px_rpc_enqueue *)*buff;
+    struct px_rpc_enqueue   *dst;
+    uLongf                   len = src->pr_raw_len;
     int                      rc;
-    int                      rcvd = 0;
 
-    rc = cl_dequeue_pack(&rpc);
-    if (rc < 0)
-        return rc;
+    dst = malloc(sizeof(*dst) + len);
+    if (dst == NULL)
+        return -ENOMEM;
 
-    rc = px_rpc_send(pzd, (char *)&rpc, sizeof(rpc));
-    if (rc < 0)
-        return rc;
+    rc = uncompress(dst->pr_records, &len, src->pr_records,
+                    *rcvd - sizeof(*src));
+    if (rc != Z_OK || len != src->pr_raw_len) {
+        free(dst);
+        return rc == Z_MEM_ERROR ? -ENOMEM : -EPROTO;
+    }
 
-    buff = (char *)malloc(RECV_BUFFER_LENGTH);
-    if (buff == NULL)
+    memcpy(dst, src, sizeof(*dst));
+    dst->pr_flags &= ~RPC_ENQ_ZLIB;
+
+    free(*buff);
+    *buff = (char *)dst;
+    *rcvd = sizeof(*dst) + len;
+    return 0;
+#else
+    return -EPROTO;
+#endif
+}
+
+/**
+ * Replace an ENQUEUE reply of a server predating versioning, whose records
+ * come right after the count, with the current layout. The original buffer is
+ * released upon success only.
+ */
+static int px_enqueue_upgrade(char **buff, int *rcvd)
+{
+    struct px_rpc_enqueue_v0    *src = (struct px_rpc_enqueue_v0 *)*buff;
+    struct px_rpc_enqueue       *dst;
+    size_t                       len;
+
+    if (*rcvd < sizeof(*src))
+        return -EINVAL;
+
+    len = *rcvd - sizeof(*src);
+    dst = malloc(sizeof(*dst) + len);
+    if (dst == NULL)
         return -ENOMEM;
 
-    rc = cl_rep_recv(pzd, buff, RECV_BUFFER_LENGTH);
-    if (rc < 0)
-        goto out_free;
+    memset(dst, 0, sizeof(*dst));
+    dst->pr_hdr     = src->pr_hdr;
+    dst->pr_count   = src->pr_count;
+    dst->pr_raw_len = len;
+    memcpy(dst->pr_records, src->pr_records, len);
 
-    rcvd = rc;
-    rc = 0;
+    free(*buff);
+    *buff = (char *)dst;
+    *rcvd = sizeof(*dst) + len;
+    return 0;
+}
+
+/**
+ * Make the records of an ENQUEUE (or the return code of an ACK) reply
+ * available to the caller. The buffer is consumed in any case.
+ */
+static int px_reply_load(struct px_zmq_data *pzd, char *buff, int rcvd)
+{
+    struct px_rpc_hdr       *rep_hdr;
+    int                      rc = 0;
 
     rep_hdr = (struct px_rpc_hdr *)buff;
     if (rcvd < sizeof(*rep_hdr)) {
@@ -333,7 +655,7 @@ static int px_dequeue_records(struct px_zmq_data *pzd)
             struct px_rpc_ack   *rep_ack;
 
             rep_ack = (struct px_rpc_ack *)buff;
-            if (rcvd < sizeof(*rep_ack)) {
+            if (rcvd < offsetof(struct px_rpc_ack, pr_op)) {
                 rc = -EINVAL;
                 goto out_free;
             }
@@ -346,9 +668,32 @@ static int px_dequeue_records(struct px_zmq_data *pzd)
             struct changelog_rec    *rec_iter;
             int                      i;
 
+            /* Each bucket takes a credit until cleared */
+            if (pzd->held_cnt >= pzd->credits) {
+                rc = -EPROTO;
+                goto out_free;
+            }
+
+            if (pzd->version == 0) {
+                rc = px_enqueue_upgrade(&buff, &rcvd);
+                if (rc < 0)
+                    goto out_free;
+
+                rep_hdr = (struct px_rpc_hdr *)buff;
+            }
+
             rep_enq = (struct px_rpc_enqueue *)buff;
+            if (rcvd > sizeof(*rep_enq) && rep_enq->pr_flags & RPC_ENQ_ZLIB) {
+                rc = px_enqueue_inflate(&buff, &rcvd);
+                if (rc < 0)
+                    goto out_free;
+
+                rep_hdr = (struct px_rpc_hdr *)buff;
+                rep_enq = (struct px_rpc_enqueue *)buff;
+            }
+
             if (rcvd < (sizeof(*rep_enq) +
-                        sizeof(*rec_iter))) {
+                        sizeof(*rec_iter)) || rep_enq->pr_count == 0) {
                 rc = -EINVAL;
                 goto out_free;
             }
@@ -359,6 +704,26 @@ static int px_dequeue_records(struct px_zmq_data *pzd)
                     goto out_free;
             }
 
+            if (rep_enq->pr_flags & RPC_ENQ_COLUMNAR) {
+                rc = lcap_col_decode(rep_enq->pr_records,
+                                     rcvd - sizeof(*rep_enq), &pzd->cols);
+                if (rc == 0 && pzd->cols.lcb_count != rep_enq->pr_count)
+                    rc = -EINVAL;
+                if (rc < 0)
+                    goto out_free;
+
+                /* Records are only rebuilt if asked for */
+                pzd->rec_nxt  = 0;
+                pzd->rec_cnt  = rep_enq->pr_count;
+                pzd->rec_buff = buff;
+                pzd->rec_len  = rcvd - sizeof(*rep_enq);
+                pzd->rec_columnar = true;
+
+                pzd->held[pzd->held_cnt++] =
+                    lcap_col_index(&pzd->cols, pzd->cols.lcb_count - 1);
+                break;
+            }
+
             rec_iter = (struct changelog_rec *)rep_enq->pr_records;
             for (i = 0; i < rep_enq->pr_count; i++) {
                 pzd->records[i] = (struct changelog_rec *)rec_iter;
@@ -368,6 +733,10 @@ static int px_dequeue_records(struct px_zmq_data *pzd)
             pzd->rec_nxt  = 0;
             pzd->rec_cnt  = i;
             pzd->rec_buff = buff;
+            pzd->rec_len  = rcvd - sizeof(*rep_enq);
+
+            /* Held until cleared */
+            pzd->held[pzd->held_cnt++] = pzd->records[i - 1]->cr_index;
             rc = 0;
             break;
         }
@@ -378,12 +747,109 @@ static int px_dequeue_records(struct px_zmq_data *pzd)
     }
 
 out_free:
-    if (rc)
+    if (rc || rep_hdr->op_type != RPC_OP_ENQUEUE)
         free(buff);
 
     return rc;
 }
 
+/**
+ * Wait for the server to push records. Only errors, for requests which are not
+ * acknowledged otherwise, can come in between.
+ */
+static int px_stream_wait(struct px_zmq_data *pzd)
+{
+    char    *buff;
+    int      rc;
+
+    for (;;) {
+        rc = cl_rep_recv_alloc(pzd, &buff);
+        if (rc < 0)
+            return rc;
+
+        if (cl_rep_is_enqueue(buff, rc) ||
+            rc < offsetof(struct px_rpc_ack, pr_op) ||
+            ((struct px_rpc_ack *)buff)->pr_retcode != 0)
+            return px_reply_load(pzd, buff, rc);
+
+        free(buff);
+    }
+}
+
+/**
+ * Get the next bucket of records. As many DEQUEUE requests as the credit
+ * window allows are kept in flight, so that buckets keep coming while the
+ * current one is being processed.
+ */
+static int px_dequeue_records(struct px_zmq_data *pzd)
+{
+    struct px_rpc_dequeue    rpc;
+    struct list_node        *lnode;
+    struct px_stashed_rep   *psr;
+    char                    *buff;
+    int                      rc;
+
+    rc = cl_dequeue_pack(&rpc);
+    if (rc < 0)
+        return rc;
+
+    /* Pushed records are waited for, no need to ask */
+    while (!pzd->stream &&
+           pzd->inflight + pzd->stash.l_count + pzd->held_cnt < pzd->credits) {
+        rc = px_rpc_send(pzd, (char *)&rpc, sizeof(rpc));
+        if (rc < 0)
+            return rc;
+
+        pzd->inflight++;
+    }
+
+    lnode = list_pop_head(&pzd->stash);
+    if (lnode != NULL) {
+        psr = list_entry(lnode, struct px_stashed_rep, psr_node);
+        buff = psr->psr_buff;
+        rc   = psr->psr_len;
+        free(psr);
+        return px_reply_load(pzd, buff, rc);
+    }
+
+    if (pzd->stream)
+        return px_stream_wait(pzd);
+
+    /* Window full of buckets which have not been cleared */
+    if (pzd->inflight == 0)
+        return -EPROTO;
+
+    rc = cl_rep_recv_alloc(pzd, &buff);
+    if (rc < 0)
+        return rc;
+
+    pzd->inflight--;
+    return px_reply_load(pzd, buff, rc);
+}
+
+/**
+ * Rebuild the records of a batch received encoded by columns.
+ */
+static int px_columns_records(struct px_zmq_data *pzd)
+{
+    struct changelog_rec    *rec_iter;
+    size_t                   len;
+    int                      i;
+    int                      rc;
+
+    rc = lcap_col_records(&pzd->cols, &pzd->rec_raw, &len);
+    if (rc < 0)
+        return rc;
+
+    rec_iter = (struct changelog_rec *)pzd->rec_raw;
+    for (i = 0; i < pzd->rec_cnt; i++) {
+        pzd->records[i] = rec_iter;
+        rec_iter = changelog_rec_next(rec_iter);
+    }
+
+    return 0;
+}
+
 static int px_changelog_recv(struct lcap_cl_ctx *ctx,
                              struct changelog_rec **rec)
 {
@@ -391,25 +857,74 @@ static int px_changelog_recv(struct lcap_cl_ctx *ctx,
     int                  rc;
 
     if (pzd->rec_nxt == pzd->rec_cnt) {
+        /* Nobody holds records of a batch consumed by columns */
+        if (pzd->col_taken)
+            pzd_batch_release(pzd);
+
         rc = px_dequeue_records(pzd);
         if (rc != 0)
             return rc; /* <0 or >0 are both possible */
     }
 
+    if (pzd->rec_columnar && pzd->rec_raw == NULL) {
+        rc = px_columns_records(pzd);
+        if (rc < 0)
+            return rc;
+    }
+
     *rec = pzd->records[pzd->rec_nxt++];
     return 0;
 }
 
+/**
+ * Hand the rest of the current batch (or the next one) over by columns.
+ * Batches received as plain records get encoded here.
+ */
+static int px_changelog_columns(struct lcap_cl_ctx *ctx,
+                                const struct lcap_col_batch **cols)
+{
+    struct px_zmq_data      *pzd = (struct px_zmq_data *)ctx->ccc_ptr;
+    struct px_rpc_enqueue   *rep_enq;
+    size_t                   len;
+    int                      rc;
+
+    if (pzd->rec_nxt == pzd->rec_cnt) {
+        pzd_batch_release(pzd);
+
+        rc = px_dequeue_records(pzd);
+        if (rc != 0)
+            return rc;
+    }
+
+    if (!pzd->rec_columnar && pzd->col_buff == NULL) {
+        rep_enq = (struct px_rpc_enqueue *)pzd->rec_buff;
+        rc = lcap_col_encode(rep_enq->pr_records, pzd->rec_len, pzd->rec_cnt,
+                             0, &pzd->col_buff, &len);
+        if (rc < 0)
+            return rc;
+
+        rc = lcap_col_decode(pzd->col_buff, len, &pzd->cols);
+        if (rc < 0)
+            return rc;
+    }
+
+    pzd->cols.lcb_first = pzd->rec_nxt;
+    pzd->rec_nxt   = pzd->rec_cnt;
+    pzd->col_taken = true;
+
+    *cols = &pzd->cols;
+    return 0;
+}
+
 
 static int px_changelog_free(struct lcap_cl_ctx *ctx,
                              struct changelog_rec **rec)
 {
     struct px_zmq_data  *pzd = (struct px_zmq_data *)ctx->ccc_ptr;
 
-    if (pzd->rec_nxt == pzd->rec_cnt) {
-        free(pzd->rec_buff);
-        pzd->rec_buff = NULL;
-    }
+    if (pzd->rec_nxt == pzd->rec_cnt)
+        pzd_batch_release(pzd);
+
     *rec = NULL;
     return 0;
 }
@@ -422,9 +937,18 @@ static int px_changelog_clear(struct lcap_cl_ctx *ctx, const char *mdtname,
     size_t               id_len;
     size_t               name_len;
     size_t               rpc_len;
+    int                  count;
+    int                  i;
+    int                  j;
     int                  rc;
 
-    if (pzd->rec_nxt < pzd->rec_cnt)
+    /* Only whole buckets can be acknowledged */
+    for (i = 0, count = 0; i < pzd->held_cnt; i++) {
+        if (endrec == 0 || pzd->held[i] <= endrec)
+            count++;
+    }
+
+    if (count == 0)
         return 0;
 
     id_len = strlen(id);
@@ -443,7 +967,15 @@ static int px_changelog_clear(struct lcap_cl_ctx *ctx, const char *mdtname,
     if (rc < 0)
         goto out_free;
 
-    rc = cl_ack_retcode(pzd);
+    /* Same selection as the server does */
+    for (i = 0, j = 0; i < pzd->held_cnt; i++) {
+        if (endrec != 0 && pzd->held[i] > endrec)
+            pzd->held[j++] = pzd->held[i];
+    }
+    pzd->held_cnt = j;
+
+    /* Acknowledgements flow back asynchronously when streaming */
+    rc = pzd->stream ? 0 : cl_ack_retcode(pzd, RPC_OP_CLEAR);
 
 out_free:
     free(rpc);
@@ -451,10 +983,20 @@ out_free:
     return rc;
 }
 
+static int px_changelog_origin(struct lcap_cl_ctx *ctx, const char **mdtname)
+{
+    struct px_zmq_data  *pzd = (struct px_zmq_data *)ctx->ccc_ptr;
+
+    *mdtname = pzd->rec_mdt;
+    return 0;
+}
+
 struct lcap_cl_operations cl_ops_proxy = {
     .cco_start  = px_changelog_start,
     .cco_fini   = px_changelog_fini,
     .cco_recv   = px_changelog_recv,
     .cco_free   = px_changelog_free,
-    .cco_clear  = px_changelog_clear
+    .cco_clear  = px_changelog_clear,
+    .cco_columns = px_changelog_columns,
+    .cco_origin = px_changelog_origin
 };
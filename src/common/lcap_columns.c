@@ -0,0 +1,510 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "lcap_columns.h"
+
+
+/* col_wire_hdr::cw_flags */
+#define CW_TIME64   0x01    /* Time offsets do not fit 32 bits */
+
+/**
+ * Header of an encoded batch, followed by its columns. Its size is a multiple
+ * of 8 bytes, so that the columns which come next are aligned.
+ */
+struct col_wire_hdr {
+    uint32_t    cw_count;
+    uint32_t    cw_flags;
+    uint64_t    cw_base_index;
+    uint64_t    cw_base_time;
+    uint32_t    cw_rename_count;
+    uint32_t    cw_prev_count;
+    uint32_t    cw_jobid_count;
+    uint32_t    cw_names_len;
+} __attribute__((packed));
+
+/**
+ * Columns of an encoded batch, in wire order. Widest elements come first so
+ * that every column is naturally aligned without any padding.
+ */
+enum col_id {
+    COL_TIME64 = 0,
+    COL_TFID,
+    COL_PFID,
+    COL_RENAME,
+    COL_PREV,
+    COL_INDEX,
+    COL_TIME32,
+    COL_NAME_OFF,
+    COL_RENAME_POS,
+    COL_PREV_POS,
+    COL_FLAGS,
+    COL_JOBID,
+    COL_TYPE,
+    COL_JOBID_DICT,
+    COL_NAMES,
+    COL_COUNT
+};
+
+/**
+ * Distinct job IDs of a batch, found through an open-addressing hash table.
+ */
+struct col_dict {
+    char        *cd_entries;    /**< LUSTRE_JOBID_SIZE bytes each */
+    uint32_t     cd_count;
+    uint32_t    *cd_slots;      /**< Rank of an entry + 1, 0 if free */
+    uint32_t     cd_mask;
+};
+
+
+/**
+ * Compute the offset of every column from the header. Return the length of
+ * the whole batch.
+ */
+static size_t col_layout(const struct col_wire_hdr *hdr, size_t off[COL_COUNT])
+{
+    size_t  n = hdr->cw_count;
+    bool    time64 = hdr->cw_flags & CW_TIME64;
+    size_t  len[COL_COUNT] = {
+        [COL_TIME64]     = time64 ? n * sizeof(uint64_t) : 0,
+        [COL_TFID]       = n * sizeof(struct lu_fid),
+        [COL_PFID]       = n * sizeof(struct lu_fid),
+        [COL_RENAME]     = hdr->cw_rename_count *
+                           sizeof(struct changelog_ext_rename),
+        [COL_PREV]       = hdr->cw_prev_count * sizeof(uint64_t),
+        [COL_INDEX]      = n * sizeof(uint32_t),
+        [COL_TIME32]     = time64 ? 0 : n * sizeof(uint32_t),
+        [COL_NAME_OFF]   = (n + 1) * sizeof(uint32_t),
+        [COL_RENAME_POS] = hdr->cw_rename_count * sizeof(uint32_t),
+        [COL_PREV_POS]   = hdr->cw_prev_count * sizeof(uint32_t),
+        [COL_FLAGS]      = n * sizeof(uint16_t),
+        [COL_JOBID]      = n * sizeof(uint16_t),
+        [COL_TYPE]       = n * sizeof(uint8_t),
+        [COL_JOBID_DICT] = (size_t)hdr->cw_jobid_count * LUSTRE_JOBID_SIZE,
+        [COL_NAMES]      = hdr->cw_names_len
+    };
+    size_t  pos = sizeof(*hdr);
+    int     i;
+
+    for (i = 0; i < COL_COUNT; i++) {
+        off[i] = pos;
+        pos += len[i];
+    }
+
+    return pos;
+}
+
+static int col_dict_init(struct col_dict *dict, uint32_t count)
+{
+    uint32_t    size = 16;
+
+    while (size < 2 * count)
+        size <<= 1;
+
+    dict->cd_count   = 0;
+    dict->cd_mask    = size - 1;
+    dict->cd_slots   = calloc(size, sizeof(*dict->cd_slots));
+    dict->cd_entries = malloc((size_t)count * LUSTRE_JOBID_SIZE);
+    if (dict->cd_slots == NULL || dict->cd_entries == NULL)
+        return -ENOMEM;
+
+    return 0;
+}
+
+static void col_dict_fini(struct col_dict *dict)
+{
+    free(dict->cd_slots);
+    free(dict->cd_entries);
+}
+
+/* FNV-1a */
+static uint32_t col_jobid_hash(const char *jobid)
+{
+    uint32_t    hash = 2166136261U;
+    int         i;
+
+    for (i = 0; i < LUSTRE_JOBID_SIZE && jobid[i] != '\0'; i++) {
+        hash ^= (unsigned char)jobid[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/**
+ * Get the rank of a job ID in the dictionary, adding it on first sight.
+ */
+static int col_dict_insert(struct col_dict *dict, const char *jobid)
+{
+    char        key[LUSTRE_JOBID_SIZE];
+    uint32_t    slot;
+    uint32_t    rank;
+
+    /* Whatever trails the terminating NUL does not matter */
+    strncpy(key, jobid, sizeof(key));
+
+    slot = col_jobid_hash(key) & dict->cd_mask;
+    while ((rank = dict->cd_slots[slot]) != 0) {
+        if (memcmp(dict->cd_entries + (rank - 1) * LUSTRE_JOBID_SIZE, key,
+                   LUSTRE_JOBID_SIZE) == 0)
+            return rank - 1;
+
+        slot = (slot + 1) & dict->cd_mask;
+    }
+
+    if (dict->cd_count > UINT16_MAX)
+        return -EOVERFLOW;
+
+    memcpy(dict->cd_entries + dict->cd_count * LUSTRE_JOBID_SIZE, key,
+           LUSTRE_JOBID_SIZE);
+    dict->cd_slots[slot] = ++dict->cd_count;
+    return dict->cd_count - 1;
+}
+
+int lcap_col_encode(const void *recs, size_t len, uint32_t count,
+                    size_t headroom, void **buff, size_t *col_len)
+{
+    const struct changelog_rec  *rec;
+    struct col_wire_hdr          hdr;
+    struct col_dict              dict;
+    struct changelog_ext_rename *ren;
+    struct lu_fid               *tfid;
+    struct lu_fid               *pfid;
+    uint64_t                    *time64;
+    uint64_t                    *prev;
+    uint32_t                    *index;
+    uint32_t                    *time32;
+    uint32_t                    *name_off;
+    uint32_t                    *ren_pos;
+    uint32_t                    *prev_pos;
+    uint16_t                    *flags;
+    uint16_t                    *jobid;
+    uint16_t                    *jobids;
+    uint8_t                     *type;
+    uint64_t                     max_index = 0;
+    uint64_t                     max_time = 0;
+    size_t                       col[COL_COUNT];
+    size_t                       rec_len;
+    size_t                       total;
+    size_t                       off;
+    char                        *base;
+    char                        *out = NULL;
+    uint32_t                     names = 0;
+    uint32_t                     r = 0;
+    uint32_t                     p = 0;
+    uint32_t                     i;
+    int                          rc;
+
+    if (count == 0 || headroom % 8 != 0)
+        return -EINVAL;
+
+    if (len > UINT32_MAX)
+        return -EOVERFLOW;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.cw_count      = count;
+    hdr.cw_base_index = UINT64_MAX;
+    hdr.cw_base_time  = UINT64_MAX;
+
+    jobids = malloc(count * sizeof(*jobids));
+    rc = col_dict_init(&dict, count);
+    if (rc < 0 || jobids == NULL) {
+        rc = -ENOMEM;
+        goto out_free;
+    }
+
+    /* First pass: bounds, sparse fields and job IDs dictionary */
+    for (i = 0, off = 0; i < count; i++, off += rec_len) {
+        rec = (const struct changelog_rec *)((const char *)recs + off);
+        if (len - off < sizeof(*rec)) {
+            rc = -EINVAL;
+            goto out_free;
+        }
+
+        if (rec->cr_type > UINT8_MAX ||
+            (rec->cr_flags & ~(CLF_FLAGMASK | CLF_SUPPORTED))) {
+            rc = -EOVERFLOW;
+            goto out_free;
+        }
+
+        rec_len = changelog_rec_size((struct changelog_rec *)rec) +
+                  rec->cr_namelen;
+        if (len - off < rec_len) {
+            rc = -EINVAL;
+            goto out_free;
+        }
+
+        if (rec->cr_index < hdr.cw_base_index)
+            hdr.cw_base_index = rec->cr_index;
+        if (rec->cr_index > max_index)
+            max_index = rec->cr_index;
+        if (rec->cr_time < hdr.cw_base_time)
+            hdr.cw_base_time = rec->cr_time;
+        if (rec->cr_time > max_time)
+            max_time = rec->cr_time;
+
+        if (rec->cr_flags & CLF_RENAME)
+            hdr.cw_rename_count++;
+
+        if (rec->cr_prev != 0)
+            hdr.cw_prev_count++;
+
+        hdr.cw_names_len += rec->cr_namelen;
+
+        jobids[i] = 0;
+        if (rec->cr_flags & CLF_JOBID) {
+            rc = col_dict_insert(&dict, changelog_rec_jobid(
+                                 (struct changelog_rec *)rec)->cr_jobid);
+            if (rc < 0)
+                goto out_free;
+
+            jobids[i] = rc;
+        }
+    }
+
+    if (off != len) {
+        rc = -EINVAL;
+        goto out_free;
+    }
+
+    if (max_index - hdr.cw_base_index > UINT32_MAX) {
+        rc = -EOVERFLOW;
+        goto out_free;
+    }
+
+    if (max_time - hdr.cw_base_time > UINT32_MAX)
+        hdr.cw_flags |= CW_TIME64;
+
+    hdr.cw_jobid_count = dict.cd_count;
+
+    total = col_layout(&hdr, col);
+    out = malloc(headroom + total);
+    if (out == NULL) {
+        rc = -ENOMEM;
+        goto out_free;
+    }
+
+    base = out + headroom;
+    memcpy(base, &hdr, sizeof(hdr));
+
+    /* Second pass: fill the columns in */
+    index    = (uint32_t *)(base + col[COL_INDEX]);
+    time32   = (uint32_t *)(base + col[COL_TIME32]);
+    time64   = (uint64_t *)(base + col[COL_TIME64]);
+    type     = (uint8_t *)(base + col[COL_TYPE]);
+    flags    = (uint16_t *)(base + col[COL_FLAGS]);
+    tfid     = (struct lu_fid *)(base + col[COL_TFID]);
+    pfid     = (struct lu_fid *)(base + col[COL_PFID]);
+    ren_pos  = (uint32_t *)(base + col[COL_RENAME_POS]);
+    ren      = (struct changelog_ext_rename *)(base + col[COL_RENAME]);
+    prev_pos = (uint32_t *)(base + col[COL_PREV_POS]);
+    prev     = (uint64_t *)(base + col[COL_PREV]);
+    jobid    = (uint16_t *)(base + col[COL_JOBID]);
+    name_off = (uint32_t *)(base + col[COL_NAME_OFF]);
+
+    for (i = 0, off = 0; i < count; i++, off += rec_len) {
+        rec = (const struct changelog_rec *)((const char *)recs + off);
+        rec_len = changelog_rec_size((struct changelog_rec *)rec) +
+                  rec->cr_namelen;
+
+        index[i] = rec->cr_index - hdr.cw_base_index;
+        if (hdr.cw_flags & CW_TIME64)
+            time64[i] = rec->cr_time - hdr.cw_base_time;
+        else
+            time32[i] = rec->cr_time - hdr.cw_base_time;
+
+        type[i]  = rec->cr_type;
+        flags[i] = rec->cr_flags;
+        jobid[i] = jobids[i];
+        memcpy(&tfid[i], &rec->cr_tfid, sizeof(tfid[i]));
+        memcpy(&pfid[i], &rec->cr_pfid, sizeof(pfid[i]));
+
+        if (rec->cr_flags & CLF_RENAME) {
+            ren_pos[r] = i;
+            memcpy(&ren[r], changelog_rec_rename((struct changelog_rec *)rec),
+                   sizeof(ren[r]));
+            r++;
+        }
+
+        if (rec->cr_prev != 0) {
+            prev_pos[p] = i;
+            prev[p] = rec->cr_prev;
+            p++;
+        }
+
+        name_off[i] = names;
+        memcpy(base + col[COL_NAMES] + names,
+               changelog_rec_name((struct changelog_rec *)rec),
+               rec->cr_namelen);
+        names += rec->cr_namelen;
+    }
+
+    name_off[count] = names;
+    memcpy(base + col[COL_JOBID_DICT], dict.cd_entries,
+           (size_t)dict.cd_count * LUSTRE_JOBID_SIZE);
+
+    *buff    = out;
+    *col_len = total;
+    rc = 0;
+
+out_free:
+    col_dict_fini(&dict);
+    free(jobids);
+    return rc;
+}
+
+int lcap_col_decode(const void *buff, size_t len, struct lcap_col_batch *cols)
+{
+    const struct col_wire_hdr   *hdr = buff;
+    const char                  *base = buff;
+    size_t                       col[COL_COUNT];
+    uint32_t                     r = 0;
+    uint32_t                     p = 0;
+    uint32_t                     i;
+
+    if ((uintptr_t)buff % 8 != 0 || len < sizeof(*hdr))
+        return -EINVAL;
+
+    if (hdr->cw_count == 0 || col_layout(hdr, col) != len)
+        return -EINVAL;
+
+    cols->lcb_count        = hdr->cw_count;
+    cols->lcb_first        = 0;
+    cols->lcb_base_index   = hdr->cw_base_index;
+    cols->lcb_base_time    = hdr->cw_base_time;
+    cols->lcb_index        = (const uint32_t *)(base + col[COL_INDEX]);
+    cols->lcb_time32       = NULL;
+    cols->lcb_time64       = NULL;
+    cols->lcb_type         = (const uint8_t *)(base + col[COL_TYPE]);
+    cols->lcb_flags        = (const uint16_t *)(base + col[COL_FLAGS]);
+    cols->lcb_tfid         = (const struct lu_fid *)(base + col[COL_TFID]);
+    cols->lcb_pfid         = (const struct lu_fid *)(base + col[COL_PFID]);
+    cols->lcb_rename_count = hdr->cw_rename_count;
+    cols->lcb_rename_pos   = (const uint32_t *)(base + col[COL_RENAME_POS]);
+    cols->lcb_rename       = (const struct changelog_ext_rename *)
+                             (base + col[COL_RENAME]);
+    cols->lcb_prev_count   = hdr->cw_prev_count;
+    cols->lcb_prev_pos     = (const uint32_t *)(base + col[COL_PREV_POS]);
+    cols->lcb_prev         = (const uint64_t *)(base + col[COL_PREV]);
+    cols->lcb_jobid_count  = hdr->cw_jobid_count;
+    cols->lcb_jobid        = (const uint16_t *)(base + col[COL_JOBID]);
+    cols->lcb_jobid_dict   = base + col[COL_JOBID_DICT];
+    cols->lcb_name_off     = (const uint32_t *)(base + col[COL_NAME_OFF]);
+    cols->lcb_names        = base + col[COL_NAMES];
+
+    if (hdr->cw_flags & CW_TIME64)
+        cols->lcb_time64 = (const uint64_t *)(base + col[COL_TIME64]);
+    else
+        cols->lcb_time32 = (const uint32_t *)(base + col[COL_TIME32]);
+
+    /* Check cross references once, so that consumers can trust them */
+    if (cols->lcb_name_off[0] != 0 ||
+        cols->lcb_name_off[hdr->cw_count] != hdr->cw_names_len)
+        return -EINVAL;
+
+    for (i = 0; i < hdr->cw_count; i++) {
+        if (cols->lcb_name_off[i + 1] < cols->lcb_name_off[i] ||
+            cols->lcb_name_off[i + 1] - cols->lcb_name_off[i] > UINT16_MAX)
+            return -EINVAL;
+
+        if ((cols->lcb_flags[i] & CLF_JOBID) &&
+            cols->lcb_jobid[i] >= hdr->cw_jobid_count)
+            return -EINVAL;
+
+        if (cols->lcb_flags[i] & CLF_RENAME) {
+            if (r == hdr->cw_rename_count || cols->lcb_rename_pos[r] != i)
+                return -EINVAL;
+            r++;
+        }
+
+        if (p < hdr->cw_prev_count && cols->lcb_prev_pos[p] == i)
+            p++;
+    }
+
+    if (r != hdr->cw_rename_count || p != hdr->cw_prev_count)
+        return -EINVAL;
+
+    return 0;
+}
+
+int lcap_col_records(const struct lcap_col_batch *cols, void **buff,
+                     size_t *len)
+{
+    struct changelog_rec    *rec;
+    size_t                   size;
+    size_t                   off;
+    uint32_t                 namelen;
+    uint32_t                 r = 0;
+    uint32_t                 p = 0;
+    uint32_t                 i;
+    char                    *out;
+
+    size = (size_t)cols->lcb_count * sizeof(struct changelog_rec) +
+           (size_t)cols->lcb_rename_count * sizeof(struct changelog_ext_rename) +
+           cols->lcb_name_off[cols->lcb_count];
+
+    for (i = 0; i < cols->lcb_count; i++) {
+        if (cols->lcb_flags[i] & CLF_JOBID)
+            size += sizeof(struct changelog_ext_jobid);
+    }
+
+    out = malloc(size);
+    if (out == NULL)
+        return -ENOMEM;
+
+    for (i = 0, off = 0; i < cols->lcb_count; i++) {
+        rec = (struct changelog_rec *)(out + off);
+        namelen = cols->lcb_name_off[i + 1] - cols->lcb_name_off[i];
+
+        rec->cr_namelen = namelen;
+        rec->cr_flags   = cols->lcb_flags[i];
+        rec->cr_type    = cols->lcb_type[i];
+        rec->cr_index   = lcap_col_index(cols, i);
+        rec->cr_time    = lcap_col_time(cols, i);
+        rec->cr_prev    = 0;
+        memcpy(&rec->cr_tfid, cols->lcb_tfid + i, sizeof(struct lu_fid));
+        memcpy(&rec->cr_pfid, cols->lcb_pfid + i, sizeof(struct lu_fid));
+
+        if (p < cols->lcb_prev_count && cols->lcb_prev_pos[p] == i)
+            rec->cr_prev = cols->lcb_prev[p++];
+
+        if (rec->cr_flags & CLF_RENAME)
+            memcpy(changelog_rec_rename(rec), cols->lcb_rename + r++,
+                   sizeof(struct changelog_ext_rename));
+
+        if (rec->cr_flags & CLF_JOBID)
+            memcpy(changelog_rec_jobid(rec)->cr_jobid,
+                   lcap_col_jobid(cols, i), LUSTRE_JOBID_SIZE);
+
+        memcpy(changelog_rec_name(rec),
+               cols->lcb_names + cols->lcb_name_off[i], namelen);
+        off += changelog_rec_size(rec) + namelen;
+    }
+
+    *buff = out;
+    *len  = size;
+    return 0;
+}
@@ -29,6 +29,7 @@
 #include <lustre/lustreapi.h>
 
 #include <lcap_idl.h>
+#include <lcap_columns.h>
 
 
 enum lcap_cl_flags {
@@ -39,9 +40,43 @@ enum lcap_cl_flags {
     /* NULL-channel, get records directly from Lustre */
     LCAP_CL_DIRECT  = 0x04,
     /* Include (possibly empty) jobid record extension */
-    LCAP_CL_JOBID   = 0x08
+    LCAP_CL_JOBID   = 0x08,
+    /* Have records pushed by the server as they come (proxy mode only) */
+    LCAP_CL_STREAM  = RPC_REG_STREAM,
+    /* Receive every record, whatever the other consumers (proxy mode only) */
+    LCAP_CL_BROADCAST = RPC_REG_BROADCAST,
+    /* Have records compressed on the wire, if supported (proxy mode only) */
+    LCAP_CL_COMPRESS = RPC_REG_COMPRESS,
+    /* Have records encoded by columns on the wire (proxy mode only) */
+    LCAP_CL_COLUMNAR = RPC_REG_COLUMNAR,
+    /* Start from a time, in msec since the Epoch, rather than from a record
+     * (proxy mode only) */
+    LCAP_CL_START_TIME = RPC_REG_START_TIME
 };
 
+/**
+ * Environment variables tuning proxy (lcapd) sessions.
+ */
+/* Delay (msec) to acknowledge records before they are sent to another client */
+#define LCAP_ENV_ACK_TIMEOUT    "LCAP_ACK_TIMEOUT"
+/* Number of buckets to receive ahead, before acknowledging previous ones */
+#define LCAP_ENV_CREDITS        "LCAP_CREDITS"
+/* Consumer group to join, records being distributed among its members */
+#define LCAP_ENV_GROUP          "LCAP_GROUP"
+/* Only receive records of these types, as a mask of (1 << cr_type) */
+#define LCAP_ENV_TYPE_MASK      "LCAP_TYPE_MASK"
+/* Only receive records with any of these cr_flags set */
+#define LCAP_ENV_FLAGS_MASK     "LCAP_FLAGS_MASK"
+/* Only receive records matching this expression, see lcapd filter.h */
+#define LCAP_ENV_FILTER         "LCAP_FILTER"
+/* Comma separated list of the MDTs that LCAP_MDT_ALL stands for */
+#define LCAP_ENV_MDTS           "LCAP_MDTS"
+
+/**
+ * Device name to read the records of all MDTs (see LCAP_ENV_MDTS), merged.
+ */
+#define LCAP_MDT_ALL            "all"
+
 
 struct lcap_cl_ctx;
 
@@ -53,6 +88,8 @@ struct lcap_cl_operations {
     int (*cco_free)(struct lcap_cl_ctx *, struct changelog_rec **);
     int (*cco_clear)(struct lcap_cl_ctx *, const char *, const char *,
                      long long);
+    int (*cco_columns)(struct lcap_cl_ctx *, const struct lcap_col_batch **);
+    int (*cco_origin)(struct lcap_cl_ctx *, const char **);
 };
 
 /* Opaque context.
@@ -69,11 +106,19 @@ struct lcap_cl_ctx {
  * \param[out]  pctx        Address of a lcap_cl_ctx pointer which this
  *                          function will initialize and which is to be
  *                          passed to the other lcap_changelog_*() functions
+ * Records of several MDTs can be read at once, merged by time, by naming
+ * them all separated by commas (or LCAP_MDT_ALL). This is not supported in
+ * direct or streaming mode, and the start record has to be a time then
+ * (LCAP_CL_START_TIME), if any.
+ *
  * \param[in]   flags       Set of LCAP_CL_* flags
  * \param[in]   mdtname     Device name from which to read records
- * \param[in]   startrec    Id of the first desired record
+ * \param[in]   startrec    Id of the first desired record, or its time in
+ *                          msec since the Epoch with LCAP_CL_START_TIME
  *
  * \retval 0 on success
+ * \retval -EPROTONOSUPPORT if the server predates protocol versioning and
+ *         cannot honor the flags or selection (see LCAP_ENV_*) asked for
  * \retval Appropriate negative error code on failure
  */
 int lcap_changelog_start(struct lcap_cl_ctx **pctx, enum lcap_cl_flags flags,
@@ -135,9 +180,61 @@ static inline int lcap_changelog_free(struct lcap_cl_ctx *ctx,
     return ctx->ccc_ops->cco_free(ctx, rec);
 }
 
+/**
+ * Receive the records of a whole batch at once, as columns (see lcap_columns.h)
+ * to scan field by field. This works with any batch, but is cheapest for
+ * batches sent by columns (LCAP_CL_COLUMNAR). Records of the batch already
+ * received through lcap_changelog_recv() are the ones before lcb_first.
+ *
+ * \param[in]   ctx     The client context initialized by lcap_changelog_start
+ * \param[out]  cols    Where to store the batch, valid until the next call to
+ *                      lcap_changelog_recv() or lcap_changelog_columns()
+ *
+ * \retval 0 on success
+ * \retval -EOPNOTSUPP in direct mode
+ * \retval Appropriate negative error code on failure
+ */
+static inline int lcap_changelog_columns(struct lcap_cl_ctx *ctx,
+                                         const struct lcap_col_batch **cols)
+{
+    assert(ctx);
+    assert(ctx->ccc_ops);
+
+    if (ctx->ccc_ops->cco_columns == NULL)
+        return -EOPNOTSUPP;
+
+    return ctx->ccc_ops->cco_columns(ctx, cols);
+}
+
+/**
+ * Get the device name of the MDT the last received record comes from, which
+ * is where to clear it when reading several MDTs at once.
+ *
+ * \param[in]   ctx     The client context initialized by lcap_changelog_start
+ * \param[out]  mdtname Where to store the device name, valid until
+ *                      lcap_changelog_fini()
+ *
+ * \retval 0 on success
+ * \retval -ENODATA if no record has been received yet
+ * \retval -EOPNOTSUPP in direct mode
+ */
+static inline int lcap_changelog_origin(struct lcap_cl_ctx *ctx,
+                                        const char **mdtname)
+{
+    assert(ctx);
+    assert(ctx->ccc_ops);
+
+    if (ctx->ccc_ops->cco_origin == NULL)
+        return -EOPNOTSUPP;
+
+    return ctx->ccc_ops->cco_origin(ctx, mdtname);
+}
+
 /**
  * Acknowledge records up to a given number so that they can be cleared
- * upstream.
+ * upstream. When reading several MDTs at once, name the MDT of the records
+ * (see lcap_changelog_origin()), or name them as on start with \a endrec 0 to
+ * clear each one up to the last record received from it.
  *
  * \param[in]   ctx     The client context initialized by lcap_changelog_start
  * \param[in]   mdtname The device name on which to free the records
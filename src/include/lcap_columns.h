@@ -0,0 +1,131 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef LCAP_COLUMNS_H
+#define LCAP_COLUMNS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <lustre/lustreapi.h>
+#include <lustre/lustre_user.h>
+
+/**
+ * Columnar view of a batch of records.
+ *
+ * Fixed-width fields are stored as arrays indexed by record rank, so that a
+ * batch can be scanned one field at a time. Indexes and times are stored as
+ * offsets from the smallest value of the batch. Rename extensions and the
+ * (seldom set) cr_prev field are sparse, along with the rank of the records
+ * they belong to. Job IDs are stored once per batch, records referring to them
+ * by rank in the dictionary. Names are concatenated, record i owning the bytes
+ * from lcb_name_off[i] to lcb_name_off[i + 1].
+ *
+ * Columns point into the buffer the batch was decoded from.
+ */
+struct lcap_col_batch {
+    uint32_t                             lcb_count;     /**< Records */
+    uint32_t                             lcb_first;     /**< First record not
+                                                          consumed already */
+    uint64_t                             lcb_base_index;
+    uint64_t                             lcb_base_time;
+    const uint32_t                      *lcb_index;     /**< cr_index - base */
+    const uint32_t                      *lcb_time32;    /**< cr_time - base */
+    const uint64_t                      *lcb_time64;    /**< Same, if time32
+                                                          is NULL */
+    const uint8_t                       *lcb_type;
+    const uint16_t                      *lcb_flags;
+    const struct lu_fid                 *lcb_tfid;      /**< Or marker flags */
+    const struct lu_fid                 *lcb_pfid;
+    uint32_t                             lcb_rename_count;
+    const uint32_t                      *lcb_rename_pos; /**< CLF_RENAME */
+    const struct changelog_ext_rename   *lcb_rename;
+    uint32_t                             lcb_prev_count;
+    const uint32_t                      *lcb_prev_pos;  /**< cr_prev != 0 */
+    const uint64_t                      *lcb_prev;
+    uint32_t                             lcb_jobid_count;
+    const uint16_t                      *lcb_jobid;     /**< CLF_JOBID */
+    const char                          *lcb_jobid_dict; /**< Entries of
+                                                          LUSTRE_JOBID_SIZE */
+    const uint32_t                      *lcb_name_off;  /**< count + 1 */
+    const char                          *lcb_names;
+};
+
+static inline uint64_t lcap_col_index(const struct lcap_col_batch *cols,
+                                      uint32_t i)
+{
+    return cols->lcb_base_index + cols->lcb_index[i];
+}
+
+static inline uint64_t lcap_col_time(const struct lcap_col_batch *cols,
+                                     uint32_t i)
+{
+    if (cols->lcb_time32 != NULL)
+        return cols->lcb_base_time + cols->lcb_time32[i];
+
+    return cols->lcb_base_time + cols->lcb_time64[i];
+}
+
+/**
+ * Job ID of a record, not necessarily NUL-terminated, or NULL if it has none.
+ */
+static inline const char *lcap_col_jobid(const struct lcap_col_batch *cols,
+                                         uint32_t i)
+{
+    if (!(cols->lcb_flags[i] & CLF_JOBID))
+        return NULL;
+
+    return cols->lcb_jobid_dict + cols->lcb_jobid[i] * LUSTRE_JOBID_SIZE;
+}
+
+static inline const char *lcap_col_name(const struct lcap_col_batch *cols,
+                                        uint32_t i, size_t *len)
+{
+    *len = cols->lcb_name_off[i + 1] - cols->lcb_name_off[i];
+    return cols->lcb_names + cols->lcb_name_off[i];
+}
+
+/**
+ * Encode \a count records, \a len bytes long, into a newly allocated buffer.
+ * The encoded batch starts \a headroom bytes (a multiple of 8) into the buffer,
+ * left for the caller to use, and is \a col_len bytes long.
+ *
+ * \retval 0 on success
+ * \retval -EOVERFLOW if the records cannot be represented this way
+ * \retval Appropriate negative error code on failure
+ */
+int lcap_col_encode(const void *recs, size_t len, uint32_t count,
+                    size_t headroom, void **buff, size_t *col_len);
+
+/**
+ * Check an encoded batch and map its columns. The batch must be 8-byte aligned
+ * and stay around as long as \a cols is used.
+ */
+int lcap_col_decode(const void *buff, size_t len, struct lcap_col_batch *cols);
+
+/**
+ * Rebuild the records of a batch, as a newly allocated buffer of \a len bytes.
+ */
+int lcap_col_records(const struct lcap_col_batch *cols, void **buff,
+                     size_t *len);
+
+#endif /* LCAP_COLUMNS_H */
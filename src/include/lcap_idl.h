@@ -60,12 +60,45 @@ enum rpc_op_type {
 };
 
 
+/**
+ * Version of the layouts below, carried by the header of every message. Peers
+ * which predate versioning leave it to 0 and use the layouts of version 0
+ * (px_rpc_register_v0, px_rpc_enqueue_v0, others are unchanged).
+ */
+#define LCAP_PROTO_VERSION  1
+
 struct px_rpc_hdr {
     uint32_t    op_type;
-    uint32_t    reserved;
+    uint32_t    version;    /* LCAP_PROTO_VERSION of the sender */
 } __attribute__((packed));
 
+/* px_rpc_register::pr_flags, along with the LCAP_CL_* client flags */
+#define RPC_REG_STREAM      0x10    /* Push records, as LCAP_CL_STREAM */
+#define RPC_REG_BROADCAST   0x20    /* Get all records, as LCAP_CL_BROADCAST */
+#define RPC_REG_COMPRESS    0x40    /* Accept compressed records */
+#define RPC_REG_COLUMNAR    0x80    /* Accept records encoded by columns */
+#define RPC_REG_START_TIME  0x100   /* pr_start is a time (msec since the
+                                       Epoch), as LCAP_CL_START_TIME */
+
+/* Size of px_rpc_register::pr_group, including the terminating NUL */
+#define RPC_GROUP_NAME_LEN  64
+
 struct px_rpc_register {
+    struct px_rpc_hdr   pr_hdr;
+    uint32_t            pr_flags;
+    uint32_t            pr_ack_timeout; /* msec, 0 for server default */
+    uint64_t            pr_start;
+    uint8_t             pr_mdtname[128];
+    uint32_t            pr_credits;     /* max buckets held, 0 for 1 */
+    uint32_t            pr_flags_mask;  /* cr_flags of interest, 0 for all */
+    uint64_t            pr_type_mask;   /* 1 << cr_type of interest, 0 for all */
+    uint8_t             pr_group[RPC_GROUP_NAME_LEN]; /* "" for default */
+    uint32_t            pr_filter_len;  /* including NUL, 0 if no filter */
+    char                pr_filter[0];   /* filter expression */
+} __attribute__((packed));
+
+/* Layout of version 0, still accepted from legacy clients */
+struct px_rpc_register_v0 {
     struct px_rpc_hdr   pr_hdr;
     uint32_t            pr_flags;
     uint32_t            padding;
@@ -80,7 +113,21 @@ struct px_rpc_clear {
     char                pr_id[0];
 } __attribute__((packed));
 
+/* px_rpc_enqueue::pr_flags */
+#define RPC_ENQ_ZLIB        0x01    /* pr_records is a zlib stream */
+#define RPC_ENQ_COLUMNAR    0x02    /* pr_records is a lcap_columns.h batch */
+
 struct px_rpc_enqueue {
+    struct px_rpc_hdr   pr_hdr;
+    uint32_t            pr_count;
+    uint32_t            pr_flags;
+    uint32_t            pr_raw_len;     /* uncompressed length of pr_records */
+    uint32_t            pr_reserved;    /* keeps pr_records 8-byte aligned */
+    uint8_t             pr_records[0];
+} __attribute__((packed));
+
+/* Layout of version 0, as sent to legacy clients */
+struct px_rpc_enqueue_v0 {
     struct px_rpc_hdr   pr_hdr;
     uint32_t            pr_count;
     uint8_t             pr_records[0];
@@ -97,6 +144,8 @@ struct px_rpc_fini {
 struct px_rpc_ack {
     struct px_rpc_hdr   pr_hdr;
     int32_t             pr_retcode;
+    uint32_t            pr_op;          /* operation acknowledged, as of
+                                           version 1 */
 } __attribute__((packed));
 
 struct px_rpc_signal {
@@ -110,7 +159,8 @@ static inline size_t rpc_expected_length(enum rpc_op_type op)
 {
     switch (op) {
         case RPC_OP_START:
-            return sizeof(struct px_rpc_register);
+            /* Legacy clients send the shorter layout */
+            return sizeof(struct px_rpc_register_v0);
         case RPC_OP_DEQUEUE:
             return sizeof(struct px_rpc_dequeue);
         case RPC_OP_CLEAR:
@@ -128,6 +178,12 @@ static inline size_t rpc_expected_length(enum rpc_op_type op)
     }
 }
 
+static inline void rpc_hdr_init(struct px_rpc_hdr *hdr, enum rpc_op_type op)
+{
+    hdr->op_type = op;
+    hdr->version = LCAP_PROTO_VERSION;
+}
+
 static inline const char *rpc_optype2str(enum rpc_op_type type)
 {
     switch(type) {
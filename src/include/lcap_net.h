@@ -35,12 +35,17 @@ struct conn_id {
 
 #define LCAP_RECV_NO_ENVELOPE   (1 << 0)
 #define LCAP_RECV_NONBLOCK      (1 << 1)
+/* Keep the body frames as received, so that they can be forwarded as they are.
+ * lr_body then references the frame of single frame bodies instead of a copy */
+#define LCAP_RECV_FRAMES        (1 << 2)
 struct lcapnet_request {
     int                  lr_flags;
     struct conn_id      *lr_remote;
     struct conn_id      *lr_forward;
     struct px_rpc_hdr   *lr_body;
     size_t               lr_body_len;
+    zmq_msg_t           *lr_frames;     /* Body frames, LCAP_RECV_FRAMES only */
+    int                  lr_nframes;
 };
 
 /**
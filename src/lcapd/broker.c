@@ -95,15 +95,17 @@ static int broker_reader_send(struct lcap_ctx *ctx,
                (int)req->lr_forward->ci_length,
                (const char *)req->lr_forward->ci_data);
 
-    return peer_rpc_send(ctx->cc_sock, req->lr_forward, req->lr_remote,
-                         (const char *)req->lr_body, req->lr_body_len);
+    return peer_rpc_forward(ctx->cc_sock, req->lr_forward, req->lr_remote, req);
 }
 
+/**
+ * Forward a reply to its client. Records are handed over as the reader sent
+ * them, frames referencing its buckets, so that the broker copies none.
+ */
 static int broker_client_send(struct lcap_ctx *ctx,
                               const struct lcapnet_request *req)
 {
-    return peer_rpc_send(ctx->cc_sock, NULL, req->lr_forward,
-                         (const char *)req->lr_body, req->lr_body_len);
+    return peer_rpc_forward(ctx->cc_sock, NULL, req->lr_forward, req);
 }
 
 static int broker_handle_signal(struct lcap_ctx *ctx,
@@ -158,6 +160,7 @@ int lcapd_process_request(void *hint, const struct lcapnet_request *req)
     struct lcap_ctx     *ctx = (struct lcap_ctx *)hint;
     struct px_rpc_hdr   *hdr = req->lr_body;
     size_t               msg_len = req->lr_body_len;
+    enum rpc_op_type     op_type = RPC_OP_ACK;
     int                  rc = 0;
 
     if (msg_len < sizeof(*hdr)) {
@@ -166,20 +169,22 @@ int lcapd_process_request(void *hint, const struct lcapnet_request *req)
         goto out_reply;
     }
 
-    if (hdr->op_type < RPC_OP_FIRST || hdr->op_type > RPC_OP_LAST) {
+    /* The body is gone once forwarded */
+    op_type = hdr->op_type;
+    if (op_type < RPC_OP_FIRST || op_type > RPC_OP_LAST) {
         rc = -EINVAL;
-        lcap_error("Received RPC with invalid opcode: %d\n", hdr->op_type);
+        lcap_error("Received RPC with invalid opcode: %d\n", op_type);
         goto out_reply;
     }
 
-    rc = rpc_handle_one(ctx, hdr->op_type, req);
+    rc = rpc_handle_one(ctx, op_type, req);
 
 out_reply:
-    lcap_debug("Received %s RPC [rc=%d | %s]", rpc_optype2str(hdr->op_type),
+    lcap_debug("Received %s RPC [rc=%d | %s]", rpc_optype2str(op_type),
                rc, zmq_strerror(-rc));
 
     if (rc < 0)
-        rc = ack_retcode(ctx->cc_sock, NULL, req->lr_remote, rc);
+        rc = ack_retcode(ctx->cc_sock, NULL, req->lr_remote, op_type, rc);
 
     return rc;
 }
@@ -32,6 +32,12 @@
 #define DEFAULT_CFG_FILE    "/etc/lcap.cfg"
 #define DEFAULT_REC_BATCH   64
 #define DEFAULT_MAX_BUCKETS 256
+#define DEFAULT_CLEAR_INTERVAL  1000
+#define DEFAULT_CLEAR_BATCH     4096
+#define DEFAULT_ACK_TIMEOUT     10000
+#define DEFAULT_MAX_CREDITS     16
+#define DEFAULT_GROUP_EXPIRY    3600
+#define DEFAULT_SPILL_SEG_SIZE  (64 << 20)
 
 /* defined in lcapd.c */
 void usage(void);
@@ -59,6 +65,75 @@ static char *cfg_get_arg(const char *line)
     return strdup(arg);
 }
 
+/**
+ * Parse a boolean argument (yes/no, true/false, on/off, 1/0).
+ */
+static int cfg_get_bool(const char *line, bool *val)
+{
+    char    *arg;
+    int      rc = 0;
+
+    arg = cfg_get_arg(line);
+    if (arg == NULL)
+        return -EINVAL;
+
+    if (strcasecmp(arg, "yes") == 0 || strcasecmp(arg, "true") == 0 ||
+        strcasecmp(arg, "on") == 0 || strcmp(arg, "1") == 0)
+        *val = true;
+    else if (strcasecmp(arg, "no") == 0 || strcasecmp(arg, "false") == 0 ||
+             strcasecmp(arg, "off") == 0 || strcmp(arg, "0") == 0)
+        *val = false;
+    else
+        rc = -EINVAL;
+
+    free(arg);
+    return rc;
+}
+
+/**
+ * Parse a size in bytes, with an optional K, M or G suffix.
+ */
+static int cfg_get_size(const char *line, size_t *val)
+{
+    char                *arg;
+    char                *end;
+    unsigned long long   size;
+    int                  rc = 0;
+
+    arg = cfg_get_arg(line);
+    if (arg == NULL)
+        return -EINVAL;
+
+    errno = 0;
+    size = strtoull(arg, &end, 10);
+    if (errno != 0 || end == arg) {
+        rc = -EINVAL;
+        goto out_free;
+    }
+
+    switch (toupper(*end)) {
+        case 'G':
+            size <<= 10;
+            /* fall through */
+        case 'M':
+            size <<= 10;
+            /* fall through */
+        case 'K':
+            size <<= 10;
+            end++;
+            break;
+    }
+
+    if (*end != '\0')
+        rc = -EINVAL;
+    else
+        *val = size;
+
+out_free:
+    free(arg);
+    return rc;
+}
+
 static int lcap_parse_args(int ac, char **av, struct lcap_cfg *config)
 {
     int opt;
@@ -125,6 +200,146 @@ static int handle_cfg_max_buckets_line(struct lcap_cfg *config, const char *line
     return 0;
 }
 
+static int handle_cfg_max_memory_line(struct lcap_cfg *config, const char *line)
+{
+    return cfg_get_size(line, &config->ccf_max_mem);
+}
+
+static int handle_cfg_max_total_memory_line(struct lcap_cfg *config,
+                                            const char *line)
+{
+    return cfg_get_size(line, &config->ccf_max_total_mem);
+}
+
+static int handle_cfg_spill_dir_line(struct lcap_cfg *config, const char *line)
+{
+    char *dir;
+
+    if (config->ccf_spill_dir)
+        return -EALREADY;
+
+    dir = cfg_get_arg(line);
+    if (dir == NULL) {
+        fprintf(stderr, "Missing parameter: spill directory\n");
+        return -EINVAL;
+    }
+
+    config->ccf_spill_dir = dir;
+    return 0;
+}
+
+static int handle_cfg_spill_segment_size_line(struct lcap_cfg *config,
+                                              const char *line)
+{
+    return cfg_get_size(line, &config->ccf_spill_seg_size);
+}
+
+static int handle_cfg_clear_interval_line(struct lcap_cfg *config,
+                                         const char *line)
+{
+    char *msec;
+
+    msec = cfg_get_arg(line);
+    if (msec == NULL)
+        return -EINVAL;
+
+    config->ccf_clear_interval = atoi(msec);
+    free(msec);
+
+    return 0;
+}
+
+static int handle_cfg_clear_batch_line(struct lcap_cfg *config,
+                                       const char *line)
+{
+    char *count;
+
+    count = cfg_get_arg(line);
+    if (count == NULL)
+        return -EINVAL;
+
+    config->ccf_clear_batch = atoi(count);
+    free(count);
+
+    return 0;
+}
+
+static int handle_cfg_ack_timeout_line(struct lcap_cfg *config,
+                                       const char *line)
+{
+    char *msec;
+
+    msec = cfg_get_arg(line);
+    if (msec == NULL)
+        return -EINVAL;
+
+    config->ccf_ack_timeout = atoi(msec);
+    free(msec);
+
+    return 0;
+}
+
+static int handle_cfg_max_credits_line(struct lcap_cfg *config,
+                                       const char *line)
+{
+    char *count;
+
+    count = cfg_get_arg(line);
+    if (count == NULL)
+        return -EINVAL;
+
+    config->ccf_max_credits = atoi(count);
+    free(count);
+
+    /* Clients could not hold a single bucket */
+    if (config->ccf_max_credits <= 0) {
+        fprintf(stderr, "Invalid parameter: Max_Credits must be positive\n");
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int handle_cfg_group_expiry_line(struct lcap_cfg *config,
+                                        const char *line)
+{
+    char *secs;
+
+    secs = cfg_get_arg(line);
+    if (secs == NULL)
+        return -EINVAL;
+
+    config->ccf_group_expiry = atoi(secs);
+    free(secs);
+
+    return 0;
+}
+
+static int handle_cfg_hugepages_line(struct lcap_cfg *config, const char *line)
+{
+    return cfg_get_bool(line, &config->ccf_hugepages);
+}
+
+static int handle_cfg_coalesce_line(struct lcap_cfg *config, const char *line)
+{
+    return cfg_get_bool(line, &config->ccf_coalesce);
+}
+
+static int handle_cfg_coalesce_window_line(struct lcap_cfg *config,
+                                           const char *line)
+{
+    char *msec;
+
+    msec = cfg_get_arg(line);
+    if (msec == NULL)
+        return -EINVAL;
+
+    config->ccf_coalesce_window = atoi(msec);
+    free(msec);
+
+    return 0;
+}
+
 static int handle_cfg_logtype_line(struct lcap_cfg *config, const char *line)
 {
     if (config->ccf_loggername)
@@ -198,6 +413,19 @@ static int __parse_config_line(struct lcap_cfg *config, const char *line)
         /* -- global -- */
         {"batch_records", handle_cfg_batch_records_line},
         {"max_buckets",   handle_cfg_max_buckets_line},
+        {"max_memory",    handle_cfg_max_memory_line},
+        {"max_total_memory", handle_cfg_max_total_memory_line},
+        {"spill_dir",     handle_cfg_spill_dir_line},
+        {"spill_segment_size", handle_cfg_spill_segment_size_line},
+        {"hugepages",     handle_cfg_hugepages_line},
+        {"clear_interval", handle_cfg_clear_interval_line},
+        {"clear_batch",   handle_cfg_clear_batch_line},
+        {"ack_timeout",   handle_cfg_ack_timeout_line},
+        {"max_credits",   handle_cfg_max_credits_line},
+        {"group_expiry",  handle_cfg_group_expiry_line},
+        /* prefix match, longest first */
+        {"coalesce_window", handle_cfg_coalesce_window_line},
+        {"coalesce",      handle_cfg_coalesce_line},
         {"logtype",       handle_cfg_logtype_line},
         {"workers",       handle_cfg_workers_line},
         /* -- lustre filesystem -- */
@@ -258,6 +486,12 @@ static void config_set_defaults(struct lcap_cfg *config)
 {
     config->ccf_rec_batch_count = DEFAULT_REC_BATCH;
     config->ccf_max_bkt         = DEFAULT_MAX_BUCKETS;
+    config->ccf_clear_interval  = DEFAULT_CLEAR_INTERVAL;
+    config->ccf_clear_batch     = DEFAULT_CLEAR_BATCH;
+    config->ccf_ack_timeout     = DEFAULT_ACK_TIMEOUT;
+    config->ccf_max_credits     = DEFAULT_MAX_CREDITS;
+    config->ccf_group_expiry    = DEFAULT_GROUP_EXPIRY;
+    config->ccf_spill_seg_size  = DEFAULT_SPILL_SEG_SIZE;
 }
 
 int lcap_cfg_init(int ac, char **av, struct lcap_cfg *config)
@@ -283,6 +517,7 @@ int lcap_cfg_release(struct lcap_cfg *cfg)
         free(cfg->ccf_mdt[i]);
 
     free(cfg->ccf_clreader);
+    free(cfg->ccf_spill_dir);
     free(cfg->ccf_file);
     free(cfg->ccf_loggername);
 
@@ -0,0 +1,701 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include <lcap_log.h>
+
+#include "filter.h"
+
+/**
+ * Expressions are compiled into postfix programs, evaluated over a stack of
+ * booleans held in a single machine word. Predicates push their result,
+ * operators combine the topmost ones. Operands (FID sets, strings) live in a
+ * constant pool, FID sets being sorted for binary search.
+ */
+
+/**
+ * Depth of the evaluation stack, i.e. number of bits in its word.
+ */
+#define FILTER_STACK_MAX    64
+
+/**
+ * Longest field name and literal accepted.
+ */
+#define FILTER_WORD_MAX     256
+
+enum filter_field {
+    FF_TYPE,
+    FF_TFID,
+    FF_PFID,
+    FF_SFID,
+    FF_SPFID,
+    FF_JOBID,
+    FF_NAME,
+};
+
+enum filter_opcode {
+    FOP_TYPE,       /**< Record type in fi_mask */
+    FOP_FID,        /**< FID field in the set at fi_offset */
+    FOP_STR_EQ,     /**< String field equal to the one at fi_offset */
+    FOP_STR_PREFIX, /**< String field starting with the one at fi_offset */
+    FOP_NOT,
+    FOP_AND,
+    FOP_OR,
+};
+
+struct filter_insn {
+    uint8_t                  fi_op;     /**< enum filter_opcode */
+    uint8_t                  fi_field;  /**< enum filter_field */
+    uint16_t                 fi_count;  /**< FIDs in set, string length */
+    uint32_t                 fi_offset; /**< Operand offset in the pool */
+    uint64_t                 fi_mask;   /**< Record types, as 1 << cr_type */
+};
+
+struct rec_filter {
+    struct filter_insn      *rf_code;
+    unsigned int             rf_len;    /**< Number of instructions */
+    unsigned int             rf_size;   /**< Allocated instructions */
+    char                    *rf_pool;   /**< Constant pool */
+    size_t                   rf_pool_len;
+    size_t                   rf_pool_size;
+};
+
+struct filter_parser {
+    const char              *fp_expr;   /**< Whole expression */
+    const char              *fp_pos;    /**< Current position */
+    int                      fp_depth;  /**< Stack depth at this point */
+    int                      fp_nesting; /**< Parentheses and negations
+                                              being parsed */
+    struct rec_filter       *fp_filter; /**< Program being compiled */
+};
+
+static const struct {
+    const char         *name;
+    enum filter_field   field;
+} filter_fields[] = {
+    {"type",    FF_TYPE},
+    {"tfid",    FF_TFID},
+    {"pfid",    FF_PFID},
+    {"sfid",    FF_SFID},
+    {"spfid",   FF_SPFID},
+    {"jobid",   FF_JOBID},
+    {"name",    FF_NAME},
+};
+
+
+static inline bool field_is_fid(enum filter_field field)
+{
+    return field == FF_TFID || field == FF_PFID || field == FF_SFID ||
+           field == FF_SPFID;
+}
+
+static inline bool field_is_str(enum filter_field field)
+{
+    return field == FF_JOBID || field == FF_NAME;
+}
+
+static int fid_cmp(const void *a, const void *b)
+{
+    const struct lu_fid *f0 = a;
+    const struct lu_fid *f1 = b;
+
+    if (f0->f_seq != f1->f_seq)
+        return f0->f_seq < f1->f_seq ? -1 : 1;
+
+    if (f0->f_oid != f1->f_oid)
+        return f0->f_oid < f1->f_oid ? -1 : 1;
+
+    if (f0->f_ver != f1->f_ver)
+        return f0->f_ver < f1->f_ver ? -1 : 1;
+
+    return 0;
+}
+
+static int parse_error(const struct filter_parser *fp, const char *msg)
+{
+    lcap_error("Invalid filter at offset %ld (%s): %s",
+               (long)(fp->fp_pos - fp->fp_expr), msg, fp->fp_expr);
+    return -EINVAL;
+}
+
+static int emit(struct filter_parser *fp, enum filter_opcode op,
+                enum filter_field field, unsigned int count, size_t offset,
+                uint64_t mask)
+{
+    struct rec_filter   *filter = fp->fp_filter;
+    struct filter_insn  *insn;
+
+    if (filter->rf_len == filter->rf_size) {
+        unsigned int size = filter->rf_size ? filter->rf_size * 2 : 16;
+
+        insn = realloc(filter->rf_code, size * sizeof(*insn));
+        if (insn == NULL)
+            return -ENOMEM;
+
+        filter->rf_code = insn;
+        filter->rf_size = size;
+    }
+
+    /* Predicates push a value, operators but NOT pop one */
+    if (op == FOP_AND || op == FOP_OR) {
+        fp->fp_depth--;
+    } else if (op != FOP_NOT) {
+        if (++fp->fp_depth > FILTER_STACK_MAX)
+            return parse_error(fp, "expression too deep");
+    }
+
+    insn = &filter->rf_code[filter->rf_len++];
+    insn->fi_op     = op;
+    insn->fi_field  = field;
+    insn->fi_count  = count;
+    insn->fi_offset = offset;
+    insn->fi_mask   = mask;
+    return 0;
+}
+
+/**
+ * Copy \a len bytes to the constant pool, 8-bytes aligned.
+ * Return the offset of the copy, or a negative error code.
+ */
+static long pool_add(struct filter_parser *fp, const void *data, size_t len)
+{
+    struct rec_filter   *filter = fp->fp_filter;
+    size_t               offset = (filter->rf_pool_len + 7) & ~(size_t)7;
+    char                *pool;
+
+    if (offset + len > filter->rf_pool_size) {
+        size_t size = (offset + len) * 2;
+
+        pool = realloc(filter->rf_pool, size);
+        if (pool == NULL)
+            return -ENOMEM;
+
+        filter->rf_pool = pool;
+        filter->rf_pool_size = size;
+    }
+
+    memcpy(filter->rf_pool + offset, data, len);
+    filter->rf_pool_len = offset + len;
+    return offset;
+}
+
+static inline bool is_word_char(char c)
+{
+    return isalnum((unsigned char)c) || (c != '\0' && strchr("_.-@/:+", c));
+}
+
+static void skip_spaces(struct filter_parser *fp)
+{
+    while (isspace((unsigned char)*fp->fp_pos))
+        fp->fp_pos++;
+}
+
+/**
+ * Consume \a token if it comes next. Keywords must not be directly followed
+ * by another word character.
+ */
+static bool accept(struct filter_parser *fp, const char *token)
+{
+    size_t  len = strlen(token);
+
+    skip_spaces(fp);
+    if (strncasecmp(fp->fp_pos, token, len) != 0)
+        return false;
+
+    if (is_word_char(token[len - 1]) && is_word_char(fp->fp_pos[len]))
+        return false;
+
+    fp->fp_pos += len;
+    return true;
+}
+
+/**
+ * Read a bare word or a double-quoted string into \a buf.
+ * Return its length, or a negative error code.
+ */
+static int parse_word(struct filter_parser *fp, char *buf, size_t size)
+{
+    const char  *start;
+    size_t       len;
+
+    skip_spaces(fp);
+    if (*fp->fp_pos == '"') {
+        start = ++fp->fp_pos;
+        while (*fp->fp_pos != '"') {
+            if (*fp->fp_pos == '\0')
+                return parse_error(fp, "unterminated string");
+            fp->fp_pos++;
+        }
+        len = fp->fp_pos++ - start;
+    } else {
+        start = fp->fp_pos;
+        while (is_word_char(*fp->fp_pos))
+            fp->fp_pos++;
+        len = fp->fp_pos - start;
+        if (len == 0)
+            return parse_error(fp, "word expected");
+    }
+
+    if (len >= size)
+        return parse_error(fp, "word too long");
+
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    return len;
+}
+
+static int parse_type(struct filter_parser *fp, uint64_t *mask)
+{
+    char    word[FILTER_WORD_MAX];
+    char   *end;
+    long    type;
+    int     rc;
+
+    rc = parse_word(fp, word, sizeof(word));
+    if (rc < 0)
+        return rc;
+
+    type = strtol(word, &end, 0);
+    if (*end != '\0') {
+        for (type = 0; type < CL_LAST; type++) {
+            if (strcasecmp(word, changelog_type2str(type)) == 0)
+                break;
+        }
+    }
+
+    if (type < 0 || type >= CL_LAST || type >= 64)
+        return parse_error(fp, "unknown record type");
+
+    *mask |= 1ULL << type;
+    return 0;
+}
+
+static int parse_fid(struct filter_parser *fp, struct lu_fid *fid)
+{
+    unsigned long long  seq;
+    unsigned int        oid;
+    unsigned int        ver;
+    int                 len = 0;
+
+    skip_spaces(fp);
+    if (sscanf(fp->fp_pos, "[%llx:%x:%x]%n", &seq, &oid, &ver, &len) != 3 ||
+        len == 0)
+        return parse_error(fp, "FID expected");
+
+    fp->fp_pos += len;
+    fid->f_seq = seq;
+    fid->f_oid = oid;
+    fid->f_ver = ver;
+    return 0;
+}
+
+static int parse_set(struct filter_parser *fp, enum filter_field field)
+{
+    struct lu_fid   *fids = NULL;
+    unsigned int     count = 0;
+    uint64_t         mask = 0;
+    long             offset;
+    int              rc;
+
+    if (!field_is_fid(field) && field != FF_TYPE)
+        return parse_error(fp, "sets only apply to types and FIDs");
+
+    if (!accept(fp, "{"))
+        return parse_error(fp, "'{' expected");
+
+    do {
+        if (field == FF_TYPE) {
+            rc = parse_type(fp, &mask);
+            if (rc)
+                goto out;
+            continue;
+        }
+
+        if (count == UINT16_MAX) {
+            rc = parse_error(fp, "set too large");
+            goto out;
+        }
+
+        if ((count & (count - 1)) == 0) {
+            struct lu_fid *grown;
+
+            grown = realloc(fids, (count ? count * 2 : 1) * sizeof(*fids));
+            if (grown == NULL) {
+                rc = -ENOMEM;
+                goto out;
+            }
+            fids = grown;
+        }
+
+        rc = parse_fid(fp, &fids[count++]);
+        if (rc)
+            goto out;
+
+    } while (accept(fp, ","));
+
+    if (!accept(fp, "}")) {
+        rc = parse_error(fp, "'}' expected");
+        goto out;
+    }
+
+    if (field == FF_TYPE) {
+        rc = emit(fp, FOP_TYPE, field, 0, 0, mask);
+        goto out;
+    }
+
+    qsort(fids, count, sizeof(*fids), fid_cmp);
+    offset = pool_add(fp, fids, count * sizeof(*fids));
+    if (offset < 0) {
+        rc = offset;
+        goto out;
+    }
+
+    rc = emit(fp, FOP_FID, field, count, offset, 0);
+
+out:
+    free(fids);
+    return rc;
+}
+
+static int parse_predicate(struct filter_parser *fp)
+{
+    enum filter_field   field;
+    char                word[FILTER_WORD_MAX];
+    bool                negate = false;
+    bool                prefix = false;
+    struct lu_fid       fid;
+    uint64_t            mask = 0;
+    long                offset;
+    size_t              i;
+    int                 rc;
+
+    rc = parse_word(fp, word, sizeof(word));
+    if (rc < 0)
+        return rc;
+
+    for (i = 0; i < sizeof(filter_fields) / sizeof(filter_fields[0]); i++) {
+        if (strcasecmp(word, filter_fields[i].name) == 0)
+            break;
+    }
+
+    if (i == sizeof(filter_fields) / sizeof(filter_fields[0]))
+        return parse_error(fp, "unknown field");
+
+    field = filter_fields[i].field;
+
+    if (accept(fp, "in"))
+        return parse_set(fp, field);
+
+    if (accept(fp, "!="))
+        negate = true;
+    else if (accept(fp, "^="))
+        prefix = true;
+    else if (!accept(fp, "==") && !accept(fp, "="))
+        return parse_error(fp, "operator expected");
+
+    if (prefix && !field_is_str(field))
+        return parse_error(fp, "prefix match only applies to strings");
+
+    if (field == FF_TYPE) {
+        rc = parse_type(fp, &mask);
+        if (rc == 0)
+            rc = emit(fp, FOP_TYPE, field, 0, 0, mask);
+    } else if (field_is_fid(field)) {
+        rc = parse_fid(fp, &fid);
+        if (rc == 0) {
+            offset = pool_add(fp, &fid, sizeof(fid));
+            rc = offset < 0 ? offset : emit(fp, FOP_FID, field, 1, offset, 0);
+        }
+    } else {
+        rc = parse_word(fp, word, sizeof(word));
+        if (rc >= 0) {
+            size_t len = rc;
+
+            offset = pool_add(fp, word, len);
+            rc = offset < 0 ? offset : emit(fp, prefix ? FOP_STR_PREFIX :
+                                            FOP_STR_EQ, field, len, offset, 0);
+        }
+    }
+
+    if (rc == 0 && negate)
+        rc = emit(fp, FOP_NOT, field, 0, 0, 0);
+
+    return rc;
+}
+
+static int parse_expr(struct filter_parser *fp);
+
+/**
+ * Parse a predicate, possibly negated or parenthesized. Nesting is bounded
+ * as the stack is, so that remote expressions cannot exhaust the one of the
+ * reader thread before anything gets emitted.
+ */
+static int parse_factor(struct filter_parser *fp)
+{
+    int rc;
+
+    if (accept(fp, "not")) {
+        if (++fp->fp_nesting > FILTER_STACK_MAX)
+            return parse_error(fp, "expression too deep");
+
+        rc = parse_factor(fp);
+        fp->fp_nesting--;
+        return rc ? rc : emit(fp, FOP_NOT, 0, 0, 0, 0);
+    }
+
+    if (accept(fp, "(")) {
+        if (++fp->fp_nesting > FILTER_STACK_MAX)
+            return parse_error(fp, "expression too deep");
+
+        rc = parse_expr(fp);
+        fp->fp_nesting--;
+        if (rc)
+            return rc;
+
+        return accept(fp, ")") ? 0 : parse_error(fp, "')' expected");
+    }
+
+    return parse_predicate(fp);
+}
+
+static int parse_term(struct filter_parser *fp)
+{
+    int rc;
+
+    rc = parse_factor(fp);
+    while (rc == 0 && accept(fp, "and")) {
+        rc = parse_factor(fp);
+        if (rc == 0)
+            rc = emit(fp, FOP_AND, 0, 0, 0, 0);
+    }
+
+    return rc;
+}
+
+static int parse_expr(struct filter_parser *fp)
+{
+    int rc;
+
+    rc = parse_term(fp);
+    while (rc == 0 && accept(fp, "or")) {
+        rc = parse_term(fp);
+        if (rc == 0)
+            rc = emit(fp, FOP_OR, 0, 0, 0, 0);
+    }
+
+    return rc;
+}
+
+/**
+ * Compile a filter expression into \a filter, to be released with
+ * rec_filter_free(). Return 0 on success or a negative error code.
+ */
+int rec_filter_compile(const char *expr, struct rec_filter **filter)
+{
+    struct filter_parser    fp;
+    int                     rc;
+
+    memset(&fp, 0, sizeof(fp));
+    fp.fp_expr   = expr;
+    fp.fp_pos    = expr;
+    fp.fp_filter = calloc(1, sizeof(*fp.fp_filter));
+    if (fp.fp_filter == NULL)
+        return -ENOMEM;
+
+    rc = parse_expr(&fp);
+    if (rc == 0) {
+        skip_spaces(&fp);
+        if (*fp.fp_pos != '\0')
+            rc = parse_error(&fp, "trailing characters");
+    }
+
+    if (rc) {
+        rec_filter_free(fp.fp_filter);
+        return rc;
+    }
+
+    lcap_debug("Compiled filter '%s' into %u instructions", expr,
+               fp.fp_filter->rf_len);
+    *filter = fp.fp_filter;
+    return 0;
+}
+
+void rec_filter_free(struct rec_filter *filter)
+{
+    if (filter == NULL)
+        return;
+
+    free(filter->rf_code);
+    free(filter->rf_pool);
+    free(filter);
+}
+
+/**
+ * Copy a FID field of \a rec to \a fid, records being packed and unaligned.
+ * Return false if the record has no such field.
+ */
+static bool rec_fid(const struct changelog_rec *rec, enum filter_field field,
+                    struct lu_fid *fid)
+{
+    struct changelog_rec    *crec = (struct changelog_rec *)rec;
+    const void              *src;
+
+    switch (field) {
+        case FF_TFID:
+            src = (const char *)rec + offsetof(struct changelog_rec, cr_tfid);
+            break;
+        case FF_PFID:
+            src = (const char *)rec + offsetof(struct changelog_rec, cr_pfid);
+            break;
+        case FF_SFID:
+            if (!(rec->cr_flags & CLF_RENAME))
+                return false;
+            src = (const char *)changelog_rec_rename(crec) +
+                  offsetof(struct changelog_ext_rename, cr_sfid);
+            break;
+        case FF_SPFID:
+            if (!(rec->cr_flags & CLF_RENAME))
+                return false;
+            src = (const char *)changelog_rec_rename(crec) +
+                  offsetof(struct changelog_ext_rename, cr_spfid);
+            break;
+        default:
+            return false;
+    }
+
+    memcpy(fid, src, sizeof(*fid));
+    return true;
+}
+
+static const char *rec_str(const struct changelog_rec *rec,
+                           enum filter_field field, size_t *len)
+{
+    struct changelog_rec    *crec = (struct changelog_rec *)rec;
+    const char              *str;
+
+    if (field == FF_JOBID) {
+        if (!(rec->cr_flags & CLF_JOBID)) {
+            *len = 0;
+            return "";
+        }
+
+        str  = changelog_rec_jobid(crec)->cr_jobid;
+        *len = strnlen(str, LUSTRE_JOBID_SIZE);
+        return str;
+    }
+
+    str  = changelog_rec_name(crec);
+    *len = strnlen(str, rec->cr_namelen);
+    return str;
+}
+
+static bool fid_lookup(const struct lu_fid *set, unsigned int count,
+                       const struct lu_fid *fid)
+{
+    unsigned int    lo = 0;
+    unsigned int    hi = count;
+    unsigned int    mid;
+    int             cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        cmp = fid_cmp(fid, &set[mid]);
+        if (cmp == 0)
+            return true;
+
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return false;
+}
+
+/**
+ * Evaluate a compiled filter against a record.
+ */
+bool rec_filter_match(const struct rec_filter *filter,
+                      const struct changelog_rec *rec)
+{
+    const struct filter_insn    *insn = filter->rf_code;
+    const struct filter_insn    *end  = insn + filter->rf_len;
+    struct lu_fid                fid;
+    const char                  *str;
+    uint64_t                     stack = 0;
+    uint64_t                     top;
+    size_t                       len;
+    bool                         res;
+
+    for (; insn < end; insn++) {
+        switch (insn->fi_op) {
+            case FOP_TYPE:
+                res = rec->cr_type < 64 &&
+                      (insn->fi_mask & (1ULL << rec->cr_type));
+                break;
+
+            case FOP_FID:
+                res = rec_fid(rec, insn->fi_field, &fid) &&
+                      fid_lookup((const struct lu_fid *)(filter->rf_pool +
+                                 insn->fi_offset), insn->fi_count, &fid);
+                break;
+
+            case FOP_STR_EQ:
+            case FOP_STR_PREFIX:
+                str = rec_str(rec, insn->fi_field, &len);
+                res = (len == insn->fi_count ||
+                       (insn->fi_op == FOP_STR_PREFIX && len > insn->fi_count))
+                      && memcmp(str, filter->rf_pool + insn->fi_offset,
+                                insn->fi_count) == 0;
+                break;
+
+            case FOP_NOT:
+                stack ^= 1;
+                continue;
+
+            case FOP_AND:
+                top   = stack & 1;
+                stack = (stack >> 1) & (top | ~1ULL);
+                continue;
+
+            case FOP_OR:
+                top   = stack & 1;
+                stack = (stack >> 1) | top;
+                continue;
+
+            default:
+                return false;
+        }
+
+        stack = (stack << 1) | res;
+    }
+
+    return stack & 1;
+}
@@ -0,0 +1,52 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+
+#include <lustre/lustreapi.h>
+#include <lustre/lustre_user.h>
+
+/**
+ * Record filter expressions, compiled once into a compact postfix program.
+ *
+ *   expr   := term ('or' term)*
+ *   term   := factor ('and' factor)*
+ *   factor := 'not' factor | '(' expr ')' | field op value
+ *           | field 'in' '{' value (',' value)* '}'
+ *
+ * Fields are type, tfid, pfid, sfid, spfid (FIDs, as [seq:oid:ver]), jobid and
+ * name (strings, quoted or not). Types are given by name (CREAT, UNLNK...) or
+ * number. Operators are '=', '!=' and, for strings, '^=' (prefix match).
+ * Sets ('in') apply to types and FIDs.
+ *
+ *   type in {CREAT, UNLNK} and jobid ^= "dd." and pfid = [0x200000007:0x1:0x0]
+ */
+struct rec_filter;
+
+int rec_filter_compile(const char *expr, struct rec_filter **filter);
+bool rec_filter_match(const struct rec_filter *filter,
+                      const struct changelog_rec *rec);
+void rec_filter_free(struct rec_filter *filter);
+
+#endif /* FILTER_H */
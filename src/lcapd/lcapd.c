@@ -219,7 +219,8 @@ static int lcapd_serve(struct lcap_ctx *ctx)
             break;
 
         if (itm[0].revents & ZMQ_POLLIN) {
-            rc = lcap_rpc_recv(ctx->cc_sock, LCAP_RECV_NONBLOCK,
+            rc = lcap_rpc_recv(ctx->cc_sock,
+                               LCAP_RECV_NONBLOCK | LCAP_RECV_FRAMES,
                                lcapd_process_request, ctx);
             lcap_debug("Processed %d incoming RPCs", rc);
         }
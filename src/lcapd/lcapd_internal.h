@@ -49,11 +49,24 @@ struct lcap_cfg {
     char            *ccf_loggername;
 
     bool             ccf_oneshot;
+    bool             ccf_hugepages;
+    bool             ccf_coalesce;
 
     int              ccf_verbosity;
     int              ccf_max_bkt;
     int              ccf_rec_batch_count;
     int              ccf_worker_count;
+    int              ccf_clear_interval;    /* msec */
+    int              ccf_clear_batch;       /* records */
+    int              ccf_ack_timeout;       /* msec */
+    int              ccf_max_credits;       /* buckets held per client */
+    int              ccf_group_expiry;      /* sec, 0 to keep groups forever */
+    int              ccf_coalesce_window;   /* msec, 0 for a whole bucket */
+    size_t           ccf_max_mem;           /* bytes per MDT, 0 for no limit */
+    size_t           ccf_max_total_mem;     /* bytes for all MDTs, 0 for no
+                                               limit */
+    char            *ccf_spill_dir;         /* NULL for no spilling */
+    size_t           ccf_spill_seg_size;    /* bytes */
 };
 
 struct lcap_ctx {
@@ -103,8 +116,21 @@ int peer_rpc_send(void *sock, const struct conn_id *src_id,
                   const struct conn_id *dst_id, const char *msg,
                   size_t msg_len);
 
+int peer_rpc_send_zc(void *sock, const struct conn_id *src_id,
+                     const struct conn_id *dst_id, void *msg, size_t msg_len,
+                     zmq_free_fn *ffn, void *hint);
+
+int peer_rpc_send_zc_hdr(void *sock, const struct conn_id *src_id,
+                         const struct conn_id *dst_id, const void *hdr,
+                         size_t hdr_len, void *msg, size_t skip,
+                         size_t msg_len, zmq_free_fn *ffn, void *hint);
+
+int peer_rpc_forward(void *sock, const struct conn_id *src_id,
+                     const struct conn_id *dst_id,
+                     const struct lcapnet_request *req);
+
 int ack_retcode(void *sock, const struct conn_id *src_cid,
-                const struct conn_id *dst_cid, int ret);
+                const struct conn_id *dst_cid, enum rpc_op_type op, int ret);
 
 
 static inline bool cid_compare(const struct conn_id *cid0,
@@ -26,154 +26,404 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 #include "lcapd_internal.h"
+#include "spsc.h"
+#include "timer_wheel.h"
+#include "filter.h"
+#include "segment.h"
 
 #include <lcap_idl.h>
+#include <lcap_columns.h>
 
 /**
  * LCAPD changelog reader.
  *
- * This thread greedily consumes records and dispatch them into buckets.
- * A bucket is a set of consecutive records and serves as an abstraction
- * for efficient delivery and processing.
- *
- * The reader maintains an _ordered_ linked list of buckets. As long as there
- * are available records from lustre and free slots (to not blow up memory) it
- * will try to expand the list by reading new records.
- *
- * Three pointers are maintained on the list:
- * - current_open: points to the next bucket where to insert a newly read record
- * - deliver_next: points to the next bucket to send to a client asking for one
- * - cleanup_next: points to the next bucket to acknowledge to lustre
- *
- * Once a bucket has been acknowledged, it is considered as ready (for ACK).
+ * Each reader is made of three threads:
+ * - the ingestion thread reads records from the (blocking) LLAPI changelog
+ *   interface into buckets, sets of consecutive records laid out as the
+ *   messages they get sent as;
+ * - the serving thread processes client requests and delivers the buckets to
+ *   consumer groups, each bucket going to one member of every group;
+ * - the clear thread acknowledges records upstream, in the background.
  *
- * If the consumer fails to consume and acknowledge a bucket in time, that
- * bucket and the following ones are considered non-ready again and deliver_next
- * comes back to it, for resend.
- *
- * If the bucket designated by cleanup_next enters the ACK_READY state, it and
- * all the (directly) following ones that are ACK_READY are cleaned upstream
- * (i.e. to lustre) and freed.
- *
- *
- *              deliver_next
- *              |   +--------- current_open
- *              v   v
- *      A - B - C - D - NULL
- *      P   R   P   P               (Ready/Pending)
- *      ^
- *      |
- *      cleanup_next
+ * Sealed buckets go from ingestion to serving through a lock-free SPSC queue
+ * (re_sealed), and come back once cleared through the bucket pool. Serving
+ * keeps them in an ordered ring, by bucket number, until every group has
+ * acknowledged them. Acknowledged records are posted to the clear thread.
+ * Buckets which do not fit into the cache go to the spill log (segment.h)
+ * and are loaded back in order. Threads wake each other up through event
+ * descriptors instead of polling.
+ */
+
+
+/**
+ * Number of milliseconds to wait between two retries at the end of the
+ * changelog records stream, when LLAPI offers no way to be notified of new
+ * records. The delay starts short and backs off exponentially while idle.
+ */
+#define EOF_RETRY_MIN_MSEC  10
+#define EOF_RETRY_MAX_MSEC  1000
+
+/**
+ * Memory pinned by the caches of all the readers of the process, against
+ * Max_Total_Memory.
+ */
+static long ReaderMemory;
+
+/**
+ * Readers whose ingestion waits for the others to give memory back, by reader
+ * index, so that they get woken up when they do.
+ */
+static struct reader_env   *BudgetWaiting[MAX_MDT];
+static int                  BudgetWaiters;
+static pthread_mutex_t      BudgetLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Delivery latency histogram: slot N counts records delivered between 2^(N-1)
+ * and 2^N milliseconds after they were created.
+ */
+#define LAT_HIST_SLOTS      24
+
+/**
+ * Bucket lease timer wheel geometry: 1024 slots of 100ms cover leases of up
+ * to ~100s in a single round, longer ones just take several.
+ */
+#define LEASE_WHEEL_SLOTS   1024
+#define LEASE_TICK_MSEC     100
+
+/**
+ * Initial number of slots in the client table. Must be a power of two.
+ */
+#define CLIENT_TABLE_MIN_SIZE   64
+
+/**
+ * Expected average size of a record, used to size the bucket arenas.
+ * Buckets are sealed early if their records turn out to be larger.
+ */
+#define BUCKET_REC_AVG_SIZE 128
+
+/**
+ * Largest possible record: rename and jobid extensions, plus both names.
  */
+#define LCAP_REC_MAX_SIZE   (sizeof(struct changelog_rec) +         \
+                             sizeof(struct changelog_ext_rename) +  \
+                             sizeof(struct changelog_ext_jobid) +   \
+                             2 * (NAME_MAX + 1))
 
 
 /**
- * Number of seconds to wait between two retries at the end of the
- * changelog records stream.
+ * Number of record types subject to coalescing, see coalesce_slot().
  */
-#define EOF_RETRY_DELAY 1
+#define COALESCE_TYPES      6
 
 /**
- * Delay to acknowledge a bucket before it expires.
+ * Record creation time in milliseconds since the Epoch. Lustre packs seconds
+ * and nanoseconds into cr_time.
  */
-#define ACK_TIMEOUT_MSEC    10000
+static inline uint64_t changelog_rec_msec(const struct changelog_rec *rec)
+{
+    return (rec->cr_time >> 30) * 1000 + (rec->cr_time & ((1 << 30) - 1)) /
+                                         1000000;
+}
+
+
+/**
+ * Slot of the record types for which only the latest record of a FID matters,
+ * -1 for the other ones.
+ */
+static inline int coalesce_slot(unsigned int type)
+{
+    switch (type) {
+        case CL_MTIME:
+            return 0;
+        case CL_CTIME:
+            return 1;
+        case CL_ATIME:
+            return 2;
+        case CL_CLOSE:
+            return 3;
+        case CL_SETATTR:
+            return 4;
+        case CL_XATTR:
+            return 5;
+        default:
+            return -1;
+    }
+}
 
 
 extern int TerminateSig;
 
 
+/**
+ * Bucket arena: records are stored in there as they are read, laid out as an
+ * RPC_OP_ENQUEUE message so that the bucket can be sent as is.
+ * Messages being sent by ZMQ reference it, the bucket can only be reused once
+ * they all have been released.
+ */
+struct bucket_wire {
+    int                      bw_refcount;   /**< Messages in flight */
+    size_t                   bw_capacity;   /**< Room for records, or length
+                                                 of an encoded copy */
+    struct px_rpc_enqueue    bw_rpc;        /**< Variable length, keep last */
+};
+
+/* Encoded copies a bucket may have, by RPC_ENQ_* flags - 1 */
+#define BKT_ENCODINGS   (RPC_ENQ_ZLIB | RPC_ENQ_COLUMNAR)
+
+enum bucket_state {
+    BKT_PENDING = 0,    /**< Never delivered */
+    BKT_LEASED,         /**< Delivered, waiting for acknowledgement */
+    BKT_EXPIRED,        /**< Lease expired, waiting for redelivery */
+    BKT_READY,          /**< Fully consumed / acked */
+};
+
+struct client_state;
+struct consumer_group;
+
+/**
+ * Delivery state of a bucket within a consumer group.
+ */
+struct bucket_lease {
+    enum bucket_state        bl_state;  /**< Delivery state */
+    long                     bl_index;  /**< Bucket number */
+    struct client_state     *bl_owner;  /**< Current lease holder */
+    struct consumer_group   *bl_group;  /**< Group the lease belongs to */
+    struct tw_timer          bl_timer;  /**< Lease expiry timer */
+    struct list_node         bl_node;   /**< Entry in the redelivery list */
+};
+
+/**
+ * Set of clients sharing the stream of records, each bucket being delivered to
+ * a single one of them. Buckets are acknowledged for the group as a whole, so
+ * its members all select the same records: a record filtered out for one of
+ * them is filtered out for all.
+ */
+struct consumer_group {
+    struct list_node         cg_node;   /**< Chain node in env::re_groups */
+    char                     cg_name[RPC_GROUP_NAME_LEN]; /**< "" if default */
+    bool                     cg_private; /**< Owned by a broadcast client */
+    uint64_t                 cg_type_mask; /**< Record types of interest */
+    uint32_t                 cg_flags_mask; /**< cr_flags of interest */
+    char                    *cg_filter; /**< Filter expression, NULL if none */
+    unsigned int             cg_members; /**< Registered clients */
+    uint64_t                 cg_expiry; /**< When to forget about the group
+                                             (msec, monotonic), 0 while it
+                                             has members */
+    long long                cg_start;  /**< First record to deliver, the
+                                             ones before count as acked */
+    uint64_t                 cg_start_time; /**< Time (msec) of the first
+                                                 record, until resolved into
+                                                 cg_start, 0 if none */
+    long                     cg_deliver_next; /**< Next bucket to be sent */
+    long                     cg_cleanup_next; /**< Next bucket to be acked */
+    struct list              cg_redeliver; /**< Leases to be sent again */
+    struct bucket_lease     *cg_leases; /**< By bucket number, as the ring */
+};
+
 struct lcap_rec_bucket {
     long                     lrb_index;
-    struct timespec          lrb_expiry;    /**< Expiry time */
-    bool                     lrb_ready;     /**< Fully consumed / acked */
-    struct list_node         lrb_node;      /**< Entry in env::re_buckets */
+    bool                     lrb_delivered; /**< Sent at least once */
+    uint8_t                  lrb_enc_failed; /**< Encodings which did not
+                                                  help, by 1 << RPC_ENQ_* */
+    struct bucket_wire      *lrb_enc[BKT_ENCODINGS]; /**< Encoded copies */
+    size_t                   lrb_enc_bytes; /**< Their size, along with
+                                                 their header */
+    struct list_node         lrb_node;      /**< Entry in the pool lists when
+                                                 recycled */
     size_t                   lrb_size;      /**< Aggregated record size */
+    long long                lrb_max_index; /**< Highest record index */
+    uint64_t                 lrb_min_time;  /**< Oldest record time (msec) */
+    uint64_t                 lrb_max_time;  /**< Latest record time (msec),
+                                                 previous buckets included */
     int                      lrb_rec_count; /**< Number of records */
-    struct changelog_rec    *lrb_records[]; /**< Pointers to the records */
+    struct bucket_wire       lrb_wire;      /**< Records, keep last */
+};
+
+/**
+ * Latest coalescable records of a FID within the open bucket.
+ */
+struct coalesce_entry {
+    struct lu_fid            ce_fid;
+    unsigned long            ce_gen;    /**< Entry in use if rc_gen */
+    int                      ce_ord[COALESCE_TYPES]; /**< Record ordinal in
+                                                          bucket, -1 if none */
+    uint32_t                 ce_off[COALESCE_TYPES]; /**< Record offset */
+};
+
+/**
+ * Coalescing state of the open bucket, ingestion thread only.
+ */
+struct rec_coalescer {
+    struct coalesce_entry   *rc_table;  /**< Open addressing, by FID */
+    size_t                   rc_mask;   /**< Table size - 1 */
+    unsigned long            rc_gen;    /**< Bumped to forget all entries */
+    bool                    *rc_dead;   /**< Superseded records, by ordinal */
+    int                      rc_ndead;  /**< Number of superseded records */
 };
 
+/**
+ * Each counter is only updated by one of the reader threads.
+ */
 struct reader_stats {
     struct timeval  rs_start_time;  /**< Start time */
     long            rs_rec_read;    /**< Number of read records */
+    long            rs_rec_coalesced; /**< Records superseded by later ones */
     long            rs_rec_sent;    /**< Number of sent records */
+    long            rs_rec_filtered;/**< Records filtered out on delivery */
+    long            rs_bytes_sent;  /**< Record bytes sent */
+    long            rs_zbytes_in;   /**< Record bytes compressed */
+    long            rs_zbytes_out;  /**< Compressed output bytes */
+    long            rs_zusec;       /**< Time spent compressing */
+    long            rs_col_bytes_in;  /**< Record bytes encoded by columns */
+    long            rs_col_bytes_out; /**< Encoded output bytes */
+    long            rs_rec_redelivered; /**< Records sent again on expiry */
+    long            rs_lat_hist[LAT_HIST_SLOTS]; /**< Delivery latency */
+    long            rs_lat_max;     /**< Highest delivery latency (msec) */
+    long            rs_bytes_copied;/**< Record bytes copied */
+    long            rs_pool_hits;   /**< Buckets taken from the pool */
+    long            rs_pool_waits;  /**< Reads delayed for want of one */
+    long            rs_mem_peak;    /**< Most memory cached at once */
+    long            rs_bkt_spilled; /**< Buckets only stored on disk */
+    long            rs_spill_bytes; /**< Record bytes spilled */
+    long            rs_bkt_reloaded;/**< Spilled buckets loaded back */
+    long            rs_spill_syncs; /**< Spilled records flushes */
+    long            rs_recovery_msec; /**< Time to open the segment log */
+    long            rs_rec_cleared; /**< Number of records cleared upstream */
+    long            rs_clear_ops;   /**< Number of upstream clear calls */
+};
+
+/**
+ * Preallocated buckets, recycled once cleared upstream so that steady-state
+ * reading does not hit the allocator. They are the only buckets there are:
+ * reading waits for one to be recycled when they are all in use.
+ */
+struct bucket_pool {
+    void                    *bp_slab;   /**< Backing memory for all buckets */
+    size_t                   bp_length; /**< Mapped length of bp_slab */
+    size_t                   bp_count;  /**< Number of buckets */
+    size_t                   bp_bktsz;  /**< Size of a single bucket */
+    size_t                   bp_arena;  /**< Record bytes per bucket */
+    struct spsc_queue        bp_free;   /**< Available buckets, from the
+                                             serving to the ingestion thread */
+    struct list              bp_busy;   /**< Recycled buckets still being sent,
+                                             serving thread only */
+    int                      bp_nbusy;  /**< Its length, for ZMQ threads to
+                                             tell when to wake it up */
+};
+
+/**
+ * Bucket held by a client, along with the last record it was actually sent.
+ */
+struct bucket_hold {
+    long                     bh_index;  /**< Bucket number */
+    long long                bh_last;   /**< Last record sent to the client */
 };
 
 struct client_state {
-    long long                cs_start;  /**< Client start record number */
-    struct list_node         cs_node;   /**< List node in env::re_peers */
-    struct lcap_rec_bucket  *cs_bucket; /**< Currently processed bucket */
+    unsigned int             cs_ack_timeout; /**< Lease duration (msec) */
+    uint32_t                 cs_flags_mask; /**< cr_flags of interest */
+    uint64_t                 cs_type_mask; /**< Record types of interest */
+    struct rec_filter       *cs_filter; /**< Compiled filter expression */
+    uint64_t                 cs_hash;   /**< Hash of cs_ident */
+    struct consumer_group   *cs_group;  /**< Group the client belongs to */
+    struct list_node         cs_node;   /**< Chain node in env::re_clients */
+    uint32_t                 cs_version; /**< Protocol version spoken */
+    bool                     cs_stream; /**< Records are pushed to it */
+    uint32_t                 cs_encoding; /**< RPC_ENQ_* flags it accepts */
+    struct list_node         cs_stream_node; /**< In env::re_streams */
+    unsigned int             cs_credits; /**< Max buckets held at a time */
+    unsigned int             cs_nheld;  /**< Number of buckets held */
+    struct bucket_hold      *cs_held;   /**< Buckets held */
     struct conn_id          *cs_ident;  /**< Variable length, keep last */
 };
 
+/**
+ * Registered clients, hashed by connection identity.
+ */
+struct client_table {
+    struct list             *ct_slots;  /**< Hash chains of client states */
+    size_t                   ct_size;   /**< Number of slots (power of two) */
+    size_t                   ct_count;  /**< Number of registered clients */
+};
+
 struct reader_env {
     const struct lcap_cfg   *re_cfg;     /**< Global configuration (shared) */
+    int                      re_index;   /**< Reader index (one per MDT) */
+    struct reader_stats      re_stats;   /**< Reader statistics/metrics */
+
+    /* -- Ingestion thread -- */
+    pthread_t                re_ingest;  /**< Ingestion thread */
     void                    *re_clpriv;  /**< LLAPI private changelog info */
+    long long                re_srec;    /**< Next start index */
+    uint64_t                 re_time_hwm; /**< Latest record time (msec) */
+    long                     re_bkt_idx; /**< Global bucket index counter */
+    struct lcap_rec_bucket  *re_open;    /**< Open bucket for insert */
+    struct lcap_rec_bucket  *re_spare;   /**< Spilled bucket, reused first */
+    struct rec_coalescer     re_coalesce; /**< Redundant records tracking */
+    struct segment_log       re_spill;   /**< Buckets overflowing the cache */
+    int                      re_tail_fd; /**< Changelog to poll for new
+                                              records, -1 if not tailing */
+
+    /* -- Shared, accessed atomically -- */
+    struct spsc_queue        re_sealed;  /**< Sealed buckets, to be served */
+    struct bucket_pool       re_pool;    /**< Preallocated buckets */
+    long                     re_rec_cnt; /**< Count of handed over records */
+    long                     re_mem;     /**< Memory pinned by handed over
+                                              buckets and encoded copies */
+    long long                re_acked_index; /**< Last acknowledged record */
+    int                      re_worker_rc; /**< Helper threads failure */
+    bool                     re_stop;    /**< Helper threads termination */
+    int                      re_ingest_fd; /**< Wakes up ingestion (eventfd) */
+    int                      re_serve_fd;  /**< Wakes up serving (eventfd) */
+
+    /* -- Clear thread, protected by re_clear_lock -- */
+    pthread_t                re_clear;   /**< Upstream clear thread */
+    pthread_mutex_t          re_clear_lock;
+    pthread_cond_t           re_clear_cond;
+    long long                re_clear_target;  /**< Highest clearable record */
+    long                     re_clear_pending; /**< Records not cleared yet */
+    struct timespec          re_clear_since;   /**< Oldest pending clear */
+
+    /* -- Serving thread -- */
     void                    *re_zctx;    /**< Local ZMQ context */
     void                    *re_sock;    /**< Records publication socket */
     struct conn_id          *re_ident;   /**< This reader connection identity */
-    struct reader_stats      re_stats;   /**< Reader statistics/metrics */
-    int                      re_index;   /**< Reader index (one per MDT) */
-    long long                re_srec;    /**< Next start index */
-    long                     re_bkt_idx; /**< Global bucket index counter */
-    long                     re_rec_cnt; /**< Total count of records */
-    struct lcap_rec_bucket  *re_current_open; /**< Open bucket for insert */
-    struct lcap_rec_bucket  *re_deliver_next; /**< Next bucket to be sent */
-    struct lcap_rec_bucket  *re_cleanup_next; /**< Next bucket to be cleared */
-    struct list              re_buckets; /**< Linked list of buckets */
-    struct list              re_peers;   /**< Linked list of client states */
+    long                     re_ring_head;    /**< Next bucket to be served */
+    long                     re_cleanup_next; /**< Next bucket to be cleared */
+    struct lcap_rec_bucket **re_ring;    /**< Live buckets, by bucket number */
+    long                     re_ring_mask; /**< Ring capacity - 1 */
+    struct client_table      re_clients; /**< Registered client states */
+    struct timer_wheel       re_leases;  /**< Leased buckets expiry */
+    struct list              re_groups;  /**< Consumer groups */
+    struct list              re_streams; /**< Streaming clients */
 };
 
 
-/**
- * Allocate and insert a new, empty, bucket to \a env.
- */
-static int rec_bucket_add(struct reader_env *env)
+static inline void reader_wakeup(int fd)
 {
-    struct lcap_rec_bucket  *bkt;
-    int                      slot_cnt = env->re_cfg->ccf_rec_batch_count;
-    size_t                   bkt_sz = sizeof(*bkt) +
-                                      slot_cnt * sizeof(struct changelog_rec *);
-
-    bkt = (struct lcap_rec_bucket *)calloc(1, bkt_sz);
-    if (bkt == NULL)
-        return -ENOMEM;
-
-    bkt->lrb_index = env->re_bkt_idx++;
-    list_append(&env->re_buckets, &bkt->lrb_node);
-
-    env->re_current_open = bkt;
-
-    lcap_debug("Opened bucket #%ld for insert at %p", bkt->lrb_index, bkt);
-    return 0;
+    eventfd_write(fd, 1);
 }
 
 /**
- * Copy and return a connection ID.
- * Return NULL if memory could not be allocated.
+ * Wait for \a fd to be signalled, for at most \a timeout msec (-1 for ever).
  */
-static struct conn_id *conn_id_dup(const struct conn_id *cid)
-{
-    struct conn_id *dup;
-
-    dup = malloc(sizeof(*dup) + cid->ci_length);
-    if (dup != NULL) {
-        dup->ci_length = cid->ci_length;
-        memcpy(dup->ci_data, cid->ci_data, cid->ci_length);
-    }
-
-    return dup;
-}
-
-/**
- * Indicate whether the reader as described by \a env is full or still has
- * available slots to store records. */
-static inline bool changelog_reader_full(const struct reader_env *env)
+static void reader_wait(int fd, int timeout)
 {
-    const struct lcap_cfg   *cfg = env->re_cfg;
+    struct pollfd   pfd = {.fd = fd, .events = POLLIN};
+    eventfd_t       val;
 
-    return env->re_rec_cnt >= cfg->ccf_rec_batch_count * cfg->ccf_max_bkt;
+    if (poll(&pfd, 1, timeout) > 0)
+        eventfd_read(fd, &val);
 }
 
 /**
@@ -185,432 +435,2742 @@ static inline const char *reader_device(const struct reader_env *env)
     return env->re_cfg->ccf_mdt[env->re_index];
 }
 
-/**
- * Readers are named after the MDT device they are attached to. Fill and store
- * a connection_id structure accordingly. This is used for identify ourselves
- * to the broker.
- */
-static int build_reader_identity(struct reader_env *env)
+static inline size_t rec_bucket_arena_size(const struct lcap_cfg *cfg)
 {
-    const char  *dev = reader_device(env);
-    size_t       dev_len = strlen(dev);
-
-    env->re_ident = malloc(sizeof(*env->re_ident) + dev_len);
-    if (env->re_ident == NULL)
-        return -ENOMEM;
+    size_t  arena = cfg->ccf_rec_batch_count * BUCKET_REC_AVG_SIZE;
 
-    memcpy(env->re_ident->ci_data, dev, dev_len);
-    env->re_ident->ci_length = dev_len;
-    return 0;
+    return arena < LCAP_REC_MAX_SIZE ? LCAP_REC_MAX_SIZE : arena;
 }
 
+#ifdef MAP_HUGETLB
 /**
- * Associate an identity to the reader described by \a env.
- * An identity is a unique identifier used to route messages to the
- * other components appropriately.
+ * Default huge page size, as reported by the kernel. Return 0 if unknown.
  */
-static int changelog_reader_set_identity(struct reader_env *env)
+static size_t hugepage_size(void)
 {
-    int rc;
+    char            line[128];
+    unsigned long   kib = 0;
+    FILE           *fp;
 
-    rc = build_reader_identity(env);
-    if (rc < 0)
-        return rc;
+    fp = fopen("/proc/meminfo", "r");
+    if (fp == NULL)
+        return 0;
 
-    rc = zmq_setsockopt(env->re_sock, ZMQ_IDENTITY, env->re_ident->ci_data,
-                        env->re_ident->ci_length);
-    if (rc < 0)
-        return -errno;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "Hugepagesize: %lu kB", &kib) == 1)
+            break;
+    }
 
-    return 0;
+    fclose(fp);
+    return kib * 1024;
 }
+#endif
 
 /**
- * Try to initialize a changelog reader thread.
- * A reader is given an index by the main lcapd process, which indicates
- * which MDT to follow from the ones specified in the configuration.
+ * Preallocate enough buckets to fill the cache (plus the open one) as a
+ * single slab, optionally backed by huge pages. The memory budgets, if any,
+ * bound it as well, since the open bucket and the spilled one are not
+ * accounted.
  */
-static int changelog_reader_init(const struct lcap_cfg *cfg, unsigned int idx,
-                                 struct reader_env *env)
+static int bucket_pool_init(struct bucket_pool *pool,
+                            const struct lcap_cfg *cfg)
 {
-    int rc;
-
-    memset(env, 0, sizeof(*env));
-    env->re_cfg   = cfg;
-    env->re_index = idx;
-    gettimeofday(&env->re_stats.rs_start_time, NULL);
+    size_t   count = cfg->ccf_max_bkt + 1;
+    int      flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    size_t   i;
+    int      rc;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->bp_arena  = rec_bucket_arena_size(cfg);
+    pool->bp_bktsz  = sizeof(struct lcap_rec_bucket) + pool->bp_arena;
+    /* keep consecutive buckets aligned */
+    pool->bp_bktsz  = (pool->bp_bktsz + 63) & ~(size_t)63;
+
+    if (cfg->ccf_max_mem > 0 && cfg->ccf_max_mem / pool->bp_bktsz + 2 < count)
+        count = cfg->ccf_max_mem / pool->bp_bktsz + 2;
+    if (cfg->ccf_max_total_mem > 0 &&
+        cfg->ccf_max_total_mem / pool->bp_bktsz + 2 < count)
+        count = cfg->ccf_max_total_mem / pool->bp_bktsz + 2;
+    pool->bp_count  = count;
+    pool->bp_length = count * pool->bp_bktsz;
+    pool->bp_slab   = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (cfg->ccf_hugepages) {
+        size_t  hpsz = hugepage_size();
+        size_t  length;
+
+        /* Huge page mappings are made and unmapped by whole pages */
+        if (hpsz > 0) {
+            length = (pool->bp_length + hpsz - 1) / hpsz * hpsz;
+            pool->bp_slab = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                                 flags | MAP_HUGETLB, -1, 0);
+            if (pool->bp_slab != MAP_FAILED)
+                pool->bp_length = length;
+        }
 
-    /* Create a first bucket... */
-    rc = rec_bucket_add(env);
-    if (rc)
-        return rc;
+        if (pool->bp_slab == MAP_FAILED)
+            lcap_info("Cannot map bucket pool on huge pages (%s), "
+                      "falling back to regular pages",
+                      hpsz > 0 ? strerror(errno) : "unknown page size");
+    }
+#endif
 
-    env->re_current_open = 
-    env->re_deliver_next =
-    env->re_cleanup_next = list_entry(env->re_buckets.l_first,
-                                      struct lcap_rec_bucket,
-                                      lrb_node);
+    if (pool->bp_slab == MAP_FAILED)
+        pool->bp_slab = mmap(NULL, pool->bp_length, PROT_READ | PROT_WRITE,
+                             flags, -1, 0);
 
-    env->re_zctx = zmq_ctx_new();
-    if (env->re_zctx == NULL) {
-        rc = -errno;
-        lcap_error("Cannot initialize ZMQ context: %s", zmq_strerror(-rc));
-        return rc;
+    if (pool->bp_slab == MAP_FAILED) {
+        pool->bp_slab = NULL;
+        return -errno;
     }
 
-    env->re_sock = zmq_socket(env->re_zctx, ZMQ_DEALER);
-    if (env->re_sock == NULL) {
-        rc = -errno;
-        lcap_error("Cannot open changelog publication socket: %s",
-                   zmq_strerror(-rc));
+    rc = spsc_init(&pool->bp_free, count);
+    if (rc) {
+        munmap(pool->bp_slab, pool->bp_length);
+        pool->bp_slab = NULL;
         return rc;
     }
 
-    rc = changelog_reader_set_identity(env);
-    if (rc < 0) {
-        lcap_error("Cannot set identity to '%s': %s",
-                   (char *)env->re_ident->ci_data, zmq_strerror(-rc));
-        return rc;
-    }
+    for (i = 0; i < count; i++) {
+        struct lcap_rec_bucket *bkt;
 
-    rc = zmq_connect(env->re_sock, BROKER_CONN_URL);
-    if (rc < 0) {
-        rc = -errno;
-        lcap_error("Cannot connect to %s: %s", BROKER_CONN_URL,
-                   zmq_strerror(-rc));
-        return rc;
+        bkt = (struct lcap_rec_bucket *)((char *)pool->bp_slab +
+                                         i * pool->bp_bktsz);
+        spsc_push(&pool->bp_free, bkt);
     }
 
-    lcap_verb("Ready to distribute records to %s", BROKER_CONN_URL);
+    lcap_debug("Preallocated %zu buckets (%zu bytes)", count, pool->bp_length);
     return 0;
 }
 
+static void rec_bucket_enc_free(struct lcap_rec_bucket *bkt)
+{
+    int i;
+
+    for (i = 0; i < BKT_ENCODINGS; i++) {
+        free(bkt->lrb_enc[i]);
+        bkt->lrb_enc[i] = NULL;
+    }
+}
+
 /**
- * Poke the broker, and give him information about the health of the current
- * reader as described by \env.
+ * Hand a bucket nobody references anymore back to the ingestion thread, along
+ * with its encoded copies.
  */
-static int changelog_reader_signal(struct reader_env *env, int errcode)
+static void bucket_pool_release(struct bucket_pool *pool,
+                                struct lcap_rec_bucket *bkt)
 {
-    struct px_rpc_signal    rpc;
-    int                     rc;
-
-    memset(&rpc, 0, sizeof(rpc));
-    rpc.pr_hdr.op_type = RPC_OP_SIGNAL;
-    rpc.pr_ret         = (uint64_t)errcode;
+    rec_bucket_enc_free(bkt);
+    spsc_push(&pool->bp_free, bkt); /* sized for all buckets */
+}
 
-    strcpy((char *)rpc.pr_mdtname, reader_device(env));
+static void bucket_pool_fini(struct bucket_pool *pool)
+{
+    struct list_node        *lnode;
+    struct lcap_rec_bucket  *bkt;
 
-    rc = zmq_send(env->re_sock, "", 0, ZMQ_SNDMORE);
-    if (rc < 0) {
-        rc = -errno;
-        lcap_error("Cannot send signal RPC: %s", zmq_strerror(-rc));
-        return rc;
+    /* ZMQ is gone by now, nothing references the buckets anymore */
+    while ((lnode = list_pop_head(&pool->bp_busy)) != NULL) {
+        bkt = list_entry(lnode, struct lcap_rec_bucket, lrb_node);
+        rec_bucket_enc_free(bkt);
     }
 
-    rc = zmq_send(env->re_sock, (void *)rpc.pr_mdtname,
-                  strlen((char *)rpc.pr_mdtname), ZMQ_SNDMORE);
-    if (rc < 0) {
-        rc = -errno;
-        lcap_error("Cannot send signal RPC: %s", zmq_strerror(-rc));
-        return rc;
-    }
+    spsc_fini(&pool->bp_free);
 
-    rc = zmq_send(env->re_sock, (void *)&rpc, sizeof(rpc), 0);
-    if (rc < 0) {
-        rc = -errno;
-        lcap_error("Cannot send signal RPC: %s", zmq_strerror(-rc));
-        return rc;
+    if (pool->bp_slab != NULL)
+        munmap(pool->bp_slab, pool->bp_length);
+
+    memset(pool, 0, sizeof(*pool));
+}
+
+static inline bool rec_bucket_busy(struct lcap_rec_bucket *bkt)
+{
+    int i;
+
+    if (__atomic_load_n(&bkt->lrb_wire.bw_refcount, __ATOMIC_SEQ_CST) > 0)
+        return true;
+
+    for (i = 0; i < BKT_ENCODINGS; i++) {
+        if (bkt->lrb_enc[i] != NULL &&
+            __atomic_load_n(&bkt->lrb_enc[i]->bw_refcount,
+                            __ATOMIC_SEQ_CST) > 0)
+            return true;
     }
 
-    return 0;
+    return false;
 }
 
 /**
- * Display information gathered during operation times.
+ * Give back recycled buckets which ZMQ is done sending to the ingestion
+ * thread. Return whether there were any. Serving thread only.
  */
-static int changelog_reader_print_stats(struct reader_env *env)
+static bool bucket_pool_reclaim(struct bucket_pool *pool)
 {
-    struct reader_stats *rstats = &env->re_stats;
-    const char          *device = reader_device(env);
-    struct timeval       end;
-    int                  duration;
-    double               processing_rate;
+    struct list_node        *lnode = pool->bp_busy.l_first;
+    struct list_node        *next;
+    struct lcap_rec_bucket  *bkt;
+    bool                     reclaimed = false;
 
-    gettimeofday(&end, NULL);
+    for (; lnode != NULL; lnode = next) {
+        next = lnode->ln_next;
+        bkt  = list_entry(lnode, struct lcap_rec_bucket, lrb_node);
 
-    duration = end.tv_sec - rstats->rs_start_time.tv_sec;
-    duration *= 1000;
-    duration += (end.tv_usec / 1000) - (rstats->rs_start_time.tv_usec / 1000);
+        if (rec_bucket_busy(bkt))
+            continue;
 
-    if (duration == 0)
-        processing_rate = 0.0;
-    else
-        processing_rate = (double)rstats->rs_rec_read / duration;
+        list_remove(&pool->bp_busy, lnode);
+        __atomic_sub_fetch(&pool->bp_nbusy, 1, __ATOMIC_RELAXED);
+        bucket_pool_release(pool, bkt);
+        reclaimed = true;
+    }
 
-    lcap_info("%ld records processed from %s (%d/s)", rstats->rs_rec_read,
-              device, (int)(processing_rate * 1000));
-    return 0;
+    return reclaimed;
+}
+
+static void rec_bucket_reset(struct bucket_pool *pool,
+                             struct lcap_rec_bucket *bkt)
+{
+    memset(bkt, 0, sizeof(*bkt));
+    bkt->lrb_wire.bw_capacity = pool->bp_arena;
+    rpc_hdr_init(&bkt->lrb_wire.bw_rpc.pr_hdr, RPC_OP_ENQUEUE);
+}
+
+/**
+ * Get an empty bucket from the pool, NULL if they are all in use: buckets
+ * sealed at the end of the stream are partially filled, hence the cache can
+ * run out of buckets before reaching its budget. Ingestion thread only.
+ */
+static struct lcap_rec_bucket *bucket_pool_get(struct reader_env *env)
+{
+    struct bucket_pool      *pool = &env->re_pool;
+    struct lcap_rec_bucket  *bkt;
+
+    bkt = spsc_pop(&pool->bp_free);
+    if (bkt == NULL) {
+        env->re_stats.rs_pool_waits++;
+        return NULL;
+    }
+
+    env->re_stats.rs_pool_hits++;
+    rec_bucket_reset(pool, bkt);
+    return bkt;
+}
+
+/**
+ * Recycle a bucket. Serving thread only, but for termination.
+ *
+ * Buckets ZMQ is still sending are put aside until it releases them. Counting
+ * them first lets bucket_wire_put() know that it has to wake the serving thread
+ * up, whichever of the two sees the other one last.
+ */
+static void bucket_pool_put(struct reader_env *env, struct lcap_rec_bucket *bkt)
+{
+    struct bucket_pool  *pool = &env->re_pool;
+
+    __atomic_add_fetch(&pool->bp_nbusy, 1, __ATOMIC_SEQ_CST);
+
+    if (rec_bucket_busy(bkt)) {
+        list_append(&pool->bp_busy, &bkt->lrb_node);
+    } else {
+        __atomic_sub_fetch(&pool->bp_nbusy, 1, __ATOMIC_RELAXED);
+        bucket_pool_release(pool, bkt);
+    }
+}
+
+/**
+ * Allocate the bucket ring. Its capacity is a power of two large enough to
+ * hold every bucket of the pool.
+ *
+ * Live buckets are the ones numbered from re_cleanup_next (included) to
+ * re_ring_head (excluded), bucket N being stored at slot N & re_ring_mask.
+ * Consumer groups track the delivery state of bucket N in the same slot of
+ * their own lease array.
+ */
+static int rec_ring_init(struct reader_env *env)
+{
+    long    capacity = 1;
+
+    while (capacity < env->re_pool.bp_count)
+        capacity <<= 1;
+
+    env->re_ring = calloc(capacity, sizeof(*env->re_ring));
+    if (env->re_ring == NULL)
+        return -ENOMEM;
+
+    env->re_ring_mask = capacity - 1;
+    return 0;
+}
+
+static inline bool rec_ring_full(const struct reader_env *env)
+{
+    return env->re_ring_head - env->re_cleanup_next > env->re_ring_mask;
+}
+
+/**
+ * Get the live bucket numbered \a idx, or NULL if there is none (either it
+ * has not been served yet or it has been cleared already).
+ */
+static inline struct lcap_rec_bucket *rec_bucket_lookup(
+                                            const struct reader_env *env,
+                                            long idx)
+{
+    if (idx < env->re_cleanup_next || idx >= env->re_ring_head)
+        return NULL;
+
+    return env->re_ring[idx & env->re_ring_mask];
+}
+
+/**
+ * Find the first live bucket, from bucket number \a from on, holding records
+ * from \a index on. Buckets hold increasing ranges of records, hence a binary
+ * search over the ring. Return env::re_ring_head if there is none.
+ */
+static long rec_ring_seek(const struct reader_env *env, long from,
+                          long long index)
+{
+    long    lo = from < env->re_cleanup_next ? env->re_cleanup_next : from;
+    long    hi = env->re_ring_head;
+    long    mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (rec_bucket_lookup(env, mid)->lrb_max_index < index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * Find the first live bucket whose time watermark reaches \a msec, by binary
+ * search over the ring. Return env::re_ring_head if there is none.
+ */
+static long rec_ring_seek_time(const struct reader_env *env, uint64_t msec)
+{
+    long    lo = env->re_cleanup_next;
+    long    hi = env->re_ring_head;
+    long    mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (rec_bucket_lookup(env, mid)->lrb_max_time < msec)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * Get the delivery state of the bucket numbered \a idx within \a grp. Only
+ * meaningful for live buckets.
+ */
+static inline struct bucket_lease *rec_lease_lookup(
+                                            const struct reader_env *env,
+                                            struct consumer_group *grp,
+                                            long idx)
+{
+    return &grp->cg_leases[idx & env->re_ring_mask];
+}
+
+/**
+ * Move the buckets sealed by the ingestion thread to the ring, as long as
+ * there is room for them. Serving thread only.
+ */
+static void changelog_reader_collect(struct reader_env *env)
+{
+    struct lcap_rec_bucket  *bkt;
+    struct list_node        *lnode;
+    struct bucket_lease     *lease;
+    long                     head = env->re_ring_head;
+
+    while (!rec_ring_full(env)) {
+        bkt = spsc_pop(&env->re_sealed);
+        if (bkt == NULL)
+            break;
+
+        assert(bkt->lrb_index == env->re_ring_head);
+        env->re_ring[bkt->lrb_index & env->re_ring_mask] = bkt;
+        env->re_ring_head++;
+
+        /* The slots were left ready by the buckets previously stored there */
+        for (lnode = env->re_groups.l_first; lnode; lnode = lnode->ln_next) {
+            lease = rec_lease_lookup(env, list_entry(lnode,
+                                     struct consumer_group, cg_node),
+                                     bkt->lrb_index);
+            lease->bl_state = BKT_PENDING;
+            lease->bl_owner = NULL;
+        }
+    }
+
+    /* Room was made in the queue, in case ingestion is waiting for it */
+    if (env->re_ring_head != head)
+        reader_wakeup(env->re_ingest_fd);
+}
+
+/**
+ * Size the coalescing table so that it never fills up, a bucket holding at
+ * most Batch_Records distinct FIDs.
+ */
+static int rec_coalescer_init(struct rec_coalescer *rc,
+                              const struct lcap_cfg *cfg)
+{
+    size_t  size = 1;
+
+    while (size < 2 * cfg->ccf_rec_batch_count)
+        size <<= 1;
+
+    rc->rc_table = calloc(size, sizeof(*rc->rc_table));
+    rc->rc_dead  = calloc(cfg->ccf_rec_batch_count, sizeof(*rc->rc_dead));
+    if (rc->rc_table == NULL || rc->rc_dead == NULL)
+        return -ENOMEM;
+
+    rc->rc_mask = size - 1;
+    rc->rc_gen  = 1;
+    return 0;
+}
+
+static void rec_coalescer_fini(struct rec_coalescer *rc)
+{
+    free(rc->rc_table);
+    free(rc->rc_dead);
+    memset(rc, 0, sizeof(*rc));
+}
+
+static inline bool lu_fid_eq(const struct lu_fid *f0, const struct lu_fid *f1)
+{
+    return f0->f_seq == f1->f_seq && f0->f_oid == f1->f_oid &&
+           f0->f_ver == f1->f_ver;
+}
+
+/**
+ * Find the entry of \a fid, or a free one to track it if \a create is set.
+ * Return NULL if there is none.
+ */
+static struct coalesce_entry *rec_coalescer_lookup(struct rec_coalescer *rc,
+                                                   const struct lu_fid *fid,
+                                                   bool create)
+{
+    struct coalesce_entry   *ce;
+    uint64_t                 hash;
+    int                      i;
+
+    hash  = fid->f_seq * 0x9e3779b97f4a7c15ULL;
+    hash ^= (fid->f_oid ^ ((uint64_t)fid->f_ver << 32)) * 0xc2b2ae3d27d4eb4fULL;
+    hash ^= hash >> 29;
+
+    for (;; hash++) {
+        ce = &rc->rc_table[hash & rc->rc_mask];
+        if (ce->ce_gen != rc->rc_gen)
+            break;
+
+        if (lu_fid_eq(&ce->ce_fid, fid))
+            return ce;
+    }
+
+    if (!create)
+        return NULL;
+
+    ce->ce_fid = *fid;
+    ce->ce_gen = rc->rc_gen;
+    for (i = 0; i < COALESCE_TYPES; i++)
+        ce->ce_ord[i] = -1;
+
+    return ce;
+}
+
+/**
+ * Track a record just stored into the open bucket at ordinal \a ord, and mark
+ * the previous record of the same type for the same FID as superseded.
+ * Ingestion thread only.
+ */
+static void rec_coalesce(struct reader_env *env,
+                         const struct lcap_rec_bucket *bkt,
+                         const struct changelog_rec *rec, int ord, size_t off)
+{
+    struct rec_coalescer        *rc = &env->re_coalesce;
+    unsigned int                 window = env->re_cfg->ccf_coalesce_window;
+    int                          slot = coalesce_slot(rec->cr_type);
+    const struct changelog_rec  *prev;
+    struct coalesce_entry       *ce;
+    struct lu_fid                fid = rec->cr_tfid;
+    int                          i;
+
+    ce = rec_coalescer_lookup(rc, &fid, slot >= 0);
+    if (ce == NULL)
+        return;
+
+    /* Other events act as barriers, e.g. a rename in between two SATTR */
+    if (slot < 0) {
+        for (i = 0; i < COALESCE_TYPES; i++)
+            ce->ce_ord[i] = -1;
+        return;
+    }
+
+    if (ce->ce_ord[slot] >= 0) {
+        prev = (const struct changelog_rec *)
+                        (bkt->lrb_wire.bw_rpc.pr_records + ce->ce_off[slot]);
+
+        if (window == 0 ||
+            changelog_rec_msec(rec) - changelog_rec_msec(prev) <= window) {
+            rc->rc_dead[ce->ce_ord[slot]] = true;
+            rc->rc_ndead++;
+            env->re_stats.rs_rec_coalesced++;
+        }
+    }
+
+    ce->ce_ord[slot] = ord;
+    ce->ce_off[slot] = off;
+}
+
+/**
+ * Squeeze the superseded records out of the open bucket, before sealing it.
+ * The last record always remains, so that acknowledging it clears the whole
+ * bucket. Ingestion thread only.
+ */
+static void rec_bucket_compact(struct reader_env *env,
+                               struct lcap_rec_bucket *bkt)
+{
+    struct rec_coalescer    *rc = &env->re_coalesce;
+    struct px_rpc_enqueue   *rpc = &bkt->lrb_wire.bw_rpc;
+    struct changelog_rec    *rec;
+    size_t                   rec_len;
+    size_t                   src = 0;
+    size_t                   dst = 0;
+    int                      count = 0;
+    int                      ord;
+
+    if (rc->rc_ndead == 0)
+        return;
+
+    for (ord = 0; ord < bkt->lrb_rec_count; ord++, src += rec_len) {
+        rec = (struct changelog_rec *)(rpc->pr_records + src);
+        rec_len = changelog_rec_size(rec) + rec->cr_namelen;
+
+        if (rc->rc_dead[ord]) {
+            rc->rc_dead[ord] = false;
+            continue;
+        }
+
+        if (dst != src)
+            memmove(rpc->pr_records + dst, rec, rec_len);
+
+        rec = (struct changelog_rec *)(rpc->pr_records + dst);
+        if (count == 0 || changelog_rec_msec(rec) < bkt->lrb_min_time)
+            bkt->lrb_min_time = changelog_rec_msec(rec);
+
+        dst += rec_len;
+        count++;
+    }
+
+    lcap_debug("Coalesced bucket at %p from %d down to %d records",
+               bkt, bkt->lrb_rec_count, count);
+
+    bkt->lrb_size      = dst;
+    bkt->lrb_rec_count = count;
+    rpc->pr_count      = count;
+
+    /* Offsets moved, forget about them */
+    rc->rc_ndead = 0;
+    rc->rc_gen++;
+}
+
+/**
+ * Get an empty bucket, the one whose records got spilled last if any.
+ * Ingestion thread only.
+ */
+static struct lcap_rec_bucket *rec_bucket_new(struct reader_env *env)
+{
+    struct lcap_rec_bucket  *bkt = env->re_spare;
+
+    if (bkt == NULL)
+        return bucket_pool_get(env);
+
+    env->re_spare = NULL;
+    rec_bucket_reset(&env->re_pool, bkt);
+    return bkt;
+}
+
+/**
+ * Get a new, empty, bucket to insert records into. It gets numbered once
+ * handed over. Return -ENOBUFS if all the buckets are in use. Ingestion thread
+ * only.
+ */
+static int rec_bucket_open(struct reader_env *env)
+{
+    struct lcap_rec_bucket  *bkt;
+
+    bkt = rec_bucket_new(env);
+    if (bkt == NULL)
+        return -ENOBUFS;
+
+    env->re_open = bkt;
+    env->re_coalesce.rc_gen++;
+
+    lcap_debug("Opened bucket for insert at %p", bkt);
+    return 0;
+}
+
+/**
+ * ZMQ free callback for messages built on top of a bucket arena, possibly
+ * invoked from a ZMQ I/O thread. The bucket itself is reclaimed by the reader
+ * (\a hint), woken up if it is waiting for buckets to be released. The bucket
+ * may be reused as soon as it is released, only the reader can be looked at.
+ */
+static void bucket_wire_put(void *data, void *hint)
+{
+    struct bucket_wire  *wire = container_of(data, struct bucket_wire, bw_rpc);
+    struct reader_env   *env  = (struct reader_env *)hint;
+
+    if (__atomic_sub_fetch(&wire->bw_refcount, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&env->re_pool.bp_nbusy, __ATOMIC_SEQ_CST) > 0)
+        reader_wakeup(env->re_serve_fd);
+}
+
+/**
+ * Recycle a bucket along with the records it contains.
+ */
+static void rec_bucket_destroy(struct reader_env *env,
+                               struct lcap_rec_bucket *bkt)
+{
+    lcap_debug("Destroying bucket #%ld at %p", bkt->lrb_index, bkt);
+    bucket_pool_put(env, bkt);
+}
+
+/**
+ * Whether a bucket can take more records. Buckets are sealed as soon as they
+ * could not fit a record of the largest possible size.
+ */
+static inline bool rec_bucket_full(const struct reader_env *env,
+                                   const struct lcap_rec_bucket *bkt)
+{
+    return bkt->lrb_rec_count == env->re_cfg->ccf_rec_batch_count ||
+           bkt->lrb_wire.bw_capacity - bkt->lrb_size < LCAP_REC_MAX_SIZE;
+}
+
+/**
+ * Copy and return a connection ID.
+ * Return NULL if memory could not be allocated.
+ */
+static struct conn_id *conn_id_dup(const struct conn_id *cid)
+{
+    struct conn_id *dup;
+
+    dup = malloc(sizeof(*dup) + cid->ci_length);
+    if (dup != NULL) {
+        dup->ci_length = cid->ci_length;
+        memcpy(dup->ci_data, cid->ci_data, cid->ci_length);
+    }
+
+    return dup;
+}
+
+/**
+ * Hash a connection identity (64bit FNV-1a).
+ */
+static uint64_t conn_id_hash(const struct conn_id *cid)
+{
+    uint64_t    hash = 0xcbf29ce484222325ULL;
+    size_t      i;
+
+    for (i = 0; i < cid->ci_length; i++) {
+        hash ^= cid->ci_data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static inline struct list *client_table_slot(const struct client_table *tbl,
+                                             uint64_t hash)
+{
+    return &tbl->ct_slots[hash & (tbl->ct_size - 1)];
+}
+
+static int client_table_init(struct client_table *tbl, size_t size)
+{
+    tbl->ct_slots = calloc(size, sizeof(*tbl->ct_slots));
+    if (tbl->ct_slots == NULL)
+        return -ENOMEM;
+
+    tbl->ct_size  = size;
+    tbl->ct_count = 0;
+    return 0;
+}
+
+/**
+ * Double the number of slots of \a tbl and redistribute registered clients.
+ * Hashes are cached in the client states so identities are not read again.
+ */
+static int client_table_grow(struct client_table *tbl)
+{
+    struct client_table  grown;
+    struct list_node    *lnode;
+    struct client_state *cs;
+    size_t               i;
+    int                  rc;
+
+    rc = client_table_init(&grown, tbl->ct_size * 2);
+    if (rc)
+        return rc;
+
+    for (i = 0; i < tbl->ct_size; i++) {
+        while ((lnode = list_pop_head(&tbl->ct_slots[i])) != NULL) {
+            cs = list_entry(lnode, struct client_state, cs_node);
+            list_append(client_table_slot(&grown, cs->cs_hash), lnode);
+        }
+    }
+
+    grown.ct_count = tbl->ct_count;
+    free(tbl->ct_slots);
+    *tbl = grown;
+
+    lcap_debug("Grew client table to %zu slots", tbl->ct_size);
+    return 0;
+}
+
+/**
+ * Register a client state into \a tbl. The table is grown once the average
+ * chain length would exceed one, so that lookups remain O(1).
+ */
+static int client_table_insert(struct client_table *tbl,
+                               struct client_state *cs)
+{
+    int rc;
+
+    if (tbl->ct_count >= tbl->ct_size) {
+        rc = client_table_grow(tbl);
+        if (rc)
+            return rc;
+    }
+
+    list_append(client_table_slot(tbl, cs->cs_hash), &cs->cs_node);
+    tbl->ct_count++;
+    return 0;
+}
+
+static void client_table_remove(struct client_table *tbl,
+                                struct client_state *cs)
+{
+    list_remove(client_table_slot(tbl, cs->cs_hash), &cs->cs_node);
+    tbl->ct_count--;
+}
+
+/**
+ * Get the client descriptor for the peer identified by \a cid. For this
+ * function to succeed and not return NULL, the corresponding peer must
+ * have registered itself using RPC_OP_START already.
+ */
+static struct client_state *client_state_get(struct reader_env *env,
+                                             const struct conn_id *cid)
+{
+    uint64_t             hash = conn_id_hash(cid);
+    struct list_node    *lnode;
+    struct conn_id      *cid_curr;
+    struct client_state *cs;
+
+    lnode = client_table_slot(&env->re_clients, hash)->l_first;
+    for (; lnode != NULL; lnode = lnode->ln_next) {
+        cs = list_entry(lnode, struct client_state, cs_node);
+        cid_curr = cs->cs_ident;
+
+        if (cs->cs_hash != hash || cid_curr->ci_length != cid->ci_length)
+            continue;
+
+        if (memcmp(cid_curr->ci_data, cid->ci_data, cid->ci_length) == 0)
+            return cs;
+    }
+
+    return NULL;
+}
+
+/**
+ * Free resources associated to a client state. It is assumed that the structure
+ * has already been unlinked from the client table.
+ */
+static void client_state_release(struct client_state *cs)
+{
+    rec_filter_free(cs->cs_filter);
+    free(cs->cs_held);
+    free(cs->cs_ident);
+    free(cs);
+}
+
+/**
+ * Forget about the i-th bucket held by a client.
+ */
+static inline void client_state_unhold(struct client_state *cs, unsigned int i)
+{
+    cs->cs_held[i] = cs->cs_held[--cs->cs_nheld];
+}
+
+/**
+ * Forget all registered clients and release the table itself.
+ */
+static void client_table_fini(struct client_table *tbl)
+{
+    struct list_node    *lnode;
+    size_t               i;
+
+    if (tbl->ct_slots == NULL)
+        return;
+
+    for (i = 0; i < tbl->ct_size; i++) {
+        while ((lnode = list_pop_head(&tbl->ct_slots[i])) != NULL)
+            client_state_release(list_entry(lnode, struct client_state,
+                                            cs_node));
+    }
+
+    free(tbl->ct_slots);
+    memset(tbl, 0, sizeof(*tbl));
+}
+
+static inline const char *consumer_group_name(const struct consumer_group *grp)
+{
+    if (grp->cg_private)
+        return "(broadcast)";
+
+    return grp->cg_name[0] != '\0' ? grp->cg_name : "(default)";
+}
+
+/**
+ * Create a consumer group named \a name for the records selected by \a rpc, or
+ * a private one if NULL. It starts from the oldest bucket still alive, so that
+ * no record retained by the reader is missed.
+ * Return NULL if memory could not be allocated.
+ */
+static struct consumer_group *consumer_group_new(
+                                            struct reader_env *env,
+                                            const char *name,
+                                            const struct px_rpc_register *rpc)
+{
+    struct consumer_group   *grp;
+    long                     i;
+
+    grp = calloc(1, sizeof(*grp));
+    if (grp == NULL)
+        return NULL;
+
+    grp->cg_leases = calloc(env->re_ring_mask + 1, sizeof(*grp->cg_leases));
+    if (grp->cg_leases == NULL) {
+        free(grp);
+        return NULL;
+    }
+
+    if (name != NULL && rpc->pr_filter_len > 0) {
+        grp->cg_filter = strdup((const char *)rpc->pr_filter);
+        if (grp->cg_filter == NULL) {
+            free(grp->cg_leases);
+            free(grp);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i <= env->re_ring_mask; i++)
+        grp->cg_leases[i].bl_group = grp;
+
+    if (name != NULL) {
+        strcpy(grp->cg_name, name);
+        grp->cg_type_mask  = rpc->pr_type_mask;
+        grp->cg_flags_mask = rpc->pr_flags_mask;
+    }
+
+    grp->cg_private      = name == NULL;
+    grp->cg_deliver_next = env->re_cleanup_next;
+    grp->cg_cleanup_next = env->re_cleanup_next;
+    list_append(&env->re_groups, &grp->cg_node);
+
+    lcap_verb("Created consumer group %s on %s from bucket #%ld",
+              consumer_group_name(grp), reader_device(env),
+              grp->cg_deliver_next);
+    return grp;
+}
+
+/**
+ * Indicate whether the members of \a grp select the records \a rpc asks for.
+ * Filter expressions are compared as text.
+ */
+static bool consumer_group_selects(const struct consumer_group *grp,
+                                   const struct px_rpc_register *rpc)
+{
+    if (grp->cg_type_mask != rpc->pr_type_mask ||
+        grp->cg_flags_mask != rpc->pr_flags_mask)
+        return false;
+
+    if (rpc->pr_filter_len == 0)
+        return grp->cg_filter == NULL;
+
+    return grp->cg_filter != NULL &&
+           strcmp(grp->cg_filter, (const char *)rpc->pr_filter) == 0;
+}
+
+/**
+ * Get the (non private) consumer group named \a name which selects the records
+ * \a rpc asks for, creating it if needed. Clients selecting other records than
+ * the group of that name get one of their own under the same name, rather than
+ * acknowledging records on behalf of members which did not get them.
+ * Groups are expected to be few, and looked up upon registration only.
+ */
+static struct consumer_group *consumer_group_get(
+                                            struct reader_env *env,
+                                            const char *name,
+                                            const struct px_rpc_register *rpc)
+{
+    struct list_node        *lnode;
+    struct consumer_group   *grp;
+    bool                     found = false;
+
+    for (lnode = env->re_groups.l_first; lnode; lnode = lnode->ln_next) {
+        grp = list_entry(lnode, struct consumer_group, cg_node);
+        if (grp->cg_private || strcmp(grp->cg_name, name) != 0)
+            continue;
+
+        if (consumer_group_selects(grp, rpc))
+            return grp;
+
+        found = true;
+    }
+
+    if (found)
+        lcap_info("Client selecting other records than group %s on %s "
+                  "gets a group of its own", name[0] ? name : "(default)",
+                  reader_device(env));
+
+    return consumer_group_new(env, name, rpc);
+}
+
+/**
+ * Forget about a consumer group and the leases of its buckets.
+ */
+static void consumer_group_destroy(struct reader_env *env,
+                                   struct consumer_group *grp)
+{
+    struct bucket_lease *lease;
+    long                 idx;
+
+    for (idx = grp->cg_cleanup_next; idx < grp->cg_deliver_next; idx++) {
+        lease = rec_lease_lookup(env, grp, idx);
+        if (lease->bl_state == BKT_LEASED)
+            tw_cancel(&env->re_leases, &lease->bl_timer);
+    }
+
+    lcap_verb("Destroying consumer group %s on %s at bucket #%ld",
+              consumer_group_name(grp), reader_device(env),
+              grp->cg_cleanup_next);
+
+    list_remove(&env->re_groups, &grp->cg_node);
+    free(grp->cg_filter);
+    free(grp->cg_leases);
+    free(grp);
+}
+
+/**
+ * Account \a bytes more (or less, if negative) of memory pinned by the cache of
+ * a reader. Return the amount for this reader.
+ */
+static long reader_charge(struct reader_env *env, long bytes)
+{
+    __atomic_add_fetch(&ReaderMemory, bytes, __ATOMIC_RELAXED);
+    return __atomic_add_fetch(&env->re_mem, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Wake up the ingestion of the other readers waiting for memory, after some was
+ * given back, if the budget is shared. Serving thread only.
+ */
+static void reader_budget_release(const struct reader_env *env)
+{
+    unsigned int    i;
+
+    if (env->re_cfg->ccf_max_total_mem == 0)
+        return;
+
+    /* Pairs with changelog_reader_wait(): either the waiting thread sees the
+     * memory given back, or it is seen waiting */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&BudgetWaiters, __ATOMIC_RELAXED) == 0)
+        return;
+
+    pthread_mutex_lock(&BudgetLock);
+    for (i = 0; i < env->re_cfg->ccf_mdtcount; i++) {
+        if (BudgetWaiting[i] != NULL && BudgetWaiting[i] != env)
+            reader_wakeup(BudgetWaiting[i]->re_ingest_fd);
+    }
+    pthread_mutex_unlock(&BudgetLock);
+}
+
+/**
+ * Indicate whether a bucket of \a count more records fits into the cache along
+ * with the ones handed over already. A bucket pins a whole arena, whatever the
+ * size of its records. Ingestion thread only.
+ */
+static bool changelog_reader_fits(const struct reader_env *env, long count)
+{
+    const struct lcap_cfg   *cfg = env->re_cfg;
+    long                     size = env->re_pool.bp_bktsz;
+    long                     cached;
+
+    /* Whatever the budget, one bucket at least */
+    cached = __atomic_load_n(&env->re_rec_cnt, __ATOMIC_RELAXED);
+    if (cached == 0)
+        return true;
+
+    if (cached + count > cfg->ccf_rec_batch_count * cfg->ccf_max_bkt)
+        return false;
+
+    if (cfg->ccf_max_mem > 0 &&
+        __atomic_load_n(&env->re_mem, __ATOMIC_RELAXED) + size >
+        cfg->ccf_max_mem)
+        return false;
+
+    return cfg->ccf_max_total_mem == 0 ||
+           __atomic_load_n(&ReaderMemory, __ATOMIC_RELAXED) + size <=
+           cfg->ccf_max_total_mem;
+}
+
+/**
+ * Number a bucket and push it to the serving thread. Return false if there was
+ * no room for it. Ingestion thread only.
+ */
+static bool rec_bucket_hand_over(struct reader_env *env,
+                                 struct lcap_rec_bucket *bkt)
+{
+    long    index = env->re_bkt_idx;
+    long    count = bkt->lrb_rec_count;
+    long    bytes;
+
+    /* The bucket belongs to the serving thread once pushed */
+    bkt->lrb_index = index;
+    if (!spsc_push(&env->re_sealed, bkt))
+        return false;
+
+    env->re_bkt_idx++;
+    __atomic_add_fetch(&env->re_rec_cnt, count, __ATOMIC_RELAXED);
+    bytes = reader_charge(env, env->re_pool.bp_bktsz);
+    if (bytes > env->re_stats.rs_mem_peak)
+        env->re_stats.rs_mem_peak = bytes;
+
+    reader_wakeup(env->re_serve_fd);
+
+    lcap_debug("Sealed bucket #%ld with %ld records", index, count);
+    return true;
+}
+
+static void changelog_clear_post(struct reader_env *env, long long index,
+                                 long count);
+
+/**
+ * Flush the spilled records to disk, after what they can be cleared upstream.
+ * Ingestion thread only.
+ */
+static int changelog_reader_spill_sync(struct reader_env *env, long count)
+{
+    struct segment_log  *log = &env->re_spill;
+    int                  rc;
+
+    rc = segment_sync(log);
+    if (rc) {
+        lcap_error("Cannot flush spilled records to '%s': %s", log->sl_dir,
+                   strerror(-rc));
+        return rc;
+    }
+
+    env->re_stats.rs_spill_syncs++;
+    changelog_clear_post(env, log->sl_synced_index, count);
+    return 0;
+}
+
+/**
+ * Hand the open bucket over to the serving thread, if it contains records.
+ * Return -EAGAIN if there was no room for it, in which case the bucket remains
+ * open. Ingestion thread only.
+ *
+ * When spilling is enabled, every sealed bucket is written to the segment log
+ * first, so that syncing it covers all the records read so far. Buckets that
+ * do not fit into the cache, or come after ones that did not, only stay on
+ * disk and get loaded back by changelog_reader_reload().
+ */
+static int changelog_reader_seal(struct reader_env *env)
+{
+    struct lcap_rec_bucket  *bkt = env->re_open;
+    struct segment_log      *log = &env->re_spill;
+    long                     count;
+    long                     size;
+    int                      rc;
+
+    if (bkt == NULL || bkt->lrb_rec_count == 0)
+        return 0;
+
+    rec_bucket_compact(env, bkt);
+
+    if (!segment_log_enabled(log)) {
+        if (!rec_bucket_hand_over(env, bkt))
+            return -EAGAIN;
+
+        env->re_open = NULL;
+        return 0;
+    }
+
+    count = bkt->lrb_rec_count;
+    size  = bkt->lrb_size;
+
+    rc = segment_append(log, bkt->lrb_wire.bw_rpc.pr_records, size, count,
+                        bkt->lrb_max_index, bkt->lrb_min_time,
+                        bkt->lrb_max_time);
+    if (rc) {
+        lcap_error("Cannot spill records to '%s': %s", log->sl_dir,
+                   strerror(-rc));
+        return rc;
+    }
+
+    env->re_open = NULL;
+
+    if (log->sl_backlog == 1 && changelog_reader_fits(env, count) &&
+        rec_bucket_hand_over(env, bkt)) {
+        segment_consume(log);
+        return 0;
+    }
+
+    lcap_debug("Spilled bucket with %ld records (up to record %lld)", count,
+               bkt->lrb_max_index);
+
+    env->re_stats.rs_bkt_spilled++;
+    env->re_stats.rs_spill_bytes += size;
+    env->re_spare = bkt;
+
+    return changelog_reader_spill_sync(env, count);
+}
+
+/**
+ * Load spilled buckets back, oldest first, as long as they fit into the cache,
+ * and remove the segments that are not needed anymore. Ingestion thread only.
+ */
+static int changelog_reader_reload(struct reader_env *env)
+{
+    struct segment_log      *log = &env->re_spill;
+    const struct seg_entry  *ent;
+    struct lcap_rec_bucket  *bkt;
+
+    while ((ent = segment_peek(log)) != NULL) {
+        if (!changelog_reader_fits(env, ent->se_count))
+            break;
+
+        /* Wait for buckets to be recycled */
+        bkt = rec_bucket_new(env);
+        if (bkt == NULL)
+            break;
+
+        memcpy(bkt->lrb_wire.bw_rpc.pr_records, ent->se_records, ent->se_len);
+        bkt->lrb_size      = ent->se_len;
+        bkt->lrb_rec_count = ent->se_count;
+        bkt->lrb_max_index = ent->se_max_index;
+        bkt->lrb_min_time  = ent->se_min_time;
+        bkt->lrb_max_time  = ent->se_max_time;
+        bkt->lrb_wire.bw_rpc.pr_count = ent->se_count;
+
+        if (!rec_bucket_hand_over(env, bkt)) {
+            env->re_spare = bkt;
+            break;
+        }
+
+        segment_consume(log);
+        env->re_stats.rs_bkt_reloaded++;
+        env->re_stats.rs_bytes_copied += bkt->lrb_size;
+    }
+
+    segment_trim(log, __atomic_load_n(&env->re_acked_index, __ATOMIC_ACQUIRE));
+    return 0;
+}
+
+/**
+ * Indicate whether the reader as described by \a env is full or still has
+ * available slots to store records. The bucket records are read into counts as
+ * a whole, open or about to be. Ingestion thread only. */
+static inline bool changelog_reader_full(const struct reader_env *env)
+{
+    const struct lcap_cfg   *cfg = env->re_cfg;
+    long                     size = env->re_pool.bp_bktsz;
+    long                     cached;
+    long                     count;
+
+    /* Overflow goes to disk */
+    if (segment_log_enabled(&env->re_spill))
+        return false;
+
+    /* Open bucket is full, but could not be sealed yet */
+    if (env->re_open != NULL && rec_bucket_full(env, env->re_open))
+        return true;
+
+    cached = __atomic_load_n(&env->re_rec_cnt, __ATOMIC_RELAXED);
+    count  = cached;
+    if (env->re_open != NULL)
+        count += env->re_open->lrb_rec_count;
+
+    if (count >= cfg->ccf_rec_batch_count * cfg->ccf_max_bkt)
+        return true;
+
+    /* Whatever the budget, one bucket at least */
+    if (cached == 0)
+        return false;
+
+    /* Open buckets of the other readers are only accounted once sealed */
+    if (cfg->ccf_max_mem > 0 &&
+        __atomic_load_n(&env->re_mem, __ATOMIC_RELAXED) + size >
+        cfg->ccf_max_mem)
+        return true;
+
+    return cfg->ccf_max_total_mem > 0 &&
+           __atomic_load_n(&ReaderMemory, __ATOMIC_RELAXED) + size >
+           cfg->ccf_max_total_mem;
+}
+
+/**
+ * Indicate whether reading waits for memory to be given back: either the cache
+ * is full, or spilled buckets do not fit into it. Ingestion thread only.
+ */
+static bool changelog_reader_starved(struct reader_env *env)
+{
+    const struct seg_entry  *ent;
+
+    if (changelog_reader_full(env))
+        return true;
+
+    if (!segment_log_enabled(&env->re_spill))
+        return false;
+
+    ent = segment_peek(&env->re_spill);
+    return ent != NULL && !changelog_reader_fits(env, ent->se_count);
+}
+
+/**
+ * Wait for ingestion to have something to do: records to read when following
+ * the changelog, room in the cache or buckets to be recycled otherwise. Memory
+ * given back by the other readers counts too, when the budget is shared.
+ * Ingestion thread only.
+ */
+static void changelog_reader_wait(struct reader_env *env)
+{
+    struct pollfd   pfd[2] = {{.fd = env->re_ingest_fd, .events = POLLIN},
+                              {.fd = env->re_tail_fd, .events = POLLIN}};
+    bool            budget = false;
+    eventfd_t       val;
+
+    if (env->re_tail_fd < 0 && env->re_cfg->ccf_max_total_mem > 0 &&
+        changelog_reader_starved(env)) {
+        pthread_mutex_lock(&BudgetLock);
+        BudgetWaiting[env->re_index] = env;
+        __atomic_add_fetch(&BudgetWaiters, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&BudgetLock);
+        budget = true;
+
+        /* Memory given back meanwhile did not wake this thread up */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    if (!budget || changelog_reader_starved(env)) {
+        if (poll(pfd, env->re_tail_fd >= 0 ? 2 : 1, -1) > 0 &&
+            (pfd[0].revents & POLLIN))
+            eventfd_read(env->re_ingest_fd, &val);
+    }
+
+    if (budget) {
+        pthread_mutex_lock(&BudgetLock);
+        BudgetWaiting[env->re_index] = NULL;
+        __atomic_sub_fetch(&BudgetWaiters, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&BudgetLock);
+    }
+}
+
+/**
+ * Readers are named after the MDT device they are attached to. Fill and store
+ * a connection_id structure accordingly. This is used for identify ourselves
+ * to the broker.
+ */
+static int build_reader_identity(struct reader_env *env)
+{
+    const char  *dev = reader_device(env);
+    size_t       dev_len = strlen(dev);
+
+    env->re_ident = malloc(sizeof(*env->re_ident) + dev_len);
+    if (env->re_ident == NULL)
+        return -ENOMEM;
+
+    memcpy(env->re_ident->ci_data, dev, dev_len);
+    env->re_ident->ci_length = dev_len;
+    return 0;
+}
+
+/**
+ * Associate an identity to the reader described by \a env.
+ * An identity is a unique identifier used to route messages to the
+ * other components appropriately.
+ */
+static int changelog_reader_set_identity(struct reader_env *env)
+{
+    int rc;
+
+    rc = build_reader_identity(env);
+    if (rc < 0)
+        return rc;
+
+    rc = zmq_setsockopt(env->re_sock, ZMQ_IDENTITY, env->re_ident->ci_data,
+                        env->re_ident->ci_length);
+    if (rc < 0)
+        return -errno;
+
+    return 0;
+}
+
+static inline void timespec_add_msec(struct timespec *ts, long msec)
+{
+    ts->tv_sec  += msec / 1000;
+    ts->tv_nsec += (msec % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/**
+ * Queue \a count records, up to \a index, for upstream clearing, once
+ * acknowledged (serving thread) or safely spilled (ingestion thread).
+ */
+static void changelog_clear_post(struct reader_env *env, long long index,
+                                 long count)
+{
+    pthread_mutex_lock(&env->re_clear_lock);
+
+    /* Acknowledged after having been spilled */
+    if (index <= env->re_clear_target) {
+        pthread_mutex_unlock(&env->re_clear_lock);
+        return;
+    }
+
+    if (env->re_clear_pending == 0)
+        clock_gettime(CLOCK_MONOTONIC, &env->re_clear_since);
+
+    env->re_clear_target   = index;
+    env->re_clear_pending += count;
+
+    if (env->re_clear_pending >= env->re_cfg->ccf_clear_batch)
+        pthread_cond_signal(&env->re_clear_cond);
+
+    pthread_mutex_unlock(&env->re_clear_lock);
+}
+
+/**
+ * Clear thread entry point. Issue a single upstream clear for all the records
+ * acknowledged since the previous one, according to the configured policy.
+ */
+static void *changelog_clear_main(void *args)
+{
+    struct reader_env   *env = (struct reader_env *)args;
+    const char          *cli = env->re_cfg->ccf_clreader;
+    const char          *dev = reader_device(env);
+    struct timespec      deadline;
+    long long            target;
+    long                 count;
+    int                  rc = 0;
+
+    pthread_mutex_lock(&env->re_clear_lock);
+    for (;;) {
+        bool stop = __atomic_load_n(&env->re_stop, __ATOMIC_ACQUIRE);
+
+        if (env->re_clear_pending == 0) {
+            if (stop)
+                break;
+
+            pthread_cond_wait(&env->re_clear_cond, &env->re_clear_lock);
+            continue;
+        }
+
+        /* Flush whatever is pending on termination */
+        if (!stop && env->re_clear_pending < env->re_cfg->ccf_clear_batch) {
+            deadline = env->re_clear_since;
+            timespec_add_msec(&deadline, env->re_cfg->ccf_clear_interval);
+            rc = pthread_cond_timedwait(&env->re_clear_cond,
+                                        &env->re_clear_lock, &deadline);
+            if (rc != ETIMEDOUT)
+                continue;
+        }
+
+        target = env->re_clear_target;
+        count  = env->re_clear_pending;
+        env->re_clear_pending = 0;
+        pthread_mutex_unlock(&env->re_clear_lock);
+
+        lcap_verb("Clearing %ld records from %s (up to record %lld)", count,
+                  dev, target);
+
+        rc = llapi_changelog_clear(dev, cli, target);
+
+        pthread_mutex_lock(&env->re_clear_lock);
+        if (rc < 0) {
+            lcap_error("Cannot clear changelog records "
+                        "(device='%s', reader='%s', rec=%lld): %s",
+                        dev, cli, target, strerror(-rc));
+            break;
+        }
+
+        env->re_stats.rs_rec_cleared += count;
+        env->re_stats.rs_clear_ops++;
+    }
+    pthread_mutex_unlock(&env->re_clear_lock);
+
+    if (rc < 0) {
+        __atomic_store_n(&env->re_worker_rc, rc, __ATOMIC_RELEASE);
+        reader_wakeup(env->re_serve_fd);
+    }
+
+    return NULL;
+}
+
+static int changelog_clear_init(struct reader_env *env)
+{
+    pthread_condattr_t  attr;
+    int                 rc;
+
+    rc = -pthread_mutex_init(&env->re_clear_lock, NULL);
+    if (rc)
+        return rc;
+
+    rc = -pthread_condattr_init(&attr);
+    if (rc)
+        return rc;
+
+    /* Deadlines are computed against the monotonic clock */
+    rc = -pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (rc == 0)
+        rc = -pthread_cond_init(&env->re_clear_cond, &attr);
+
+    pthread_condattr_destroy(&attr);
+    return rc;
+}
+
+/**
+ * Have the clear thread flush pending records and terminate.
+ */
+static void changelog_clear_stop(struct reader_env *env)
+{
+    pthread_mutex_lock(&env->re_clear_lock);
+    __atomic_store_n(&env->re_stop, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&env->re_clear_cond);
+    pthread_mutex_unlock(&env->re_clear_lock);
+
+    pthread_join(env->re_clear, NULL);
+}
+
+/**
+ * Open the segment log of the reader, in a directory named after its MDT.
+ * Buckets left over by a previous instance and not acknowledged get delivered
+ * again, reading from the MDT resuming after them instead of going through
+ * the whole backlog upstream.
+ */
+static int changelog_reader_spill_init(struct reader_env *env)
+{
+    const struct lcap_cfg   *cfg = env->re_cfg;
+    size_t                   seg_size = cfg->ccf_spill_seg_size;
+    char                     path[PATH_MAX];
+    struct timespec          start;
+    struct timespec          end;
+    int                      rc;
+
+    if (mkdir(cfg->ccf_spill_dir, 0700) && errno != EEXIST) {
+        rc = -errno;
+        lcap_error("Cannot create spill directory '%s': %s",
+                   cfg->ccf_spill_dir, strerror(-rc));
+        return rc;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", cfg->ccf_spill_dir,
+             reader_device(env));
+
+    /* A full bucket must fit in a segment */
+    if (seg_size < segment_min_size(env->re_pool.bp_arena))
+        seg_size = segment_min_size(env->re_pool.bp_arena);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = segment_log_open(&env->re_spill, path, seg_size);
+    if (rc)
+        return rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    env->re_stats.rs_recovery_msec = (end.tv_sec - start.tv_sec) * 1000 +
+                                     (end.tv_nsec - start.tv_nsec) / 1000000;
+
+    if (env->re_spill.sl_max_index >= 0) {
+        env->re_srec     = env->re_spill.sl_max_index + 1;
+        env->re_time_hwm = env->re_spill.sl_max_time;
+        lcap_info("%ld spilled buckets to deliver again from %s, recovered "
+                  "in %ld ms, reading resumes at record %lld",
+                  env->re_spill.sl_backlog, reader_device(env),
+                  env->re_stats.rs_recovery_msec, env->re_srec);
+    }
+
+    return 0;
+}
+
+/**
+ * Try to initialize a changelog reader thread.
+ * A reader is given an index by the main lcapd process, which indicates
+ * which MDT to follow from the ones specified in the configuration.
+ */
+static int changelog_reader_init(const struct lcap_cfg *cfg, unsigned int idx,
+                                 struct reader_env *env)
+{
+    int rc;
+
+    memset(env, 0, sizeof(*env));
+    env->re_cfg   = cfg;
+    env->re_index = idx;
+    env->re_ingest_fd = -1;
+    env->re_tail_fd   = -1;
+    env->re_serve_fd  = -1;
+    gettimeofday(&env->re_stats.rs_start_time, NULL);
+
+    rc = client_table_init(&env->re_clients, CLIENT_TABLE_MIN_SIZE);
+    if (rc)
+        return rc;
+
+    rc = tw_init(&env->re_leases, LEASE_WHEEL_SLOTS, LEASE_TICK_MSEC);
+    if (rc)
+        return rc;
+
+    rc = bucket_pool_init(&env->re_pool, cfg);
+    if (rc) {
+        lcap_error("Cannot preallocate buckets: %s", strerror(-rc));
+        return rc;
+    }
+
+    rc = rec_ring_init(env);
+    if (rc)
+        return rc;
+
+    if (cfg->ccf_coalesce) {
+        rc = rec_coalescer_init(&env->re_coalesce, cfg);
+        if (rc)
+            return rc;
+    }
+
+    if (cfg->ccf_spill_dir != NULL) {
+        rc = changelog_reader_spill_init(env);
+        if (rc)
+            return rc;
+    }
+
+    /* Sealed buckets waiting for the serving thread, which cannot exceed
+     * the number of buckets there are */
+    rc = spsc_init(&env->re_sealed, env->re_pool.bp_count);
+    if (rc)
+        return rc;
+
+    rc = changelog_clear_init(env);
+    if (rc)
+        return rc;
+
+    env->re_ingest_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    env->re_serve_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (env->re_ingest_fd < 0 || env->re_serve_fd < 0) {
+        rc = -errno;
+        lcap_error("Cannot create event descriptors: %s", strerror(-rc));
+        return rc;
+    }
+
+    env->re_zctx = zmq_ctx_new();
+    if (env->re_zctx == NULL) {
+        rc = -errno;
+        lcap_error("Cannot initialize ZMQ context: %s", zmq_strerror(-rc));
+        return rc;
+    }
+
+    env->re_sock = zmq_socket(env->re_zctx, ZMQ_DEALER);
+    if (env->re_sock == NULL) {
+        rc = -errno;
+        lcap_error("Cannot open changelog publication socket: %s",
+                   zmq_strerror(-rc));
+        return rc;
+    }
+
+    rc = changelog_reader_set_identity(env);
+    if (rc < 0) {
+        lcap_error("Cannot set identity to '%s': %s",
+                   (char *)env->re_ident->ci_data, zmq_strerror(-rc));
+        return rc;
+    }
+
+    rc = zmq_connect(env->re_sock, BROKER_CONN_URL);
+    if (rc < 0) {
+        rc = -errno;
+        lcap_error("Cannot connect to %s: %s", BROKER_CONN_URL,
+                   zmq_strerror(-rc));
+        return rc;
+    }
+
+    lcap_verb("Ready to distribute records to %s", BROKER_CONN_URL);
+    return 0;
+}
+
+/**
+ * Poke the broker, and give him information about the health of the current
+ * reader as described by \env.
+ */
+static int changelog_reader_signal(struct reader_env *env, int errcode)
+{
+    struct px_rpc_signal    rpc;
+    int                     rc;
+
+    memset(&rpc, 0, sizeof(rpc));
+    rpc_hdr_init(&rpc.pr_hdr, RPC_OP_SIGNAL);
+    rpc.pr_ret = (uint64_t)errcode;
+
+    strcpy((char *)rpc.pr_mdtname, reader_device(env));
+
+    rc = zmq_send(env->re_sock, "", 0, ZMQ_SNDMORE);
+    if (rc < 0) {
+        rc = -errno;
+        lcap_error("Cannot send signal RPC: %s", zmq_strerror(-rc));
+        return rc;
+    }
+
+    rc = zmq_send(env->re_sock, (void *)rpc.pr_mdtname,
+                  strlen((char *)rpc.pr_mdtname), ZMQ_SNDMORE);
+    if (rc < 0) {
+        rc = -errno;
+        lcap_error("Cannot send signal RPC: %s", zmq_strerror(-rc));
+        return rc;
+    }
+
+    rc = zmq_send(env->re_sock, (void *)&rpc, sizeof(rpc), 0);
+    if (rc < 0) {
+        rc = -errno;
+        lcap_error("Cannot send signal RPC: %s", zmq_strerror(-rc));
+        return rc;
+    }
+
+    return 0;
+}
+
+/**
+ * Upper bound of the \a pct-th percentile of the delivery latency, in msec.
+ */
+static long latency_percentile(const struct reader_stats *rstats, int pct)
+{
+    long    total = 0;
+    long    count = 0;
+    int     i;
+
+    for (i = 0; i < LAT_HIST_SLOTS; i++)
+        total += rstats->rs_lat_hist[i];
+
+    for (i = 0; i < LAT_HIST_SLOTS; i++) {
+        count += rstats->rs_lat_hist[i];
+        if (count * 100 >= total * pct)
+            break;
+    }
+
+    return i == 0 ? 1 : 1L << i;
+}
+
+/**
+ * Display information gathered during operation times.
+ */
+static int changelog_reader_print_stats(struct reader_env *env)
+{
+    struct reader_stats *rstats = &env->re_stats;
+    const char          *device = reader_device(env);
+    struct timeval       end;
+    int                  duration;
+    double               processing_rate;
+
+    gettimeofday(&end, NULL);
+
+    duration = end.tv_sec - rstats->rs_start_time.tv_sec;
+    duration *= 1000;
+    duration += (end.tv_usec / 1000) - (rstats->rs_start_time.tv_usec / 1000);
+
+    if (duration == 0)
+        processing_rate = 0.0;
+    else
+        processing_rate = (double)rstats->rs_rec_read / duration;
+
+    lcap_info("%ld records processed from %s (%d/s)", rstats->rs_rec_read,
+              device, (int)(processing_rate * 1000));
+    lcap_info("%ld records coalesced from %s (%.2fx reduction)",
+              rstats->rs_rec_coalesced, device,
+              rstats->rs_rec_read == rstats->rs_rec_coalesced ? 1.0 :
+              (double)rstats->rs_rec_read /
+              (rstats->rs_rec_read - rstats->rs_rec_coalesced));
+    lcap_info("Bucket pool for %s: %zu buckets, %ld hits, %ld waits", device,
+              env->re_pool.bp_count, rstats->rs_pool_hits,
+              rstats->rs_pool_waits);
+    lcap_info("Record cache for %s: %ld bytes at most (budget %zu), "
+              "%ld bytes for all MDTs (budget %zu)", device,
+              rstats->rs_mem_peak, env->re_cfg->ccf_max_mem,
+              __atomic_load_n(&ReaderMemory, __ATOMIC_RELAXED),
+              env->re_cfg->ccf_max_total_mem);
+    lcap_info("%ld buckets (%ld bytes) spilled to disk from %s, %ld loaded "
+              "back, %ld flushes, recovered in %ld ms", rstats->rs_bkt_spilled,
+              rstats->rs_spill_bytes, device, rstats->rs_bkt_reloaded,
+              rstats->rs_spill_syncs, rstats->rs_recovery_msec);
+    lcap_info("%ld records sent from %s (%.1f bytes copied per sent record)",
+              rstats->rs_rec_sent, device, rstats->rs_rec_sent == 0 ? 0.0 :
+              (double)rstats->rs_bytes_copied / rstats->rs_rec_sent);
+    lcap_info("%ld record bytes sent from %s, %ld records filtered out",
+              rstats->rs_bytes_sent, device, rstats->rs_rec_filtered);
+    lcap_info("%ld record bytes compressed from %s (%.2fx ratio, %.1f MB/s)",
+              rstats->rs_zbytes_in, device, rstats->rs_zbytes_out == 0 ? 1.0 :
+              (double)rstats->rs_zbytes_in / rstats->rs_zbytes_out,
+              rstats->rs_zusec == 0 ? 0.0 :
+              (double)rstats->rs_zbytes_in / rstats->rs_zusec);
+    lcap_info("%ld record bytes encoded by columns from %s (%.2fx ratio)",
+              rstats->rs_col_bytes_in, device,
+              rstats->rs_col_bytes_out == 0 ? 1.0 :
+              (double)rstats->rs_col_bytes_in / rstats->rs_col_bytes_out);
+    lcap_info("%ld records redelivered from %s after lease expiry",
+              rstats->rs_rec_redelivered, device);
+    lcap_info("Delivery latency from %s: p50 < %ldms, p99 < %ldms, max %ldms",
+              device, latency_percentile(rstats, 50),
+              latency_percentile(rstats, 99), rstats->rs_lat_max);
+    lcap_info("%ld records cleared from %s in %ld operations",
+              rstats->rs_rec_cleared, device, rstats->rs_clear_ops);
+    return 0;
+}
+
+/**
+ * Release resources associated to the current changelog reader as described by
+ * \a env. Print out statistics eventually.
+ */
+static int changelog_reader_release(struct reader_env *env)
+{
+    struct lcap_rec_bucket  *bkt;
+    long                     idx;
+    int                      rc;
+
+    if (env->re_sock != NULL) {
+        zmq_close(env->re_sock);
+        env->re_sock = NULL;
+    }
+
+    if (env->re_zctx != NULL) {
+        zmq_ctx_destroy(env->re_zctx);
+        env->re_zctx = NULL;
+    }
+
+    client_table_fini(&env->re_clients);
+    rec_coalescer_fini(&env->re_coalesce);
+
+    while (env->re_groups.l_first != NULL)
+        consumer_group_destroy(env, list_entry(env->re_groups.l_first,
+                                               struct consumer_group, cg_node));
+
+    tw_fini(&env->re_leases);
+
+    pthread_cond_destroy(&env->re_clear_cond);
+    pthread_mutex_destroy(&env->re_clear_lock);
+
+    if (env->re_ingest_fd >= 0)
+        close(env->re_ingest_fd);
+
+    if (env->re_serve_fd >= 0)
+        close(env->re_serve_fd);
+
+    for (idx = env->re_cleanup_next; idx < env->re_ring_head; idx++)
+        rec_bucket_destroy(env, rec_bucket_lookup(env, idx));
+
+    free(env->re_ring);
+    env->re_ring = NULL;
+
+    /* The ingestion thread is gone, drain what it left behind */
+    if (env->re_sealed.sq_slots != NULL) {
+        while ((bkt = spsc_pop(&env->re_sealed)) != NULL)
+            rec_bucket_destroy(env, bkt);
+        spsc_fini(&env->re_sealed);
+    }
+
+    if (env->re_open != NULL) {
+        rec_bucket_destroy(env, env->re_open);
+        env->re_open = NULL;
+    }
+
+    if (env->re_spare != NULL) {
+        rec_bucket_destroy(env, env->re_spare);
+        env->re_spare = NULL;
+    }
+
+    bucket_pool_fini(&env->re_pool);
+
+    if (segment_log_enabled(&env->re_spill))
+        segment_log_close(&env->re_spill);
+
+    /* Give the budget of the records left behind back to the other readers */
+    __atomic_sub_fetch(&ReaderMemory, env->re_mem, __ATOMIC_RELAXED);
+
+    rc = changelog_reader_print_stats(env);
+    if (rc < 0)
+        return rc;
+
+    return 0;
+}
+
+/**
+ * Queue the buckets whose lease has expired for redelivery. Only these get
+ * served again, before the ones never sent yet, whether or not clients are
+ * asking for records.
+ */
+static void rec_lease_expire(struct reader_env *env)
+{
+    struct list              expired = EMPTY_LIST_INITIALIZER;
+    struct list_node        *lnode;
+    struct bucket_lease     *lease;
+
+    tw_advance(&env->re_leases, &expired);
+
+    while ((lnode = list_pop_head(&expired)) != NULL) {
+        lease = container_of(lnode, struct bucket_lease, bl_timer.tt_node);
+
+        lcap_debug("Lease of bucket #%ld expired, queuing for redelivery",
+                   lease->bl_index);
+
+        list_append(&lease->bl_group->cg_redeliver, &lease->bl_node);
+        lease->bl_state = BKT_EXPIRED;
+    }
+}
+
+/**
+ * Terminate a lease, whatever its current holder.
+ */
+static void rec_lease_drop(struct reader_env *env, struct bucket_lease *lease)
+{
+    if (lease->bl_state == BKT_LEASED)
+        tw_cancel(&env->re_leases, &lease->bl_timer);
+    else if (lease->bl_state == BKT_EXPIRED)
+        list_remove(&lease->bl_group->cg_redeliver, &lease->bl_node);
+
+    lease->bl_owner = NULL;
+}
+
+/**
+ * Extract the next bucket of records to be served to a member of \a grp.
+ * Buckets whose lease has expired come first, then the ones never delivered
+ * to the group yet by increasing consumer_group::cg_deliver_next.
+ * This function returns NULL if no bucket was available.
+ */
+static struct lcap_rec_bucket *rec_bucket_get(struct reader_env *env,
+                                              struct consumer_group *grp)
+{
+    struct lcap_rec_bucket *bkt;
+    struct list_node       *lnode;
+
+    rec_lease_expire(env);
+
+    lnode = list_pop_head(&grp->cg_redeliver);
+    if (lnode != NULL) {
+        bkt = rec_bucket_lookup(env, list_entry(lnode, struct bucket_lease,
+                                                bl_node)->bl_index);
+        env->re_stats.rs_rec_redelivered += bkt->lrb_rec_count;
+        return bkt;
+    }
+
+    bkt = rec_bucket_lookup(env, grp->cg_deliver_next);
+    if (bkt == NULL)
+        return NULL;
+
+    grp->cg_deliver_next++;
+    return bkt;
+}
+
+/**
+ * Clear upstream and recycle the buckets acknowledged by all consumer groups.
+ * Buckets are retained as long as there is no group at all.
+ */
+static void changelog_reader_cleanup(struct reader_env *env)
+{
+    struct lcap_rec_bucket  *bkt;
+    struct consumer_group   *grp;
+    struct list_node        *lnode;
+    long                     target = -1;
+    long long                acked = -1;
+
+    for (lnode = env->re_groups.l_first; lnode; lnode = lnode->ln_next) {
+        grp = list_entry(lnode, struct consumer_group, cg_node);
+        if (target < 0 || grp->cg_cleanup_next < target)
+            target = grp->cg_cleanup_next;
+    }
+
+    if (target <= env->re_cleanup_next)
+        return;
+
+    while (env->re_cleanup_next < target) {
+        bkt = rec_bucket_lookup(env, env->re_cleanup_next);
+
+        lcap_verb("About to acknowledge bucket #%ld (up to record %lld)",
+                  bkt->lrb_index, bkt->lrb_max_index);
+
+        changelog_clear_post(env, bkt->lrb_max_index, bkt->lrb_rec_count);
+        acked = bkt->lrb_max_index;
+
+        env->re_ring[bkt->lrb_index & env->re_ring_mask] = NULL;
+        env->re_cleanup_next++;
+        __atomic_sub_fetch(&env->re_rec_cnt, bkt->lrb_rec_count,
+                           __ATOMIC_RELAXED);
+        reader_charge(env, -(long)(env->re_pool.bp_bktsz +
+                                   bkt->lrb_enc_bytes));
+        rec_bucket_destroy(env, bkt);
+    }
+
+    reader_budget_release(env);
+
+    /* Spilled segments up to there can go */
+    __atomic_store_n(&env->re_acked_index, acked, __ATOMIC_RELEASE);
+    reader_wakeup(env->re_ingest_fd);
+}
+
+/**
+ * Move the cleanup cursor of \a grp past the buckets it acknowledged, and
+ * clear the ones no other group is waiting for.
+ */
+static void consumer_group_advance(struct reader_env *env,
+                                   struct consumer_group *grp)
+{
+    while (grp->cg_cleanup_next < grp->cg_deliver_next &&
+           rec_lease_lookup(env, grp, grp->cg_cleanup_next)->bl_state ==
+           BKT_READY)
+        grp->cg_cleanup_next++;
+
+    changelog_reader_cleanup(env);
+}
+
+/**
+ * Move a consumer group ahead to the first bucket holding records from
+ * \a start on. The buckets before it count as acknowledged by the group, and
+ * the records before \a start in that bucket get filtered out on delivery.
+ */
+static void consumer_group_seek(struct reader_env *env,
+                                struct consumer_group *grp, long long start)
+{
+    struct bucket_lease *lease;
+    long                 target;
+    long                 idx;
+
+    target = rec_ring_seek(env, grp->cg_cleanup_next, start);
+
+    for (idx = grp->cg_cleanup_next; idx < target; idx++) {
+        lease = rec_lease_lookup(env, grp, idx);
+        rec_lease_drop(env, lease);
+        lease->bl_state = BKT_READY;
+    }
+
+    if (target > grp->cg_deliver_next)
+        grp->cg_deliver_next = target;
+
+    lcap_verb("Consumer group %s on %s starts at record %lld, bucket #%ld",
+              consumer_group_name(grp), reader_device(env), start, target);
+
+    consumer_group_advance(env, grp);
+}
+
+/**
+ * Forget about the named groups left by all their members for Group_Expiry
+ * seconds, so that they do not retain records forever. Return the delay until
+ * the next group expires (msec), -1 if none is about to. Serving thread only.
+ */
+static int consumer_group_expire(struct reader_env *env)
+{
+    struct list_node        *lnode;
+    struct list_node        *next;
+    struct consumer_group   *grp;
+    uint64_t                 now = tw_clock_msec();
+    uint64_t                 wait = UINT64_MAX;
+    bool                     expired = false;
+
+    for (lnode = env->re_groups.l_first; lnode != NULL; lnode = next) {
+        next = lnode->ln_next;
+        grp  = list_entry(lnode, struct consumer_group, cg_node);
+
+        if (grp->cg_expiry == 0)
+            continue;
+
+        if (grp->cg_expiry > now) {
+            if (grp->cg_expiry - now < wait)
+                wait = grp->cg_expiry - now;
+            continue;
+        }
+
+        lcap_info("Consumer group %s on %s expired without members",
+                  consumer_group_name(grp), reader_device(env));
+        consumer_group_destroy(env, grp);
+        expired = true;
+    }
+
+    /* Records it retained may only be waiting for it */
+    if (expired)
+        changelog_reader_cleanup(env);
+
+    return wait > INT_MAX ? -1 : (int)wait;
+}
+
+/**
+ * Get the highest index contained in a bucket.
+ */
+static long long rec_bucket_max_index(const struct lcap_rec_bucket *bkt)
+{
+    if (bkt->lrb_rec_count == 0)
+        return -1;
+
+    return bkt->lrb_max_index;
+}
+
+/**
+ * Get the lowest index contained in a (non-empty) bucket, the first one.
+ */
+static long long rec_bucket_min_index(const struct lcap_rec_bucket *bkt)
+{
+    const struct changelog_rec  *rec;
+
+    rec = (const struct changelog_rec *)bkt->lrb_wire.bw_rpc.pr_records;
+    return rec->cr_index;
+}
+
+/**
+ * Get the index of the first record from time \a msec on among \a len bytes
+ * of records, -1 if there is none.
+ */
+static long long rec_time_first(const void *recs, size_t len, uint64_t msec)
+{
+    const struct changelog_rec  *rec;
+    size_t                       off;
+
+    for (off = 0; off < len;
+         off += changelog_rec_size((struct changelog_rec *)rec) +
+                rec->cr_namelen) {
+        rec = (const struct changelog_rec *)((const char *)recs + off);
+        if (changelog_rec_msec(rec) >= msec)
+            return rec->cr_index;
+    }
+
+    return -1;
+}
+
+/**
+ * Get the index of the first record from time \a msec on in a bucket whose
+ * time watermark reaches it. Should the records reaching it have been
+ * coalesced away, the following bucket starts.
+ */
+static long long rec_bucket_seek_time(const struct lcap_rec_bucket *bkt,
+                                      uint64_t msec)
+{
+    long long   index;
+
+    index = rec_time_first(bkt->lrb_wire.bw_rpc.pr_records, bkt->lrb_size,
+                           msec);
+    return index < 0 ? bkt->lrb_max_index + 1 : index;
+}
+
+/**
+ * Resolve the start time of a group into a start record: the first one from
+ * that time on, within the first bucket whose time watermark reaches it. Live
+ * buckets are looked up first, then spilled ones. If no bucket reaches it yet,
+ * the live ones are skipped and the time gets resolved on delivery.
+ */
+static void consumer_group_start_time(struct reader_env *env,
+                                      struct consumer_group *grp,
+                                      uint64_t msec)
+{
+    long    idx;
+
+    idx = rec_ring_seek_time(env, msec);
+    if (idx < env->re_ring_head) {
+        grp->cg_start = rec_bucket_seek_time(rec_bucket_lookup(env, idx),
+                                             msec);
+    } else if (!segment_log_enabled(&env->re_spill) ||
+               segment_seek_time(&env->re_spill, msec, rec_time_first,
+                                 &grp->cg_start) == 0) {
+        grp->cg_start_time = msec;
+        if (env->re_ring_head > env->re_cleanup_next)
+            grp->cg_start = rec_bucket_max_index(
+                rec_bucket_lookup(env, env->re_ring_head - 1)) + 1;
+    }
+
+    lcap_verb("Start time %llu resolved into record %lld%s",
+              (unsigned long long)msec, grp->cg_start,
+              grp->cg_start_time ? " (until reached)" : "");
+}
+
+/**
+ * Insert a new changelog_record into the reader's cache. The record is copied
+ * into the arena of the open bucket and released. Full buckets get sealed.
+ * Ingestion thread only.
+ */
+static int changelog_reader_rec_store(struct reader_env *env,
+                                      struct changelog_rec *rec)
+{
+    struct lcap_rec_bucket  *current;
+    struct px_rpc_enqueue   *rpc;
+    size_t                   rec_len = changelog_rec_size(rec) + rec->cr_namelen;
+    int                      rc;
+
+    current = env->re_open;
+    assert(current != NULL && !rec_bucket_full(env, current));
+    assert(current->lrb_size + rec_len <= current->lrb_wire.bw_capacity);
+
+    rpc = &current->lrb_wire.bw_rpc;
+    memcpy(rpc->pr_records + current->lrb_size, rec, rec_len);
+
+    if (env->re_coalesce.rc_table != NULL)
+        rec_coalesce(env, current, rec, current->lrb_rec_count,
+                     current->lrb_size);
+
+    current->lrb_size += rec_len;
+    current->lrb_max_index = rec->cr_index;
+    if (current->lrb_rec_count == 0 ||
+        changelog_rec_msec(rec) < current->lrb_min_time)
+        current->lrb_min_time = changelog_rec_msec(rec);
+    /* Kept monotonic for time lookups, clocks of MDS threads may differ */
+    if (changelog_rec_msec(rec) > env->re_time_hwm)
+        env->re_time_hwm = changelog_rec_msec(rec);
+    current->lrb_max_time = env->re_time_hwm;
+    rpc->pr_count = ++current->lrb_rec_count;
+
+    env->re_stats.rs_bytes_copied += rec_len;
+    lcap_debug("Inserted record #%llu into current bucket at %d",
+               rec->cr_index, current->lrb_rec_count - 1);
+
+    llapi_changelog_free(&rec);
+
+    /* If the serving thread lags behind, the bucket remains open (but full)
+     * and sealing it is retried on next round */
+    if (rec_bucket_full(env, current)) {
+        rc = changelog_reader_seal(env);
+        if (rc && rc != -EAGAIN)
+            return rc;
+    }
+
+    return 0;
+}
+
+/**
+ * Process START message from client. Registration consists in creating a new
+ * client state structure and replying with the number of credits granted.
+ *
+ * Clients which predate versioning send a shorter message, and take anything
+ * but a zero return code as an error. They get what they always did: a bucket
+ * at a time, on request, from the default group.
+ */
+static int reader_handle_start(struct reader_env *env,
+                               const struct lcapnet_request *req)
+{
+    struct px_rpc_register  *rpc = (struct px_rpc_register *)req->lr_body;
+    struct px_rpc_register   legacy;
+    size_t                   body_len = req->lr_body_len;
+    const char              *group;
+    struct client_state     *cs;
+    unsigned int             credits;
+    int                      rc;
+
+    if (rpc->pr_hdr.version == 0 &&
+        body_len >= sizeof(struct px_rpc_register_v0)) {
+        memset(&legacy, 0, sizeof(legacy));
+        legacy.pr_start = ((struct px_rpc_register_v0 *)rpc)->pr_start;
+        rpc = &legacy;
+        body_len = sizeof(legacy);
+    }
+
+    if (body_len < sizeof(*rpc)) {
+        lcap_error("Truncated START RPC of size %zd", body_len);
+        return -EINVAL;
+    }
+
+    group = (const char *)rpc->pr_group;
+    if (strnlen(group, sizeof(rpc->pr_group)) == sizeof(rpc->pr_group)) {
+        lcap_error("Unterminated group name in START RPC");
+        return -EINVAL;
+    }
+
+    if (rpc->pr_filter_len > body_len - sizeof(*rpc) ||
+        (rpc->pr_filter_len > 0 &&
+         rpc->pr_filter[rpc->pr_filter_len - 1] != '\0')) {
+        lcap_error("Invalid filter expression in START RPC");
+        return -EINVAL;
+    }
+
+    cs = client_state_get(env, req->lr_forward);
+    if (cs != NULL) {
+        lcap_info("Received START RPC for already registered client");
+        return -EALREADY;
+    }
+
+    cs = calloc(1, sizeof(*cs));
+    if (cs == NULL) {
+        rc = -ENOMEM;
+        lcap_error("Cannot initialize client context: %s", strerror(-rc));
+        return rc;
+    }
+
+    /* Stop-and-wait unless asked otherwise */
+    credits = rpc->pr_credits ? rpc->pr_credits : 1;
+    if (credits > env->re_cfg->ccf_max_credits)
+        credits = env->re_cfg->ccf_max_credits;
+
+    cs->cs_credits = credits;
+    cs->cs_version = rpc->pr_hdr.version < LCAP_PROTO_VERSION ?
+                     rpc->pr_hdr.version : LCAP_PROTO_VERSION;
+    cs->cs_type_mask  = rpc->pr_type_mask;
+    cs->cs_flags_mask = rpc->pr_flags_mask;
+
+    if (rpc->pr_filter_len > 0) {
+        rc = rec_filter_compile(rpc->pr_filter, &cs->cs_filter);
+        if (rc) {
+            client_state_release(cs);
+            return rc;
+        }
+    }
+    cs->cs_stream  = !!(rpc->pr_flags & RPC_REG_STREAM);
+    if (rpc->pr_flags & RPC_REG_COLUMNAR)
+        cs->cs_encoding |= RPC_ENQ_COLUMNAR;
+#ifdef HAVE_LIBZ
+    if (rpc->pr_flags & RPC_REG_COMPRESS)
+        cs->cs_encoding |= RPC_ENQ_ZLIB;
+#endif
+    cs->cs_ack_timeout = rpc->pr_ack_timeout ? rpc->pr_ack_timeout :
+                                               env->re_cfg->ccf_ack_timeout;
+    cs->cs_held  = calloc(credits, sizeof(*cs->cs_held));
+    cs->cs_ident = conn_id_dup(req->lr_forward);
+    if (cs->cs_held == NULL || cs->cs_ident == NULL) {
+        client_state_release(cs);
+        rc = -ENOMEM;
+        lcap_error("Cannot populate client context: %s", strerror(-rc));
+        return rc;
+    }
+
+    cs->cs_hash = conn_id_hash(cs->cs_ident);
+    rc = client_table_insert(&env->re_clients, cs);
+    if (rc) {
+        client_state_release(cs);
+        lcap_error("Cannot register client context: %s", strerror(-rc));
+        return rc;
+    }
+
+    /* Groups are created on first need, once nothing else can fail: a named
+     * group left without members would never expire */
+    if (rpc->pr_flags & RPC_REG_BROADCAST)
+        cs->cs_group = consumer_group_new(env, NULL, NULL);
+    else
+        cs->cs_group = consumer_group_get(env, group, rpc);
+
+    if (cs->cs_group == NULL) {
+        client_table_remove(&env->re_clients, cs);
+        client_state_release(cs);
+        rc = -ENOMEM;
+        lcap_error("Cannot create consumer group: %s", strerror(-rc));
+        return rc;
+    }
+
+    /* The start is that of the group: skipping records on behalf of the
+     * other members would lose them */
+    if (rpc->pr_start > 0 && cs->cs_group->cg_members > 0) {
+        lcap_info("Ignoring start %s %llu of client joining group %s, "
+                  "which has members already",
+                  rpc->pr_flags & RPC_REG_START_TIME ? "time" : "record",
+                  (unsigned long long)rpc->pr_start,
+                  consumer_group_name(cs->cs_group));
+    } else if (rpc->pr_start > 0) {
+        cs->cs_group->cg_start      = 0;
+        cs->cs_group->cg_start_time = 0;
+        if (rpc->pr_flags & RPC_REG_START_TIME)
+            consumer_group_start_time(env, cs->cs_group, rpc->pr_start);
+        else
+            cs->cs_group->cg_start = rpc->pr_start;
+    }
+
+    cs->cs_group->cg_members++;
+    cs->cs_group->cg_expiry = 0;
+    if (rpc->pr_start > 0 && cs->cs_group->cg_start > 0)
+        consumer_group_seek(env, cs->cs_group, cs->cs_group->cg_start);
+
+    /* Let the client know how many credits were granted */
+    rc = ack_retcode(env->re_sock, NULL, req->lr_forward, RPC_OP_START,
+                     cs->cs_version > 0 ? credits : 0);
+    if (rc < 0) {
+        lcap_error("Cannot ACK: %s", zmq_strerror(-rc));
+        return rc;
+    }
+
+    /* Start pushing records only once registration is acknowledged */
+    if (cs->cs_stream)
+        list_append(&env->re_streams, &cs->cs_stream_node);
+
+    lcap_info("Registered new client for %s in group %s (%u credits)",
+              reader_device(env), consumer_group_name(cs->cs_group), credits);
+    return 0;
+}
+
+#ifdef HAVE_LIBZ
+/**
+ * Compress the \a size bytes of records carried by \a src into a message of
+ * its own. Return NULL if it cannot be done or if it would not save anything,
+ * so that the records are sent as is.
+ */
+static struct bucket_wire *rec_compress(struct reader_env *env,
+                                        const struct px_rpc_enqueue *src,
+                                        size_t size)
+{
+    struct reader_stats *rstats = &env->re_stats;
+    struct bucket_wire  *wire;
+    struct timespec      start;
+    struct timespec      end;
+    uLongf               zlen = compressBound(size);
+    int                  rc;
+
+    wire = malloc(sizeof(*wire) + zlen);
+    if (wire == NULL)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = compress2(wire->bw_rpc.pr_records, &zlen, src->pr_records, size,
+                   Z_BEST_SPEED);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    rstats->rs_zusec += (end.tv_sec - start.tv_sec) * 1000000L +
+                        (end.tv_nsec - start.tv_nsec) / 1000;
+    rstats->rs_zbytes_in += size;
+
+    if (rc != Z_OK || zlen >= size) {
+        rstats->rs_zbytes_out += size;
+        free(wire);
+        return NULL;
+    }
+
+    rstats->rs_zbytes_out += zlen;
+
+    wire->bw_refcount = 0;
+    wire->bw_capacity = zlen;
+    rpc_hdr_init(&wire->bw_rpc.pr_hdr, RPC_OP_ENQUEUE);
+    wire->bw_rpc.pr_count   = src->pr_count;
+    wire->bw_rpc.pr_flags   = src->pr_flags | RPC_ENQ_ZLIB;
+    wire->bw_rpc.pr_raw_len = size;
+    return wire;
 }
+#endif
 
 /**
- * Release resources associated to the current changelog reader as described by
- * \a env. Print out statistics eventually.
+ * Encode the \a size bytes of records carried by \a src by columns, into a
+ * message of its own. Return NULL if it cannot be done or if it would not save
+ * anything, so that the records are sent as is.
  */
-static int changelog_reader_release(struct reader_env *env)
+static struct bucket_wire *rec_columns(struct reader_env *env,
+                                       const struct px_rpc_enqueue *src,
+                                       size_t size)
 {
-    int rc;
+    struct reader_stats *rstats = &env->re_stats;
+    struct bucket_wire  *wire;
+    size_t               len;
+    void                *buff;
+    int                  rc;
 
-    if (env->re_sock != NULL) {
-        zmq_close(env->re_sock);
-        env->re_sock = NULL;
+    rc = lcap_col_encode(src->pr_records, size, src->pr_count,
+                         offsetof(struct bucket_wire, bw_rpc) +
+                         sizeof(struct px_rpc_enqueue), &buff, &len);
+    if (rc < 0) {
+        lcap_debug("Cannot encode %u records by columns: %s", src->pr_count,
+                   strerror(-rc));
+        return NULL;
     }
 
-    if (env->re_zctx != NULL) {
-        zmq_ctx_destroy(env->re_zctx);
-        env->re_zctx = NULL;
-    }
+    rstats->rs_col_bytes_in  += size;
+    rstats->rs_col_bytes_out += len;
 
-    rc = changelog_reader_print_stats(env);
-    if (rc < 0)
-        return rc;
+    if (len >= size) {
+        free(buff);
+        return NULL;
+    }
 
-    return 0;
+    wire = buff;
+    wire->bw_refcount = 0;
+    wire->bw_capacity = len;
+    rpc_hdr_init(&wire->bw_rpc.pr_hdr, RPC_OP_ENQUEUE);
+    wire->bw_rpc.pr_count    = src->pr_count;
+    wire->bw_rpc.pr_flags    = RPC_ENQ_COLUMNAR;
+    wire->bw_rpc.pr_raw_len  = len;
+    wire->bw_rpc.pr_reserved = 0;
+    return wire;
 }
 
-static inline struct lcap_rec_bucket *bucket_next(struct lcap_rec_bucket *bkt)
+/**
+ * ZMQ free callback for encoded copies of filtered messages, which belong to
+ * nobody else.
+ */
+static void encoded_wire_put(void *data, void *hint)
 {
-    if (bkt == NULL || bkt->lrb_node.ln_next == NULL)
-        return NULL;
+    free(container_of(data, struct bucket_wire, bw_rpc));
+}
 
-    return list_entry(bkt->lrb_node.ln_next, struct lcap_rec_bucket, lrb_node);
+static inline size_t rec_bucket_wire_len(const struct lcap_rec_bucket *bkt,
+                                         const struct bucket_wire *wire)
+{
+    return wire == &bkt->lrb_wire ? bkt->lrb_size : wire->bw_capacity;
 }
 
 /**
- * Extract the next bucket of records to be served from \a env by
- * increasing env::re_deliver_next.
- * This function returns NULL if no bucket was available.
+ * Get the message to send a bucket with, given the RPC_ENQ_* encodings a client
+ * accepts. Encoded copies are made upon first need, and kept along with the
+ * bucket. Encodings which cannot be done are dropped, columns first.
  */
-static struct lcap_rec_bucket *rec_bucket_get(struct reader_env *env)
+static struct bucket_wire *rec_bucket_wire(struct reader_env *env,
+                                           struct lcap_rec_bucket *bkt,
+                                           uint32_t enc)
 {
-    struct lcap_rec_bucket *bkt = env->re_cleanup_next;
-    struct lcap_rec_bucket *tmp;
-    struct timespec         now;
-
-    assert(bkt != NULL);
+    struct bucket_wire  **copy;
+    struct bucket_wire   *base;
+
+    if (enc == 0)
+        return &bkt->lrb_wire;
+
+    copy = &bkt->lrb_enc[enc - 1];
+
+    if (*copy == NULL && !(bkt->lrb_enc_failed & (1 << enc))) {
+        if (enc & RPC_ENQ_ZLIB) {
+#ifdef HAVE_LIBZ
+            /* Compress the records, encoded by columns if need be */
+            base = rec_bucket_wire(env, bkt, enc & ~RPC_ENQ_ZLIB);
+            if (base->bw_rpc.pr_flags == (enc & ~RPC_ENQ_ZLIB))
+                *copy = rec_compress(env, &base->bw_rpc,
+                                     rec_bucket_wire_len(bkt, base));
+#endif
+        } else {
+            *copy = rec_columns(env, &bkt->lrb_wire.bw_rpc, bkt->lrb_size);
+        }
 
-    /* Has the first non-ack'ed bucket expired? */
-    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
-    if (now.tv_sec > bkt->lrb_expiry.tv_sec) {
-        list_foreach_entry(tmp, &bkt->lrb_node, lrb_node) {
-            if (tmp == env->re_deliver_next)
-                break;
-            lcap_debug("Marking bucket #%ld at %p non ready",
-                       tmp->lrb_index, tmp);
-            tmp->lrb_ready = false;
+        if (*copy == NULL) {
+            bkt->lrb_enc_failed |= 1 << enc;
+        } else {
+            /* Pinned as long as the bucket is */
+            bkt->lrb_enc_bytes += sizeof(**copy) + (*copy)->bw_capacity;
+            reader_charge(env, sizeof(**copy) + (*copy)->bw_capacity);
         }
-        env->re_deliver_next = bkt;
-    } else {
-        bkt = env->re_deliver_next;
-        if (bkt == NULL)
-            return NULL;
     }
 
-    env->re_deliver_next = bucket_next(env->re_deliver_next);
-    return bkt;
-}
-
-/**
- * Release a bucket and all records it contains.
- */
-static void rec_bucket_destroy(struct lcap_rec_bucket *bkt)
-{
-    int i;
+    if (*copy != NULL)
+        return *copy;
 
-    for (i = 0; i < bkt->lrb_rec_count; i++) {
-        lcap_debug("Destroying record %lld at %p",
-                   bkt->lrb_records[i]->cr_index, bkt->lrb_records[i]);
-        llapi_changelog_free(&bkt->lrb_records[i]);
+    /* Columns without compression beat compression alone */
+    if ((enc & RPC_ENQ_ZLIB) && (enc & RPC_ENQ_COLUMNAR)) {
+        base = rec_bucket_wire(env, bkt, RPC_ENQ_COLUMNAR);
+        if (base != &bkt->lrb_wire)
+            return base;
     }
 
-    lcap_debug("Destroying bucket #%ld at %p", bkt->lrb_index, bkt);
-    free(bkt);
+    return rec_bucket_wire(env, bkt, enc & RPC_ENQ_COLUMNAR ?
+                                     enc & ~RPC_ENQ_COLUMNAR : 0);
 }
 
 /**
- * Get the highest index contained in a bucket.
+ * Send an ENQUEUE message carrying \a size bytes of records, which belongs to
+ * ZMQ from now on. Legacy clients get the records behind a header of their own
+ * layout, in a frame of its own, so that they are not copied either.
  */
-static long long rec_bucket_max_index(const struct lcap_rec_bucket *bkt)
+static int enqueue_send(struct reader_env *env, const struct client_state *cs,
+                        struct px_rpc_enqueue *rpc, size_t size,
+                        zmq_free_fn *ffn, void *hint)
 {
-    if (bkt->lrb_rec_count == 0)
-        return -1;
+    struct px_rpc_enqueue_v0    legacy;
+
+    if (cs->cs_version > 0)
+        return peer_rpc_send_zc(env->re_sock, NULL, cs->cs_ident, rpc,
+                                sizeof(*rpc) + size, ffn, hint);
 
-    return bkt->lrb_records[bkt->lrb_rec_count - 1]->cr_index;
+    memset(&legacy, 0, sizeof(legacy));
+    legacy.pr_hdr.op_type = RPC_OP_ENQUEUE;
+    legacy.pr_count = rpc->pr_count;
+
+    return peer_rpc_send_zc_hdr(env->re_sock, NULL, cs->cs_ident, &legacy,
+                                sizeof(legacy), rpc, sizeof(*rpc),
+                                sizeof(*rpc) + size, ffn, hint);
 }
 
 /**
- * Insert a new changelog_record into the reader's cache.
+ * Deliver a RPC_OP_ENQUEUE message to a client. The bucket arena (or its
+ * encoded copy) is handed to ZMQ as is, and cannot be reused until it has
+ * been sent.
  */
-static int changelog_reader_rec_store(struct reader_env *env,
-                                      struct changelog_rec *rec)
+static int enqueue_rec(struct reader_env *env, struct lcap_rec_bucket *bkt,
+                       const struct client_state *cs)
 {
-    struct lcap_rec_bucket  *current = env->re_current_open;
-    int                      batch_size;
-    int                      idx;
-    int                      rc;
+    struct bucket_wire  *wire = rec_bucket_wire(env, bkt, cs->cs_encoding);
+    size_t               size = rec_bucket_wire_len(bkt, wire);
+    int                  rc;
 
-    batch_size = env->re_cfg->ccf_rec_batch_count;
-    if (current == NULL || current->lrb_rec_count == batch_size) {
-        rc = rec_bucket_add(env);
-        if (rc)
-            return rc;
-        current = env->re_current_open;
-    }
+    __atomic_add_fetch(&wire->bw_refcount, 1, __ATOMIC_RELAXED);
 
-    assert(current != NULL);
-    assert(current->lrb_rec_count < batch_size);
+    lcap_verb("Sending %d records to client", bkt->lrb_rec_count);
+    rc = enqueue_send(env, cs, &wire->bw_rpc, size, bucket_wire_put, env);
+    if (rc == 0) {
+        env->re_stats.rs_rec_sent   += bkt->lrb_rec_count;
+        env->re_stats.rs_bytes_sent += size;
+    }
 
-    idx = current->lrb_rec_count++;
-    current->lrb_records[idx] = rec;
-    current->lrb_size += changelog_rec_size(rec) + rec->cr_namelen;
-    lcap_debug("Inserted record #%llu into current bucket at %d",
-               rec->cr_index, idx);
-    return 0;
+    return rc;
 }
 
-/**
- * Get the client descriptor for the peer identified by \a cid. For this
- * function to succeed and not return NULL, the corresponding peer must
- * have registered itself using RPC_OP_START already.
- *
- * XXX This O(N) complexity is miserable here.
- */
-static struct client_state *client_state_get(struct reader_env *env,
-                                             const struct conn_id *cid)
+static inline bool client_filter_active(const struct client_state *cs)
 {
-    struct list_node    *lnode;
-    struct conn_id      *cid_curr;
-    struct client_state *cs;
+    return cs->cs_type_mask != 0 || cs->cs_flags_mask != 0 ||
+           cs->cs_filter != NULL;
+}
 
-    for (lnode = env->re_peers.l_first; lnode != NULL; lnode = lnode->ln_next) {
-        cs = list_entry(lnode, struct client_state, cs_node);
-        cid_curr = cs->cs_ident;
+static inline bool client_filter_match(const struct client_state *cs,
+                                       const struct changelog_rec *rec)
+{
+    if ((long long)rec->cr_index < cs->cs_group->cg_start)
+        return false;
 
-        if (cid_curr->ci_length != cid->ci_length)
-            continue;
+    if (cs->cs_type_mask != 0 && rec->cr_type < 64 &&
+        !(cs->cs_type_mask & (1ULL << rec->cr_type)))
+        return false;
 
-        if (memcmp(cid_curr->ci_data, cid->ci_data, cid->ci_length) == 0)
-            return cs;
-    }
+    if (cs->cs_flags_mask != 0 && !(cs->cs_flags_mask & rec->cr_flags))
+        return false;
 
-    return NULL;
+    return cs->cs_filter == NULL || rec_filter_match(cs->cs_filter, rec);
 }
 
 /**
- * Free resources associated to a client state. It is assumed that the structure
- * has already been unlinked from list.
+ * ZMQ free callback for filtered messages, which belong to nobody else.
  */
-static void client_state_release(struct client_state *cs)
+static void filtered_wire_put(void *data, void *hint)
 {
-    free(cs->cs_ident);
-    free(cs);
+    free(data);
 }
 
 /**
- * Process START message from client. Registration consists in creating a new
- * client state structure and replying OK.
+ * Deliver a RPC_OP_ENQUEUE message carrying the records of \a bkt which match
+ * the filter of \a cs. They get copied to a message of their own, released by
+ * ZMQ once sent. The index of the last record sent is stored into \a last.
+ * Return 1 if no record matched, in which case nothing is sent.
  */
-static int reader_handle_start(struct reader_env *env,
-                               const struct lcapnet_request *req)
+static int enqueue_rec_filtered(struct reader_env *env,
+                                const struct lcap_rec_bucket *bkt,
+                                const struct client_state *cs,
+                                long long *last)
 {
-    struct px_rpc_register  *rpc = (struct px_rpc_register *)req->lr_body;
-    struct client_state     *cs;
-    int                      rc;
+    const struct px_rpc_enqueue *src = &bkt->lrb_wire.bw_rpc;
+    struct px_rpc_enqueue       *rpc = NULL;
+    struct bucket_wire          *wire = NULL;
+    const struct changelog_rec  *rec;
+    size_t                       rec_len;
+    size_t                       size = 0;
+    size_t                       off;
+    uint32_t                     count;
+    int                          rc;
+
+    for (off = 0; off < bkt->lrb_size; off += rec_len) {
+        rec = (const struct changelog_rec *)(src->pr_records + off);
+        rec_len = changelog_rec_size((struct changelog_rec *)rec) +
+                  rec->cr_namelen;
+
+        if (!client_filter_match(cs, rec))
+            continue;
 
-    if (req->lr_body_len < sizeof(*rpc)) {
-        lcap_error("Truncated START RPC of size %zd", req->lr_body_len);
-        return -EINVAL;
-    }
+        /* Allocated lazily, most buckets may not contain anything relevant */
+        if (rpc == NULL) {
+            rpc = malloc(sizeof(*rpc) + bkt->lrb_size - off);
+            if (rpc == NULL)
+                return -ENOMEM;
+
+            rpc_hdr_init(&rpc->pr_hdr, RPC_OP_ENQUEUE);
+            rpc->pr_count    = 0;
+            rpc->pr_flags    = 0;
+            rpc->pr_raw_len  = 0;
+            rpc->pr_reserved = 0;
+        }
 
-    cs = client_state_get(env, req->lr_forward);
-    if (cs != NULL) {
-        lcap_info("Received START RPC for already registered client");
-        return -EALREADY;
+        memcpy(rpc->pr_records + size, rec, rec_len);
+        size += rec_len;
+        rpc->pr_count++;
+        *last = rec->cr_index;
     }
 
-    cs = calloc(1, sizeof(*cs));
-    if (cs == NULL) {
-        rc = -ENOMEM;
-        lcap_error("Cannot initialize client context: %s", strerror(-rc));
-        return rc;
-    }
+    count = rpc != NULL ? rpc->pr_count : 0;
+    env->re_stats.rs_rec_filtered += bkt->lrb_rec_count - count;
+    if (count == 0)
+        return 1;
 
-    cs->cs_start = rpc->pr_start;
-    cs->cs_ident = conn_id_dup(req->lr_forward);
-    if (cs->cs_ident == NULL) {
-        free(cs);
-        rc = -ENOMEM;
-        lcap_error("Cannot populate client context: %s", strerror(-rc));
-        return rc;
+    env->re_stats.rs_bytes_copied += size;
+
+    /* Filtered messages are specific to a client, nothing worth caching */
+    if (cs->cs_encoding & RPC_ENQ_COLUMNAR) {
+        wire = rec_columns(env, rpc, size);
+        if (wire != NULL) {
+            free(rpc);
+            rpc  = &wire->bw_rpc;
+            size = wire->bw_capacity;
+        }
     }
 
-    list_append(&env->re_peers, &cs->cs_node);
+#ifdef HAVE_LIBZ
+    if (cs->cs_encoding & RPC_ENQ_ZLIB) {
+        struct bucket_wire  *zwire = rec_compress(env, rpc, size);
 
-    rc = ack_retcode(env->re_sock, NULL, req->lr_forward, 0);
-    if (rc < 0) {
-        lcap_error("Cannot ACK: %s", zmq_strerror(-rc));
-        return rc;
+        if (zwire != NULL) {
+            if (wire != NULL)
+                free(wire);
+            else
+                free(rpc);
+
+            wire = zwire;
+            rpc  = &wire->bw_rpc;
+            size = wire->bw_capacity;
+        }
     }
+#endif
+
+    /* The message belongs to ZMQ from now on, even upon failure */
+    lcap_verb("Sending %u out of %d records to client", count,
+              bkt->lrb_rec_count);
+    rc = enqueue_send(env, cs, rpc, size,
+                      wire != NULL ? encoded_wire_put : filtered_wire_put,
+                      NULL);
+    if (rc < 0)
+        return rc;
 
-    lcap_info("Registered new client for %s", reader_device(env));
+    env->re_stats.rs_rec_sent   += count;
+    env->re_stats.rs_bytes_sent += size;
     return 0;
 }
 
-static void bucket_set_expiry_time(struct lcap_rec_bucket *bkt)
+/**
+ * Account the delivery latency of a bucket, upon its first delivery to any
+ * group. All its records are accounted as old as the oldest one, which is
+ * exact for the small buckets sealed at the end of the stream.
+ */
+static void reader_account_latency(struct reader_env *env,
+                                   const struct lcap_rec_bucket *bkt)
 {
-    clock_gettime(CLOCK_MONOTONIC_COARSE, &bkt->lrb_expiry);
-    bkt->lrb_expiry.tv_sec += ACK_TIMEOUT_MSEC / 1000;
+    struct reader_stats *rstats = &env->re_stats;
+    struct timespec      now;
+    uint64_t             now_msec;
+    long                 latency;
+    int                  slot = 0;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    now_msec = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    /* Clocks of the MDS and of this node may differ slightly */
+    latency = now_msec > bkt->lrb_min_time ? now_msec - bkt->lrb_min_time : 0;
+
+    while (slot < LAT_HIST_SLOTS - 1 && (1L << slot) <= latency)
+        slot++;
+
+    rstats->rs_lat_hist[slot] += bkt->lrb_rec_count;
+    if (latency > rstats->rs_lat_max)
+        rstats->rs_lat_max = latency;
 }
 
 /**
- * Pack and deliver a RPC_OP_ENQUEUE message to a client.
+ * Hand the next available bucket over to a client and send it. Buckets without
+ * any record matching the client filter are acknowledged on its behalf, and
+ * the next one is tried.
+ * Return 1 if no bucket was available.
  */
-static int enqueue_rec(struct reader_env *env, struct client_state *cs,
-                       const struct lcapnet_request *req)
+static int rec_bucket_deliver(struct reader_env *env, struct client_state *cs)
 {
-    struct px_rpc_enqueue   *rpc;
-    size_t                   rpc_size;
-    uint8_t                 *rpc_next_rec;
-    int                      i;
+    struct consumer_group   *grp = cs->cs_group;
+    struct lcap_rec_bucket  *bkt;
+    struct bucket_lease     *lease;
+    long long                last;
     int                      rc;
 
-    rpc_size = sizeof(*rpc) + cs->cs_bucket->lrb_size;
-    rpc = calloc(1, rpc_size);
-    if (rpc == NULL)
-        return -ENOMEM;
+    for (;;) {
+        bkt = rec_bucket_get(env, grp);
+        if (bkt == NULL)
+            return 1;   /* EOF */
 
-    rpc->pr_hdr.op_type = RPC_OP_ENQUEUE;
-    rpc->pr_count       = cs->cs_bucket->lrb_rec_count;
+        if (!bkt->lrb_delivered) {
+            reader_account_latency(env, bkt);
+            bkt->lrb_delivered = true;
+        }
 
-    rpc_next_rec = rpc->pr_records;
-    for (i = 0; i < rpc->pr_count; i++) {
-        struct changelog_rec    *rec = cs->cs_bucket->lrb_records[i];
-        size_t                   copy_len = changelog_rec_size(rec) +
-                                            rec->cr_namelen;
+        lease = rec_lease_lookup(env, grp, bkt->lrb_index);
+        last  = rec_bucket_max_index(bkt);
 
-        memcpy(rpc_next_rec, rec, copy_len);
-        rpc_next_rec += copy_len;
-    }
+        /* A start time no bucket had reached resolves on the first one that
+         * does */
+        if (grp->cg_start_time > 0 && bkt->lrb_max_time >= grp->cg_start_time) {
+            grp->cg_start = rec_bucket_seek_time(bkt, grp->cg_start_time);
+            grp->cg_start_time = 0;
+        }
+
+        /* Buckets before the start record are skipped for the whole group,
+         * the one holding it is sent from there on */
+        if (grp->cg_start_time > 0 || last < grp->cg_start) {
+            env->re_stats.rs_rec_filtered += bkt->lrb_rec_count;
+            rc = 1;
+        } else if (!client_filter_active(cs) &&
+                   rec_bucket_min_index(bkt) >= grp->cg_start) {
+            rc = enqueue_rec(env, bkt, cs); /* There you go! */
+        } else {
+            rc = enqueue_rec_filtered(env, bkt, cs, &last);
+        }
+
+        if (rc != 1)
+            break;
 
-    bucket_set_expiry_time(cs->cs_bucket);
+        /* Members select the same records, none of them wants any */
+        lcap_debug("Nothing to send from bucket #%ld, acknowledging it",
+                   bkt->lrb_index);
+        lease->bl_owner = NULL;
+        lease->bl_state = BKT_READY;
+        consumer_group_advance(env, grp);
+    }
 
-    lcap_verb("Sending %d records to client", cs->cs_bucket->lrb_rec_count);
-    rc = peer_rpc_send(env->re_sock, NULL, req->lr_forward, (const char *)rpc,
-                       rpc_size);
+    /* From now on, this bucket belongs to the corresponding client within
+     * its group, until ack or timeout occurs */
+    cs->cs_held[cs->cs_nheld].bh_index = bkt->lrb_index;
+    cs->cs_held[cs->cs_nheld].bh_last  = last;
+    cs->cs_nheld++;
+    lease->bl_index = bkt->lrb_index;
+    lease->bl_owner = cs;
+    lease->bl_state = BKT_LEASED;
+    tw_arm(&env->re_leases, &lease->bl_timer, cs->cs_ack_timeout);
 
-    free(rpc);
     return rc;
 }
 
+/**
+ * Push available buckets to streaming clients, as long as they have credits
+ * left and their group has buckets to deliver. Clients get served in turn.
+ */
+static int changelog_reader_push(struct reader_env *env)
+{
+    struct list_node        *lnode;
+    struct client_state     *cs;
+    int                      idle = 0;
+    int                      rc;
+
+    while (idle < env->re_streams.l_count) {
+        lnode = list_pop_head(&env->re_streams);
+        list_append(&env->re_streams, lnode);
+
+        cs = list_entry(lnode, struct client_state, cs_stream_node);
+        if (cs->cs_nheld >= cs->cs_credits) {
+            idle++;
+            continue;
+        }
+
+        rc = rec_bucket_deliver(env, cs);
+        if (rc < 0)
+            return rc;
+
+        /* Other groups may still have buckets to deliver */
+        idle = rc == 0 ? 0 : idle + 1;
+    }
+
+    return 0;
+}
+
 /**
  * Process a request for records from client. If valid, and if records are
  * currently available, they will be delivered immediately.
@@ -620,8 +3180,6 @@ static int reader_handle_dequeue(struct reader_env *env,
 {
     struct px_rpc_dequeue   *rpc = (struct px_rpc_dequeue *)req->lr_body;
     struct client_state     *cs;
-    struct lcap_rec_bucket  *bkt;
-    int                      rc;
 
     if (req->lr_body_len < sizeof(*rpc)) {
         lcap_error("Truncated DEQUEUE RPC, ignoring");
@@ -634,32 +3192,21 @@ static int reader_handle_dequeue(struct reader_env *env,
         return -EPROTO;
     }
 
-    if (cs->cs_bucket != NULL) {
-        lcap_info("Client did not acknowledge bucket #%llu",
-                  cs->cs_bucket->lrb_index);
+    if (cs->cs_nheld >= cs->cs_credits) {
+        lcap_info("Client did not acknowledge any of its %u buckets",
+                  cs->cs_nheld);
         return -EPROTO;
     }
 
-    bkt = rec_bucket_get(env);
-    if (bkt == NULL)
-        return 1;   /* EOF */
-
-    /* we're about to deliver a non-full bucket */
-    if (bkt == env->re_current_open) {
-        rc = rec_bucket_add(env);
-        if (rc)
-            return rc;
-    }
-
-    /* From now on, this bucket belongs to the corresponding client,
-     * until ack or timeout occurs */
-    cs->cs_bucket = bkt;
+    changelog_reader_collect(env);
 
-    return enqueue_rec(env, cs, req); /* There you go! */
+    return rec_bucket_deliver(env, cs);
 }
 
 /**
- * Process RPC_OP_CLEAR request.
+ * Process RPC_OP_CLEAR request. All the buckets held by the client and whose
+ * records are up to the requested index (or all of them for index 0) are
+ * acknowledged.
  */
 static int reader_handle_clear(struct reader_env *env,
                                const struct lcapnet_request *req)
@@ -667,10 +3214,9 @@ static int reader_handle_clear(struct reader_env *env,
     struct px_rpc_clear     *rpc = (struct px_rpc_clear *)req->lr_body;
     struct client_state     *cs;
     struct lcap_rec_bucket  *bkt;
-    struct lcap_rec_bucket  *next;
-    const char              *cli = env->re_cfg->ccf_clreader;
-    const char              *dev = reader_device(env);
-    int                      rc;
+    struct bucket_lease     *lease;
+    unsigned int             acked = 0;
+    unsigned int             i = 0;
 
     if (req->lr_body_len < sizeof(*rpc)) {
         lcap_error("Truncated CLEAR RPC of size %zd", req->lr_body_len);
@@ -683,40 +3229,48 @@ static int reader_handle_clear(struct reader_env *env,
         return -EPROTO;
     }
 
-    if (cs->cs_bucket == NULL) {
-        lcap_info("No bucket associated to context, nothing to clear");
-        return 0;   /* Fine... */
-    }
+    while (i < cs->cs_nheld) {
+        /* Filtered out records are acknowledged along with the last one
+         * actually sent */
+        bkt = rec_bucket_lookup(env, cs->cs_held[i].bh_index);
+        if (bkt != NULL && rpc->pr_index != 0 &&
+            cs->cs_held[i].bh_last > rpc->pr_index) {
+            i++;
+            continue;
+        }
 
-    bkt = cs->cs_bucket;
-    cs->cs_bucket = NULL;
+        /* Either acknowledged now or cleared already */
+        client_state_unhold(cs, i);
+        if (bkt == NULL)
+            continue;
 
-    /* Mark the record as "cleanable" */
-    bkt->lrb_ready = true;
+        lease = rec_lease_lookup(env, cs->cs_group, bkt->lrb_index);
+        if (lease->bl_state == BKT_READY)
+            continue;
 
-    list_foreach_entry(bkt, &env->re_cleanup_next->lrb_node, lrb_node) {
-        if (!bkt->lrb_ready)
-            break;
+        /* Late acknowledgements remain valid: the records have been
+         * processed, even if the lease expired or the bucket was sent to
+         * another member of the group. */
+        rec_lease_drop(env, lease);
 
-        env->re_cleanup_next = bkt;
+        /* Mark the record as "cleanable" for this group */
+        lease->bl_state = BKT_READY;
+        acked++;
+    }
 
-        lcap_verb("About to acknowledge bucket #%ld (up to record %lld)",
-                  bkt->lrb_index, rec_bucket_max_index(bkt));
+    if (acked == 0) {
+        lcap_info("No bucket associated to context, nothing to clear");
+        goto out_ack;
+    }
 
-        rc = llapi_changelog_clear(dev, cli, rec_bucket_max_index(bkt));
-        if (rc < 0) {
-            lcap_error("Cannot clear changelog records "
-                        "(device='%s', reader='%s', rec=%lld): %s",
-                        dev, cli, rec_bucket_max_index(bkt), strerror(-rc));
-            return rc;
-        }
+    consumer_group_advance(env, cs->cs_group);
 
-        list_remove(&env->re_buckets, &bkt->lrb_node);
-        env->re_rec_cnt -= bkt->lrb_rec_count;
-        rec_bucket_destroy(bkt);
-    }
+out_ack:
+    /* Streaming clients do not wait for acknowledgements */
+    if (cs->cs_stream)
+        return 0;
 
-    return ack_retcode(env->re_sock, NULL, req->lr_forward, 0);
+    return ack_retcode(env->re_sock, NULL, req->lr_forward, RPC_OP_CLEAR, 0);
 }
 
 /**
@@ -726,8 +3280,11 @@ static int reader_handle_clear(struct reader_env *env,
 static int reader_handle_fini(struct reader_env *env,
                               const struct lcapnet_request *req)
 {
-    struct px_rpc_fini *rpc = (struct px_rpc_fini *)req->lr_body;
-    struct client_state *cs;
+    struct px_rpc_fini      *rpc = (struct px_rpc_fini *)req->lr_body;
+    struct client_state     *cs;
+    struct consumer_group   *grp;
+    struct bucket_lease     *lease;
+    unsigned int             i;
 
     if (req->lr_body_len < sizeof(*rpc)) {
         lcap_error("Truncated FINI RPC of size %zd", req->lr_body_len);
@@ -740,10 +3297,40 @@ static int reader_handle_fini(struct reader_env *env,
         return -EPROTO;
     }
 
-    list_remove(&env->re_peers, &cs->cs_node);
+    grp = cs->cs_group;
+
+    /* No need to wait for the leases to expire, redeliver at once to the
+     * other members of the group */
+    for (i = 0; i < cs->cs_nheld && !grp->cg_private; i++) {
+        if (rec_bucket_lookup(env, cs->cs_held[i].bh_index) == NULL)
+            continue;
+
+        lease = rec_lease_lookup(env, grp, cs->cs_held[i].bh_index);
+        if (lease->bl_owner != cs)
+            continue;
+
+        rec_lease_drop(env, lease);
+        lease->bl_state = BKT_EXPIRED;
+        list_append(&grp->cg_redeliver, &lease->bl_node);
+    }
+
+    if (cs->cs_stream)
+        list_remove(&env->re_streams, &cs->cs_stream_node);
+
+    client_table_remove(&env->re_clients, cs);
     client_state_release(cs);
+    grp->cg_members--;
+
+    /* Nobody else waits for the records a broadcast client did not ack */
+    if (grp->cg_private) {
+        consumer_group_destroy(env, grp);
+        changelog_reader_cleanup(env);
+    } else if (grp->cg_members == 0 && env->re_cfg->ccf_group_expiry > 0) {
+        grp->cg_expiry = tw_clock_msec() +
+                         (uint64_t)env->re_cfg->ccf_group_expiry * 1000;
+    }
     lcap_info("Deregistered client for %s", reader_device(env));
-    return ack_retcode(env->re_sock, NULL, req->lr_forward, 0);
+    return ack_retcode(env->re_sock, NULL, req->lr_forward, RPC_OP_FINI, 0);
 }
 
 /**
@@ -804,7 +3391,8 @@ out_reply:
 
     /* Error or DEQUEUE EOF */
     if (rc < 0 || rc == 1)
-        rc = ack_retcode(env->re_sock, NULL, req->lr_forward, rc);
+        rc = ack_retcode(env->re_sock, NULL, req->lr_forward,
+                         hlen < sizeof(*hdr) ? RPC_OP_ACK : hdr->op_type, rc);
 
     return rc;
 }
@@ -815,16 +3403,42 @@ out_reply:
 static int changelog_reader_serve(struct reader_env *env)
 {
     int             rc;
-    int             timeout = env->re_clpriv ? 50 : 1000;
-    zmq_pollitem_t  itm[] = {{env->re_sock, 0, ZMQ_POLLIN, 0}};
+    int             timeout;
+    int             expiry;
+    eventfd_t       val;
+    zmq_pollitem_t  itm[] = {{env->re_sock, 0, ZMQ_POLLIN, 0},
+                             {NULL, env->re_serve_fd, ZMQ_POLLIN, 0}};
+
+    /* Pick up newly sealed buckets and give back the ones sent meanwhile */
+    changelog_reader_collect(env);
+    if (bucket_pool_reclaim(&env->re_pool))
+        reader_wakeup(env->re_ingest_fd);
+
+    /* Expire leases as they are due, not only upon DEQUEUE, and groups */
+    rec_lease_expire(env);
+    expiry = consumer_group_expire(env);
+
+    rc = changelog_reader_push(env);
+    if (rc < 0)
+        return rc;
+
+    /* Sleep until a request comes in, buckets get sealed or released by ZMQ,
+     * or a lease or a group expires */
+    timeout = tw_timeout(&env->re_leases);
+    if (expiry >= 0 && (timeout < 0 || expiry < timeout))
+        timeout = expiry;
 
-    rc = zmq_poll(itm, 1, timeout);
+    rc = zmq_poll(itm, 2, timeout);
     if (rc <= 0) {
         //lcap_debug("Nothing received (%s)", zmq_strerror(rc));
         return rc;
     }
 
-    assert(itm[0].revents & ZMQ_POLLIN);
+    if (itm[1].revents & ZMQ_POLLIN)
+        eventfd_read(env->re_serve_fd, &val);
+
+    if (!(itm[0].revents & ZMQ_POLLIN))
+        return 0;
 
     rc = lcap_rpc_recv(env->re_sock, LCAP_RECV_NONBLOCK | LCAP_RECV_NO_ENVELOPE,
                        changelog_reader_rpc_hdl, env);
@@ -837,6 +3451,7 @@ static int changelog_reader_serve(struct reader_env *env)
 
 /**
  * Enqueue records using the (unfortunately) blocking LLAPI interface.
+ * Return the number of records read, or a negative error code.
  */
 static int changelog_reader_enqueue(struct reader_env *env)
 {
@@ -847,8 +3462,28 @@ static int changelog_reader_enqueue(struct reader_env *env)
     struct changelog_rec    *rec;
     int                      rc;
 
-    if (changelog_reader_full(env))
-        return 0;
+    env->re_tail_fd = -1;
+
+    /* Retry handing over a bucket that got full while the serving thread
+     * was lagging behind */
+    if (env->re_open != NULL && rec_bucket_full(env, env->re_open)) {
+        rc = changelog_reader_seal(env);
+        if (rc && rc != -EAGAIN)
+            return rc;
+    }
+
+    /* Spilled records come first */
+    if (segment_log_enabled(&env->re_spill)) {
+        rc = changelog_reader_reload(env);
+        if (rc)
+            return rc;
+    }
+
+    /* Hand what has been read over to clients, so that the budget frees up */
+    if (changelog_reader_full(env)) {
+        rc = changelog_reader_seal(env);
+        return rc == -EAGAIN ? 0 : rc;
+    }
 
     batch_size = env->re_cfg->ccf_rec_batch_count;
 
@@ -862,70 +3497,169 @@ static int changelog_reader_enqueue(struct reader_env *env)
         }
     }
 
-    while ((rc = llapi_changelog_recv(env->re_clpriv, &rec)) == 0) {
-        if (TerminateSig)
+    for (;;) {
+        /* Records are only read once there is a bucket to store them */
+        if (env->re_open == NULL) {
+            rc = rec_bucket_open(env);
+            if (rc)
+                break;
+        }
+
+        rc = llapi_changelog_recv(env->re_clpriv, &rec);
+        if (rc || TerminateSig)
             break;
 
-        if (rec->cr_index < env->re_srec)
+        if (rec->cr_index < env->re_srec) {
+            llapi_changelog_free(&rec);
             continue;
+        }
+
+        env->re_srec = rec->cr_index + 1;
 
         rc = changelog_reader_rec_store(env, rec);
         if (rc)
             break;
 
-        env->re_srec = rec->cr_index + 1;
         env->re_stats.rs_rec_read++;
-        env->re_rec_cnt++;
         batch_count++;
 
         if (batch_count >= batch_size || changelog_reader_full(env))
             break;
     }
 
-    /* EOF: llapi_changelog_start() needed on next iteration. */
+    /* End of the stream: do not keep clients waiting for more records to fill
+     * the open bucket */
     if (rc == 1 || rc == -EAGAIN || rc == -EPROTO) {
+#ifdef HAVE_LLAPI_CHANGELOG_GET_FD
+        /* Changelog devices opened without blocking keep following the
+         * changelog, and their descriptor tells when more records come */
+        if (rc == -EAGAIN)
+            env->re_tail_fd = llapi_changelog_get_fd(env->re_clpriv);
+#endif
+        /* EOF otherwise: llapi_changelog_start() needed on next iteration */
+        if (env->re_tail_fd < 0) {
+            llapi_changelog_fini(&env->re_clpriv);
+            env->re_clpriv = NULL;
+        }
+
+        rc = changelog_reader_seal(env);
+        if (rc == -EAGAIN)
+            rc = 0;
+    }
+
+    /* Buckets get recycled as clients acknowledge them */
+    if (rc == -ENOBUFS)
+        rc = 0;
+
+    lcap_verb("Enqueued %d records from %s", batch_count, reader_device(env));
+    return rc < 0 ? rc : batch_count;
+}
+
+/**
+ * Ingestion thread entry point. Feed the serving thread with sealed buckets
+ * until told to stop.
+ */
+static void *changelog_reader_ingest(void *args)
+{
+    struct reader_env   *env = (struct reader_env *)args;
+    int                  backoff = EOF_RETRY_MIN_MSEC;
+    int                  rc = 0;
+
+    while (!TerminateSig && !__atomic_load_n(&env->re_stop, __ATOMIC_ACQUIRE)) {
+        rc = changelog_reader_enqueue(env);
+        if (rc < 0)
+            break;
+
+        if (rc > 0) {
+            backoff = EOF_RETRY_MIN_MSEC;
+            continue;
+        }
+
+        /* Nothing read: wait for records to come, buckets to be cleared or
+         * memory to be given back. Poll for records when the changelog cannot
+         * tell. */
+        if (env->re_clpriv != NULL) {
+            changelog_reader_wait(env);
+        } else {
+            reader_wait(env->re_ingest_fd, backoff);
+            backoff = backoff * 2 > EOF_RETRY_MAX_MSEC ? EOF_RETRY_MAX_MSEC :
+                                                         backoff * 2;
+        }
+    }
+
+    if (env->re_clpriv != NULL) {
         llapi_changelog_fini(&env->re_clpriv);
         env->re_clpriv = NULL;
     }
 
-    lcap_verb("Enqueued %d records from %s", batch_count, reader_device(env));
-    return rc;
+    /* Let the serving thread know that we are gone for good */
+    if (rc < 0) {
+        __atomic_store_n(&env->re_worker_rc, rc, __ATOMIC_RELEASE);
+        reader_wakeup(env->re_serve_fd);
+    }
+
+    return NULL;
 }
 
 /**
  * Changelog reader entry point.
- * Initialize context accordingly, then switch between remote messages
- * processing and local caching of changelog records. Both operations cannot
- * (easily) be put in a single event loop because of the LLAPI changelog
- * interface being blocking...
+ * Initialize context accordingly, spawn the ingestion thread, and process
+ * remote messages until termination. Both operations cannot (easily) be put
+ * in a single event loop because of the LLAPI changelog interface being
+ * blocking...
  */
 void *reader_main(void *args)
 {
     struct subtask_args *sa = (struct subtask_args *)args;
     struct reader_env    env;
+    bool                 ingesting = false;
+    bool                 clearing = false;
     int                  rc;
 
     rc = changelog_reader_init(sa->sa_cfg, sa->sa_idx, &env);
     if (rc)
         goto out;
 
+    rc = -pthread_create(&env.re_clear, NULL, changelog_clear_main, &env);
+    if (rc) {
+        lcap_error("Cannot start clear thread: %s", strerror(-rc));
+        goto out;
+    }
+
+    clearing = true;
+
+    rc = -pthread_create(&env.re_ingest, NULL, changelog_reader_ingest, &env);
+    if (rc) {
+        lcap_error("Cannot start ingestion thread: %s", strerror(-rc));
+        goto out;
+    }
+
+    ingesting = true;
+
     rc = changelog_reader_signal(&env, 0);
     if (rc)
         goto out;
 
     while (!TerminateSig) {
-        /* Enqueue records, if possible */
-        rc = changelog_reader_enqueue(&env);
+        rc = __atomic_load_n(&env.re_worker_rc, __ATOMIC_ACQUIRE);
         if (rc < 0)
             break;
 
-        /* Serve workers for 50ms (or 1s if EOF was reached) */
         rc = changelog_reader_serve(&env);
         if (rc < 0)
             break;
     }
 
 out:
+    if (ingesting) {
+        __atomic_store_n(&env.re_stop, true, __ATOMIC_RELEASE);
+        reader_wakeup(env.re_ingest_fd);
+        pthread_join(env.re_ingest, NULL);
+    }
+
+    if (clearing)
+        changelog_clear_stop(&env);
+
     lcap_debug("ChangeLog reader #%d stopping with rc=%d: %s",
                sa->sa_idx, rc, zmq_strerror(-rc));
 
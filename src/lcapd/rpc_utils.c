@@ -20,29 +20,44 @@
  */
 
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "lcapd_internal.h"
 
 
-int peer_rpc_send(void *sock, const struct conn_id *src_id,
-                  const struct conn_id *dst_id, const char *msg, size_t msg_len)
+/**
+ * Send the routing envelope preceding an RPC body.
+ */
+static int peer_rpc_send_envelope(void *sock, const struct conn_id *src_id,
+                                  const struct conn_id *dst_id)
 {
     int rc;
 
     if (src_id != NULL) {
         rc = zmq_send(sock, src_id->ci_data, src_id->ci_length, ZMQ_SNDMORE);
         if (rc < 0)
-            goto err_out;
+            return rc;
 
         rc = zmq_send(sock, "", 0, ZMQ_SNDMORE);
         if (rc < 0)
-            goto err_out;
+            return rc;
     }
 
     rc = zmq_send(sock, dst_id->ci_data, dst_id->ci_length, ZMQ_SNDMORE);
     if (rc < 0)
-        goto err_out;
+        return rc;
 
-    rc = zmq_send(sock, "", 0, ZMQ_SNDMORE);
+    return zmq_send(sock, "", 0, ZMQ_SNDMORE);
+}
+
+int peer_rpc_send(void *sock, const struct conn_id *src_id,
+                  const struct conn_id *dst_id, const char *msg, size_t msg_len)
+{
+    int rc;
+
+    rc = peer_rpc_send_envelope(sock, src_id, dst_id);
     if (rc < 0)
         goto err_out;
 
@@ -60,15 +75,157 @@ err_out:
     return rc;
 }
 
+/**
+ * Same as peer_rpc_send() for the body of a request received with
+ * LCAP_RECV_FRAMES: its frames are handed over to ZMQ as they are, without
+ * copies. Neither them nor the body can be used afterwards.
+ */
+int peer_rpc_forward(void *sock, const struct conn_id *src_id,
+                     const struct conn_id *dst_id,
+                     const struct lcapnet_request *req)
+{
+    int i;
+    int rc;
+
+    rc = peer_rpc_send_envelope(sock, src_id, dst_id);
+    if (rc < 0)
+        goto err_out;
+
+    for (i = 0; i < req->lr_nframes; i++) {
+        rc = zmq_msg_send(&req->lr_frames[i], sock,
+                          i + 1 < req->lr_nframes ? ZMQ_SNDMORE : 0);
+        if (rc < 0)
+            goto err_out;
+    }
+
+    return 0;
+
+err_out:
+    rc = -errno;
+    lcap_error("Worker send error: %s", zmq_strerror(-rc));
+    return rc;
+}
+
+/**
+ * Same as peer_rpc_send() but hand \a msg over to ZMQ instead of copying it.
+ * \a ffn is invoked with \a msg and \a hint once ZMQ is done with the buffer,
+ * whether the message could be sent or not.
+ */
+int peer_rpc_send_zc(void *sock, const struct conn_id *src_id,
+                     const struct conn_id *dst_id, void *msg, size_t msg_len,
+                     zmq_free_fn *ffn, void *hint)
+{
+    zmq_msg_t   zmsg;
+    int         rc;
+
+    rc = zmq_msg_init_data(&zmsg, msg, msg_len, ffn, hint);
+    if (rc < 0) {
+        rc = -errno;
+        ffn(msg, hint);
+        lcap_error("Cannot initialize zmsg: %s", zmq_strerror(-rc));
+        return rc;
+    }
+
+    rc = peer_rpc_send_envelope(sock, src_id, dst_id);
+    if (rc < 0)
+        goto err_out;
+
+    rc = zmq_msg_send(&zmsg, sock, 0);
+    if (rc < 0)
+        goto err_out;
+
+    return 0;
+
+err_out:
+    rc = -errno;
+    zmq_msg_close(&zmsg);
+    lcap_error("Worker send error: %s", zmq_strerror(-rc));
+    return rc;
+}
+
+/**
+ * Release of the message sent by peer_rpc_send_zc_hdr(), whose frame starts
+ * within the message.
+ */
+struct zc_tail {
+    void            *zt_msg;
+    zmq_free_fn     *zt_ffn;
+    void            *zt_hint;
+};
+
+static void zc_tail_put(void *data, void *hint)
+{
+    struct zc_tail  *tail = (struct zc_tail *)hint;
+
+    tail->zt_ffn(tail->zt_msg, tail->zt_hint);
+    free(tail);
+}
+
+/**
+ * Same as peer_rpc_send_zc() but replace the first \a skip bytes of \a msg
+ * with \a hdr, copied to a frame of its own. The rest of \a msg is handed over
+ * to ZMQ. Receivers aggregate the frames.
+ */
+int peer_rpc_send_zc_hdr(void *sock, const struct conn_id *src_id,
+                         const struct conn_id *dst_id, const void *hdr,
+                         size_t hdr_len, void *msg, size_t skip,
+                         size_t msg_len, zmq_free_fn *ffn, void *hint)
+{
+    struct zc_tail  *tail;
+    zmq_msg_t        zmsg;
+    int              rc;
+
+    tail = malloc(sizeof(*tail));
+    if (tail == NULL) {
+        ffn(msg, hint);
+        lcap_error("Cannot initialize zmsg: %s", strerror(ENOMEM));
+        return -ENOMEM;
+    }
+
+    tail->zt_msg  = msg;
+    tail->zt_ffn  = ffn;
+    tail->zt_hint = hint;
+
+    rc = zmq_msg_init_data(&zmsg, (char *)msg + skip, msg_len - skip,
+                           zc_tail_put, tail);
+    if (rc < 0) {
+        rc = -errno;
+        zc_tail_put(NULL, tail);
+        lcap_error("Cannot initialize zmsg: %s", zmq_strerror(-rc));
+        return rc;
+    }
+
+    rc = peer_rpc_send_envelope(sock, src_id, dst_id);
+    if (rc < 0)
+        goto err_out;
+
+    rc = zmq_send(sock, hdr, hdr_len, ZMQ_SNDMORE);
+    if (rc < 0)
+        goto err_out;
+
+    rc = zmq_msg_send(&zmsg, sock, 0);
+    if (rc < 0)
+        goto err_out;
+
+    return 0;
+
+err_out:
+    rc = -errno;
+    zmq_msg_close(&zmsg);
+    lcap_error("Worker send error: %s", zmq_strerror(-rc));
+    return rc;
+}
+
 int ack_retcode(void *sock, const struct conn_id *src_id,
-                const struct conn_id *dst_id, int ret)
+                const struct conn_id *dst_id, enum rpc_op_type op, int ret)
 {
     struct px_rpc_ack   rep;
     int                 rc;
 
     memset(&rep, 0, sizeof(rep));
-    rep.pr_hdr.op_type = RPC_OP_ACK;
-    rep.pr_retcode     = ret;
+    rpc_hdr_init(&rep.pr_hdr, RPC_OP_ACK);
+    rep.pr_retcode = ret;
+    rep.pr_op      = op;
 
     rc = peer_rpc_send(sock, src_id, dst_id, (char *)&rep, sizeof(rep));
     if (rc < 0) {
@@ -0,0 +1,888 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "lcapd_internal.h"
+#include "segment.h"
+
+#define SEG_SUFFIX  ".seg"
+#define IDX_SUFFIX  ".idx"
+#define CKPT_NAME   "acked"
+
+static inline size_t seg_entry_size(size_t len)
+{
+    return sizeof(struct seg_entry) + ((len + 7) & ~(size_t)7);
+}
+
+/**
+ * Fletcher-like checksum, enough to tell torn or never written entries apart.
+ */
+static uint32_t seg_checksum(const void *buff, size_t len)
+{
+    const uint8_t   *p = buff;
+    uint32_t         a = 1;
+    uint32_t         b = 0;
+    uint32_t         w;
+    size_t           i;
+
+    for (i = 0; i + sizeof(w) <= len; i += sizeof(w)) {
+        memcpy(&w, p + i, sizeof(w));
+        a += w;
+        b += a;
+    }
+
+    for (; i < len; i++) {
+        a += p[i];
+        b += a;
+    }
+
+    return a ^ b;
+}
+
+static void segment_path(const struct segment_log *log, uint64_t seqno,
+                         const char *suffix, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%016" PRIx64 "%s", log->sl_dir, seqno, suffix);
+}
+
+/**
+ * Write \a iov to a new file named \a name, replacing any previous one
+ * atomically once on disk.
+ */
+static int segment_file_put(const struct segment_log *log, const char *name,
+                            const struct iovec *iov, int iovcnt)
+{
+    char    path[PATH_MAX];
+    char    tmp[PATH_MAX];
+    size_t  len = 0;
+    ssize_t n;
+    int     fd;
+    int     rc = 0;
+    int     i;
+
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    snprintf(path, sizeof(path), "%s/%s", log->sl_dir, name);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -errno;
+
+    n = writev(fd, iov, iovcnt);
+    if (n < 0 || fdatasync(fd))
+        rc = -errno;
+    else if ((size_t)n != len)
+        rc = -EIO;
+
+    close(fd);
+
+    if (rc == 0 && rename(tmp, path))
+        rc = -errno;
+
+    if (rc)
+        unlink(tmp);
+
+    return rc;
+}
+
+/**
+ * Read the file named \a name into a newly allocated buffer.
+ */
+static int segment_file_get(const struct segment_log *log, const char *name,
+                            void **buff, size_t *len)
+{
+    char        path[PATH_MAX];
+    struct stat st;
+    ssize_t     n;
+    int         fd;
+    int         rc = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", log->sl_dir, name);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    if (fstat(fd, &st)) {
+        rc = -errno;
+        goto out_close;
+    }
+
+    *len  = st.st_size;
+    *buff = malloc(*len + 1);
+    if (*buff == NULL) {
+        rc = -ENOMEM;
+        goto out_close;
+    }
+
+    n = read(fd, *buff, *len);
+    if (n < 0 || (size_t)n != *len) {
+        rc = n < 0 ? -errno : -EIO;
+        free(*buff);
+        *buff = NULL;
+    }
+
+out_close:
+    close(fd);
+    return rc;
+}
+
+static int segment_index_add(struct segment *seg, size_t off,
+                             const struct seg_entry *ent)
+{
+    struct seg_index_entry  *idx;
+
+    if (seg->sg_nentries == seg->sg_alloc) {
+        size_t alloc = seg->sg_alloc ? 2 * seg->sg_alloc : 64;
+
+        idx = realloc(seg->sg_index, alloc * sizeof(*idx));
+        if (idx == NULL)
+            return -ENOMEM;
+
+        seg->sg_index = idx;
+        seg->sg_alloc = alloc;
+    }
+
+    idx = &seg->sg_index[seg->sg_nentries++];
+    idx->sie_off       = off;
+    idx->sie_count     = ent->se_count;
+    idx->sie_len       = ent->se_len;
+    idx->sie_max_index = ent->se_max_index;
+    idx->sie_min_time  = ent->se_min_time;
+    idx->sie_max_time  = ent->se_max_time;
+    return 0;
+}
+
+/**
+ * Flush a complete segment and store its index, so that it does not need to
+ * be scanned on restart. Failing to write the index is not fatal.
+ */
+static int segment_index_write(struct segment_log *log, struct segment *seg)
+{
+    struct seg_index_hdr     hdr = {
+        .sih_magic  = SEG_INDEX_MAGIC,
+        .sih_sum    = seg_checksum(seg->sg_index,
+                                   seg->sg_nentries * sizeof(*seg->sg_index)),
+        .sih_seqno  = seg->sg_seqno,
+        .sih_tail   = seg->sg_tail,
+        .sih_count  = seg->sg_nentries,
+    };
+    struct iovec             iov[2] = {
+        {.iov_base = &hdr,          .iov_len = sizeof(hdr)},
+        {.iov_base = seg->sg_index,
+         .iov_len  = seg->sg_nentries * sizeof(*seg->sg_index)},
+    };
+    char                     name[32];
+    int                      rc;
+
+    if (seg->sg_indexed)
+        return 0;
+
+    /* The index must not refer to entries which are not on disk */
+    if (seg->sg_synced < seg->sg_tail) {
+        if (fdatasync(seg->sg_fd))
+            return -errno;
+
+        seg->sg_synced = seg->sg_tail;
+    }
+
+    snprintf(name, sizeof(name), "%016" PRIx64 IDX_SUFFIX, seg->sg_seqno);
+    rc = segment_file_put(log, name, iov, 2);
+    if (rc) {
+        lcap_info("Cannot store index '%s' in '%s', the segment will be "
+                  "scanned on restart: %s", name, log->sl_dir, strerror(-rc));
+        return 0;
+    }
+
+    seg->sg_indexed = true;
+    return 0;
+}
+
+/**
+ * Load the index of a segment, if there is a valid one.
+ */
+static int segment_index_read(struct segment_log *log, struct segment *seg)
+{
+    const struct seg_index_hdr  *hdr;
+    const struct seg_index_entry *idx;
+    long long                    max_index = log->sl_max_index;
+    char                         name[32];
+    void                        *buff;
+    size_t                       len;
+    size_t                       off = sizeof(struct seg_header);
+    size_t                       i;
+    int                          rc;
+
+    snprintf(name, sizeof(name), "%016" PRIx64 IDX_SUFFIX, seg->sg_seqno);
+    rc = segment_file_get(log, name, &buff, &len);
+    if (rc)
+        return rc;
+
+    hdr = buff;
+    idx = (const struct seg_index_entry *)(hdr + 1);
+    if (len < sizeof(*hdr) || hdr->sih_magic != SEG_INDEX_MAGIC ||
+        hdr->sih_seqno != seg->sg_seqno || hdr->sih_tail > seg->sg_size ||
+        hdr->sih_count != (len - sizeof(*hdr)) / sizeof(*idx) ||
+        (len - sizeof(*hdr)) % sizeof(*idx) != 0 ||
+        seg_checksum(idx, len - sizeof(*hdr)) != hdr->sih_sum) {
+        rc = -EINVAL;
+        goto out_free;
+    }
+
+    /* Entries must be consecutive and cover the segment up to its tail */
+    for (i = 0; i < hdr->sih_count; i++) {
+        if (idx[i].sie_off != off || idx[i].sie_max_index <= max_index) {
+            rc = -EINVAL;
+            goto out_free;
+        }
+
+        off += seg_entry_size(idx[i].sie_len);
+        max_index = idx[i].sie_max_index;
+    }
+
+    if (off != hdr->sih_tail || hdr->sih_count == 0) {
+        rc = -EINVAL;
+        goto out_free;
+    }
+
+    seg->sg_index = malloc(len - sizeof(*hdr));
+    if (seg->sg_index == NULL) {
+        rc = -ENOMEM;
+        goto out_free;
+    }
+
+    memcpy(seg->sg_index, idx, len - sizeof(*hdr));
+    seg->sg_nentries  = hdr->sih_count;
+    seg->sg_alloc     = hdr->sih_count;
+    seg->sg_tail      = hdr->sih_tail;
+    seg->sg_max_index = max_index;
+    seg->sg_indexed   = true;
+
+out_free:
+    free(buff);
+    return rc;
+}
+
+/**
+ * Store the last acknowledged record, so that entries up to it do not get
+ * delivered again on restart.
+ */
+static int segment_checkpoint(struct segment_log *log)
+{
+    struct seg_checkpoint    ckpt = {
+        .sc_magic   = SEG_CKPT_MAGIC,
+        .sc_acked   = log->sl_acked,
+    };
+    struct iovec             iov = {.iov_base = &ckpt,
+                                    .iov_len  = sizeof(ckpt)};
+
+    ckpt.sc_sum = seg_checksum(&ckpt.sc_acked, sizeof(ckpt.sc_acked));
+    return segment_file_put(log, CKPT_NAME, &iov, 1);
+}
+
+static void segment_checkpoint_read(struct segment_log *log)
+{
+    struct seg_checkpoint   *ckpt;
+    size_t                   len;
+
+    if (segment_file_get(log, CKPT_NAME, (void **)&ckpt, &len))
+        return;
+
+    if (len == sizeof(*ckpt) && ckpt->sc_magic == SEG_CKPT_MAGIC &&
+        ckpt->sc_sum == seg_checksum(&ckpt->sc_acked, sizeof(ckpt->sc_acked)))
+        log->sl_acked = ckpt->sc_acked;
+
+    free(ckpt);
+}
+
+static int segment_map(struct segment *seg)
+{
+    void    *map;
+
+    map = mmap(NULL, seg->sg_size, PROT_READ, MAP_SHARED, seg->sg_fd, 0);
+    if (map == MAP_FAILED)
+        return -errno;
+
+    seg->sg_map = map;
+    return 0;
+}
+
+static void segment_free(struct segment *seg)
+{
+    if (seg->sg_map != NULL)
+        munmap((void *)seg->sg_map, seg->sg_size);
+
+    if (seg->sg_fd >= 0)
+        close(seg->sg_fd);
+
+    free(seg->sg_index);
+    free(seg);
+}
+
+/**
+ * Make a newly created file persistent, along with its directory entry.
+ */
+static int segment_dir_sync(const struct segment_log *log)
+{
+    int fd;
+    int rc = 0;
+
+    fd = open(log->sl_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    if (fsync(fd))
+        rc = -errno;
+
+    close(fd);
+    return rc;
+}
+
+/**
+ * Start a new segment, which entries get appended to from now on.
+ */
+static int segment_create(struct segment_log *log)
+{
+    struct seg_header    hdr = {
+        .sh_magic   = SEG_MAGIC,
+        .sh_version = SEG_VERSION,
+        .sh_seqno   = log->sl_next_seqno,
+    };
+    struct segment      *seg;
+    char                 path[PATH_MAX];
+    ssize_t              n;
+    int                  rc;
+
+    seg = calloc(1, sizeof(*seg));
+    if (seg == NULL)
+        return -ENOMEM;
+
+    segment_path(log, hdr.sh_seqno, SEG_SUFFIX, path, sizeof(path));
+
+    seg->sg_seqno     = hdr.sh_seqno;
+    seg->sg_size      = log->sl_seg_size;
+    seg->sg_max_index = -1;
+    seg->sg_fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (seg->sg_fd < 0) {
+        rc = -errno;
+        free(seg);
+        lcap_error("Cannot create segment '%s': %s", path, strerror(-rc));
+        return rc;
+    }
+
+    /* Reserve space upfront, so that running out of it shows up here */
+    rc = -posix_fallocate(seg->sg_fd, 0, seg->sg_size);
+    if (rc)
+        goto out_unlink;
+
+    n = pwrite(seg->sg_fd, &hdr, sizeof(hdr), 0);
+    if (n != sizeof(hdr)) {
+        rc = n < 0 ? -errno : -EIO;
+        goto out_unlink;
+    }
+
+    rc = segment_map(seg);
+    if (rc)
+        goto out_unlink;
+
+    rc = segment_dir_sync(log);
+    if (rc)
+        goto out_unlink;
+
+    seg->sg_tail = sizeof(hdr);
+    pthread_mutex_lock(&log->sl_lock);
+    list_append(&log->sl_segments, &seg->sg_node);
+    pthread_mutex_unlock(&log->sl_lock);
+    log->sl_wr_seg = seg;
+    log->sl_next_seqno++;
+
+    lcap_verb("Created segment '%s' (%zu bytes)", path, seg->sg_size);
+    return 0;
+
+out_unlink:
+    lcap_error("Cannot initialize segment '%s': %s", path, strerror(-rc));
+    unlink(path);
+    segment_free(seg);
+    return rc;
+}
+
+/**
+ * Add the valid entries of a segment left over by a previous instance to the
+ * backlog. Segments without a valid index get scanned. Empty ones are removed.
+ */
+static int segment_load(struct segment_log *log, uint64_t seqno, long *records)
+{
+    const struct seg_header *hdr;
+    const struct seg_entry  *ent;
+    struct segment          *seg;
+    struct stat              st;
+    char                     path[PATH_MAX];
+    size_t                   off;
+    size_t                   i;
+    int                      rc;
+
+    segment_path(log, seqno, SEG_SUFFIX, path, sizeof(path));
+
+    seg = calloc(1, sizeof(*seg));
+    if (seg == NULL)
+        return -ENOMEM;
+
+    seg->sg_seqno     = seqno;
+    seg->sg_max_index = -1;
+    seg->sg_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (seg->sg_fd < 0 || fstat(seg->sg_fd, &st)) {
+        rc = -errno;
+        goto out_free;
+    }
+
+    seg->sg_size = st.st_size;
+    if (seg->sg_size < sizeof(*hdr))
+        goto out_unlink;
+
+    rc = segment_map(seg);
+    if (rc)
+        goto out_free;
+
+    /* Crashed before the header made it to disk */
+    hdr = (const struct seg_header *)seg->sg_map;
+    if (hdr->sh_magic == 0)
+        goto out_unlink;
+
+    if (hdr->sh_magic != SEG_MAGIC || hdr->sh_version != SEG_VERSION ||
+        hdr->sh_seqno != seqno) {
+        rc = -EINVAL;
+        goto out_free;
+    }
+
+    if (segment_index_read(log, seg) == 0)
+        goto out_indexed;
+
+    for (off = sizeof(*hdr); off + sizeof(*ent) <= seg->sg_size;
+         off += seg_entry_size(ent->se_len)) {
+        ent = (const struct seg_entry *)(seg->sg_map + off);
+
+        if (ent->se_magic != SEG_ENTRY_MAGIC)
+            break;
+
+        if (seg_entry_size(ent->se_len) > seg->sg_size - off ||
+            ent->se_max_index <= seg->sg_max_index ||
+            (seg->sg_nentries > 0 && ent->se_max_time <
+             seg->sg_index[seg->sg_nentries - 1].sie_max_time) ||
+            ent->se_max_index <= log->sl_max_index ||
+            seg_checksum(ent->se_records, ent->se_len) != ent->se_sum) {
+            lcap_info("Dropping torn entry at offset %zu of '%s'", off, path);
+            break;
+        }
+
+        rc = segment_index_add(seg, off, ent);
+        if (rc)
+            goto out_free;
+
+        seg->sg_max_index = ent->se_max_index;
+    }
+
+    seg->sg_tail = off;
+
+out_indexed:
+    if (seg->sg_nentries == 0)
+        goto out_unlink;
+
+    seg->sg_synced    = seg->sg_tail;
+    log->sl_max_index = seg->sg_max_index;
+    log->sl_max_time  = seg->sg_index[seg->sg_nentries - 1].sie_max_time;
+
+    /* Nothing gets appended to it anymore, do not scan it again */
+    if (!seg->sg_indexed)
+        segment_index_write(log, seg);
+
+    list_append(&log->sl_segments, &seg->sg_node);
+
+    if (log->sl_rd_seg == NULL) {
+        log->sl_rd_seg = seg;
+        log->sl_rd_off = sizeof(*hdr);
+    }
+
+    for (i = 0; i < seg->sg_nentries; i++)
+        *records += seg->sg_index[i].sie_count;
+
+    log->sl_backlog      += seg->sg_nentries;
+    log->sl_synced_index  = log->sl_max_index;
+
+    lcap_verb("Loaded %zu buckets from '%s'%s (up to record %lld)",
+              seg->sg_nentries, path, seg->sg_indexed ? " index" : "",
+              seg->sg_max_index);
+    return 0;
+
+out_unlink:
+    lcap_verb("Removing empty segment '%s'", path);
+    unlink(path);
+    segment_path(log, seqno, IDX_SUFFIX, path, sizeof(path));
+    unlink(path);
+    rc = 0;
+
+out_free:
+    if (rc)
+        lcap_error("Cannot load segment '%s': %s", path, strerror(-rc));
+    segment_free(seg);
+    return rc;
+}
+
+static int segment_filter(const struct dirent *d)
+{
+    size_t  len = strlen(d->d_name);
+
+    return len == 16 + strlen(SEG_SUFFIX) &&
+           strcmp(d->d_name + 16, SEG_SUFFIX) == 0;
+}
+
+int segment_log_open(struct segment_log *log, const char *dir,
+                     size_t seg_size)
+{
+    struct dirent   **names;
+    uint64_t          seqno;
+    long              records = 0;
+    long              skipped = 0;
+    int               count;
+    int               rc = 0;
+    int               i;
+
+    memset(log, 0, sizeof(*log));
+    log->sl_seg_size     = seg_size;
+    log->sl_max_index    = -1;
+    log->sl_synced_index = -1;
+    log->sl_acked        = -1;
+
+    rc = -pthread_mutex_init(&log->sl_lock, NULL);
+    if (rc)
+        return rc;
+
+    log->sl_dir = strdup(dir);
+    if (log->sl_dir == NULL) {
+        pthread_mutex_destroy(&log->sl_lock);
+        return -ENOMEM;
+    }
+
+    if (mkdir(dir, 0700) && errno != EEXIST) {
+        rc = -errno;
+        lcap_error("Cannot create spill directory '%s': %s", dir,
+                   strerror(-rc));
+        goto out_err;
+    }
+
+    /* Fixed width names, hence sorted by sequence number */
+    count = scandir(dir, &names, segment_filter, alphasort);
+    if (count < 0) {
+        rc = -errno;
+        lcap_error("Cannot scan spill directory '%s': %s", dir,
+                   strerror(-rc));
+        goto out_err;
+    }
+
+    segment_checkpoint_read(log);
+
+    for (i = 0; i < count; i++) {
+        seqno = strtoull(names[i]->d_name, NULL, 16);
+        if (rc == 0)
+            rc = segment_load(log, seqno, &records);
+        log->sl_next_seqno = seqno + 1;
+        free(names[i]);
+    }
+    free(names);
+
+    if (rc)
+        goto out_err;
+
+    /* Acknowledged already */
+    while (segment_peek(log) != NULL &&
+           segment_peek(log)->se_max_index <= log->sl_acked) {
+        records -= segment_peek(log)->se_count;
+        segment_consume(log);
+        skipped++;
+    }
+
+    segment_trim(log, log->sl_acked);
+
+    if (log->sl_max_index >= 0)
+        lcap_info("Recovered %ld buckets (%ld records) from '%s', %ld "
+                  "acknowledged ones skipped", log->sl_backlog, records, dir,
+                  skipped);
+    return 0;
+
+out_err:
+    segment_log_close(log);
+    return rc;
+}
+
+void segment_log_close(struct segment_log *log)
+{
+    struct list_node    *lnode;
+    int                  rc;
+
+    rc = segment_sync(log);
+    if (rc)
+        lcap_error("Cannot flush spilled records to '%s': %s", log->sl_dir,
+                   strerror(-rc));
+
+    if (rc == 0 && log->sl_wr_seg != NULL)
+        segment_index_write(log, log->sl_wr_seg);
+
+    if (log->sl_dir != NULL && log->sl_acked >= 0) {
+        rc = segment_checkpoint(log);
+        if (rc)
+            lcap_error("Cannot checkpoint acknowledged records to '%s': %s",
+                       log->sl_dir, strerror(-rc));
+    }
+
+    while ((lnode = list_pop_head(&log->sl_segments)) != NULL)
+        segment_free(list_entry(lnode, struct segment, sg_node));
+
+    pthread_mutex_destroy(&log->sl_lock);
+    free(log->sl_dir);
+    memset(log, 0, sizeof(*log));
+}
+
+int segment_append(struct segment_log *log, const void *recs, size_t len,
+                   uint32_t count, long long max_index, uint64_t min_time,
+                   uint64_t max_time)
+{
+    static const uint8_t     pad[8];
+    struct segment          *seg = log->sl_wr_seg;
+    size_t                   need = seg_entry_size(len);
+    struct seg_entry         ent = {
+        .se_magic       = SEG_ENTRY_MAGIC,
+        .se_sum         = seg_checksum(recs, len),
+        .se_count       = count,
+        .se_len         = len,
+        .se_max_index   = max_index,
+        .se_min_time    = min_time,
+        .se_max_time    = max_time,
+    };
+    struct iovec             iov[3] = {
+        {.iov_base = &ent,          .iov_len = sizeof(ent)},
+        {.iov_base = (void *)recs,  .iov_len = len},
+        {.iov_base = (void *)pad,   .iov_len = need - sizeof(ent) - len},
+    };
+    ssize_t                  n;
+    int                      rc;
+
+    if (segment_min_size(len) > log->sl_seg_size)
+        return -EFBIG;
+
+    if (seg == NULL || seg->sg_tail + need > seg->sg_size) {
+        if (seg != NULL) {
+            rc = segment_index_write(log, seg);
+            if (rc)
+                return rc;
+        }
+
+        rc = segment_create(log);
+        if (rc)
+            return rc;
+
+        seg = log->sl_wr_seg;
+    }
+
+    n = pwritev(seg->sg_fd, iov, 3, seg->sg_tail);
+    if (n < 0)
+        return -errno;
+
+    if ((size_t)n != need)
+        return -EIO;
+
+    pthread_mutex_lock(&log->sl_lock);
+    rc = segment_index_add(seg, seg->sg_tail, &ent);
+    pthread_mutex_unlock(&log->sl_lock);
+    if (rc)
+        return rc;
+
+    if (log->sl_rd_seg == NULL) {
+        log->sl_rd_seg = seg;
+        log->sl_rd_off = seg->sg_tail;
+    }
+
+    seg->sg_tail      += need;
+    seg->sg_max_index  = max_index;
+    log->sl_max_index  = max_index;
+    log->sl_max_time   = max_time;
+    log->sl_backlog++;
+    return 0;
+}
+
+int segment_sync(struct segment_log *log)
+{
+    struct list_node    *lnode;
+    struct segment      *seg;
+
+    for (lnode = log->sl_segments.l_first; lnode; lnode = lnode->ln_next) {
+        seg = list_entry(lnode, struct segment, sg_node);
+        if (seg->sg_synced == seg->sg_tail)
+            continue;
+
+        if (fdatasync(seg->sg_fd))
+            return -errno;
+
+        seg->sg_synced = seg->sg_tail;
+    }
+
+    log->sl_synced_index = log->sl_max_index;
+    return 0;
+}
+
+const struct seg_entry *segment_peek(struct segment_log *log)
+{
+    struct list_node    *next;
+
+    if (log->sl_backlog == 0)
+        return NULL;
+
+    /* Entries appended since the cursor reached the end of its segment */
+    while (log->sl_rd_off >= log->sl_rd_seg->sg_tail) {
+        next = log->sl_rd_seg->sg_node.ln_next;
+        assert(next != NULL);
+        log->sl_rd_seg = list_entry(next, struct segment, sg_node);
+        log->sl_rd_off = sizeof(struct seg_header);
+    }
+
+    return (const struct seg_entry *)(log->sl_rd_seg->sg_map +
+                                      log->sl_rd_off);
+}
+
+void segment_consume(struct segment_log *log)
+{
+    const struct seg_entry  *ent = segment_peek(log);
+    struct list_node        *next;
+
+    assert(ent != NULL);
+
+    log->sl_rd_off += seg_entry_size(ent->se_len);
+    log->sl_backlog--;
+
+    /* Move on to the next segment, if any, so that this one can go */
+    next = log->sl_rd_seg->sg_node.ln_next;
+    if (log->sl_rd_off >= log->sl_rd_seg->sg_tail && next != NULL) {
+        log->sl_rd_seg = list_entry(next, struct segment, sg_node);
+        log->sl_rd_off = sizeof(struct seg_header);
+    }
+}
+
+void segment_trim(struct segment_log *log, long long acked)
+{
+    struct segment  *seg;
+    char             path[PATH_MAX];
+    bool             saved = false;
+    int              rc;
+
+    if (acked > log->sl_acked)
+        log->sl_acked = acked;
+
+    while (log->sl_segments.l_first != NULL) {
+        seg = list_entry(log->sl_segments.l_first, struct segment, sg_node);
+
+        if (seg == log->sl_rd_seg || seg == log->sl_wr_seg ||
+            seg->sg_max_index > log->sl_acked)
+            break;
+
+        /* Checkpoint once per trim, not per record acknowledged */
+        if (!saved) {
+            rc = segment_checkpoint(log);
+            if (rc)
+                lcap_error("Cannot checkpoint acknowledged records to '%s': "
+                           "%s", log->sl_dir, strerror(-rc));
+            saved = true;
+        }
+
+        segment_path(log, seg->sg_seqno, IDX_SUFFIX, path, sizeof(path));
+        unlink(path);
+
+        segment_path(log, seg->sg_seqno, SEG_SUFFIX, path, sizeof(path));
+        lcap_verb("Removing segment '%s' (up to record %lld)", path,
+                  seg->sg_max_index);
+
+        unlink(path);
+        pthread_mutex_lock(&log->sl_lock);
+        list_remove(&log->sl_segments, &seg->sg_node);
+        pthread_mutex_unlock(&log->sl_lock);
+        segment_free(seg);
+    }
+}
+
+int segment_seek_time(struct segment_log *log, uint64_t msec,
+                      seg_time_fn first, long long *index)
+{
+    const struct seg_index_entry    *idx = NULL;
+    const struct seg_entry          *ent;
+    struct list_node                *lnode;
+    struct segment                  *seg = NULL;
+    size_t                           lo;
+    size_t                           hi;
+    size_t                           mid;
+
+    pthread_mutex_lock(&log->sl_lock);
+
+    /* Segments are few, entries are many */
+    for (lnode = log->sl_segments.l_first; lnode; lnode = lnode->ln_next) {
+        seg = list_entry(lnode, struct segment, sg_node);
+        if (seg->sg_nentries > 0 &&
+            seg->sg_index[seg->sg_nentries - 1].sie_max_time >= msec)
+            break;
+    }
+
+    if (lnode == NULL) {
+        pthread_mutex_unlock(&log->sl_lock);
+        return 0;
+    }
+
+    lo = 0;
+    hi = seg->sg_nentries - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (seg->sg_index[mid].sie_max_time < msec)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    idx = &seg->sg_index[lo];
+    ent = (const struct seg_entry *)(seg->sg_map + idx->sie_off);
+
+    /* Records reaching the watermark may have been coalesced away */
+    *index = first(ent->se_records, ent->se_len, msec);
+    if (*index < 0)
+        *index = idx->sie_max_index + 1;
+
+    pthread_mutex_unlock(&log->sl_lock);
+    return 1;
+}
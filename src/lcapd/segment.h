@@ -0,0 +1,210 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "queue.h"
+
+/**
+ * Log of sealed buckets, as a sequence of append-only segment files. Each file
+ * is preallocated, written with pwrite() and mapped read-only to load buckets
+ * back. Entries are appended in bucket order, hence records are found in the
+ * log by increasing index.
+ *
+ * Complete segments get an index file, so that restarting only has to scan
+ * the last one. The last acknowledged record is checkpointed along with them,
+ * and the entries up to it are not delivered again.
+ *
+ * Entries also carry the latest record time seen up to them (a watermark,
+ * monotonic along the log), so that the first entry from a given time on is
+ * found by binary search over the index.
+ *
+ * The log is owned by the ingestion thread of a reader. Other threads may only
+ * look it up with segment_seek_time(), segments and indexes being changed
+ * under segment_log::sl_lock.
+ */
+#define SEG_MAGIC           0x4c434150u  /* "LCAP" */
+#define SEG_ENTRY_MAGIC     0x424b5430u  /* "BKT0" */
+#define SEG_INDEX_MAGIC     0x49445830u  /* "IDX0" */
+#define SEG_CKPT_MAGIC      0x41434b30u  /* "ACK0" */
+#define SEG_VERSION         1
+
+struct seg_header {
+    uint32_t    sh_magic;
+    uint32_t    sh_version;
+    uint64_t    sh_seqno;
+} __attribute__((packed));
+
+/**
+ * Bucket stored in a segment, records following. Entries are 8-byte aligned.
+ */
+struct seg_entry {
+    uint32_t    se_magic;
+    uint32_t    se_sum;         /**< Checksum of the records */
+    uint32_t    se_count;       /**< Number of records */
+    uint32_t    se_len;         /**< Record bytes */
+    int64_t     se_max_index;   /**< Index of the last record */
+    uint64_t    se_min_time;    /**< Oldest record time (msec) */
+    uint64_t    se_max_time;    /**< Latest record time so far (msec) */
+    uint8_t     se_records[0];
+} __attribute__((packed));
+
+/**
+ * Index file of a segment, entries following.
+ */
+struct seg_index_hdr {
+    uint32_t    sih_magic;
+    uint32_t    sih_sum;        /**< Checksum of the entries */
+    uint64_t    sih_seqno;
+    uint64_t    sih_tail;       /**< End of the last entry */
+    uint64_t    sih_count;      /**< Number of entries */
+} __attribute__((packed));
+
+struct seg_index_entry {
+    uint64_t    sie_off;        /**< Offset of the entry in the segment */
+    uint32_t    sie_count;
+    uint32_t    sie_len;
+    int64_t     sie_max_index;
+    uint64_t    sie_min_time;
+    uint64_t    sie_max_time;
+} __attribute__((packed));
+
+/**
+ * Last acknowledged record, checkpointed.
+ */
+struct seg_checkpoint {
+    uint32_t    sc_magic;
+    uint32_t    sc_sum;         /**< Checksum of sc_acked */
+    int64_t     sc_acked;
+} __attribute__((packed));
+
+struct segment {
+    struct list_node     sg_node;       /**< In segment_log::sl_segments */
+    uint64_t             sg_seqno;      /**< Names the file */
+    int                  sg_fd;
+    const char          *sg_map;        /**< Read-only mapping of the file */
+    size_t               sg_size;       /**< File (and mapping) size */
+    size_t               sg_tail;       /**< End of the last entry */
+    size_t               sg_synced;     /**< Bytes known to be on disk */
+    long long            sg_max_index;  /**< Last record stored, -1 if none */
+    struct seg_index_entry *sg_index;   /**< Entries, in order */
+    size_t               sg_nentries;
+    size_t               sg_alloc;
+    bool                 sg_indexed;    /**< Index file up to date */
+};
+
+struct segment_log {
+    char                *sl_dir;        /**< NULL if spilling is disabled */
+    size_t               sl_seg_size;   /**< Size of new segments */
+    struct list          sl_segments;   /**< Oldest first */
+    struct segment      *sl_wr_seg;     /**< Segment being appended to */
+    uint64_t             sl_next_seqno;
+    struct segment      *sl_rd_seg;     /**< Next entry to load back ... */
+    size_t               sl_rd_off;     /**< ... and its offset */
+    long                 sl_backlog;    /**< Entries not loaded back yet */
+    long long            sl_max_index;  /**< Last record appended, -1 if none */
+    long long            sl_synced_index; /**< Last record on disk */
+    long long            sl_acked;      /**< Last acknowledged record */
+    uint64_t             sl_max_time;   /**< Latest record time appended */
+    pthread_mutex_t      sl_lock;
+};
+
+/**
+ * Index of the first record from time \a msec on in the \a len bytes of
+ * records of an entry, or -1 if there is none.
+ */
+typedef long long (*seg_time_fn)(const void *recs, size_t len, uint64_t msec);
+
+static inline bool segment_log_enabled(const struct segment_log *log)
+{
+    return log->sl_dir != NULL;
+}
+
+/**
+ * Bytes a segment must be able to hold to store a bucket of \a len bytes.
+ */
+static inline size_t segment_min_size(size_t len)
+{
+    return sizeof(struct seg_header) + sizeof(struct seg_entry) +
+           ((len + 7) & ~(size_t)7);
+}
+
+/**
+ * Open the log stored in \a dir, which gets created if needed. Entries left
+ * over by a previous instance and not acknowledged make up the initial
+ * backlog, truncated at the first torn one.
+ */
+int segment_log_open(struct segment_log *log, const char *dir,
+                     size_t seg_size);
+
+/**
+ * Flush, index and close the log. Segments are kept on disk.
+ */
+void segment_log_close(struct segment_log *log);
+
+/**
+ * Append a bucket of \a count records to the log. It is part of the backlog
+ * until consumed.
+ */
+int segment_append(struct segment_log *log, const void *recs, size_t len,
+                   uint32_t count, long long max_index, uint64_t min_time,
+                   uint64_t max_time);
+
+/**
+ * Flush what has been appended to disk. Records up to
+ * segment_log::sl_synced_index are then safe.
+ */
+int segment_sync(struct segment_log *log);
+
+/**
+ * Oldest entry of the backlog, NULL if empty. It remains mapped until the
+ * log gets trimmed past it.
+ */
+const struct seg_entry *segment_peek(struct segment_log *log);
+
+/**
+ * Drop the oldest entry from the backlog.
+ */
+void segment_consume(struct segment_log *log);
+
+/**
+ * Find the first record from time \a msec on, within the first entry whose
+ * watermark reaches it, and store its index into \a index. Any thread.
+ *
+ * \retval 1 if found
+ * \retval 0 if no entry reaches \a msec
+ */
+int segment_seek_time(struct segment_log *log, uint64_t msec,
+                      seg_time_fn first, long long *index);
+
+/**
+ * Record that records up to \a acked have been acknowledged, and remove the
+ * segments whose entries have all been consumed and acknowledged.
+ */
+void segment_trim(struct segment_log *log, long long acked);
+
+#endif /* SEGMENT_H */
@@ -0,0 +1,115 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+
+/**
+ * Bounded lock-free queue of pointers, for exactly one producer thread and one
+ * consumer thread. Head and tail are free running counters, each one written
+ * by a single side, and kept on separate cache lines.
+ */
+struct spsc_queue {
+    void            **sq_slots;
+    unsigned long     sq_mask;
+    unsigned long     sq_head __attribute__((aligned(64))); /**< Consumer */
+    unsigned long     sq_tail __attribute__((aligned(64))); /**< Producer */
+};
+
+
+/**
+ * Initialize a queue able to hold at least \a count items.
+ */
+static inline int spsc_init(struct spsc_queue *q, unsigned long count)
+{
+    unsigned long   capacity = 1;
+
+    while (capacity < count)
+        capacity <<= 1;
+
+    q->sq_slots = calloc(capacity, sizeof(*q->sq_slots));
+    if (q->sq_slots == NULL)
+        return -ENOMEM;
+
+    q->sq_mask = capacity - 1;
+    q->sq_head = 0;
+    q->sq_tail = 0;
+    return 0;
+}
+
+static inline void spsc_fini(struct spsc_queue *q)
+{
+    free(q->sq_slots);
+    q->sq_slots = NULL;
+}
+
+/**
+ * Producer side. Return false if the queue is full.
+ */
+static inline bool spsc_push(struct spsc_queue *q, void *item)
+{
+    unsigned long   tail = q->sq_tail;
+    unsigned long   head = __atomic_load_n(&q->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head > q->sq_mask)
+        return false;
+
+    q->sq_slots[tail & q->sq_mask] = item;
+    __atomic_store_n(&q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Consumer side. Return NULL if the queue is empty.
+ */
+static inline void *spsc_pop(struct spsc_queue *q)
+{
+    unsigned long   head = q->sq_head;
+    unsigned long   tail = __atomic_load_n(&q->sq_tail, __ATOMIC_ACQUIRE);
+    void           *item;
+
+    if (head == tail)
+        return NULL;
+
+    item = q->sq_slots[head & q->sq_mask];
+    __atomic_store_n(&q->sq_head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+/**
+ * Consumer side. Return the next item without dequeuing it, NULL if empty.
+ */
+static inline void *spsc_peek(struct spsc_queue *q)
+{
+    unsigned long   head = q->sq_head;
+    unsigned long   tail = __atomic_load_n(&q->sq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return NULL;
+
+    return q->sq_slots[head & q->sq_mask];
+}
+
+#endif /* SPSC_H */
@@ -0,0 +1,210 @@
+/*
+ * LCAP - Lustre Changelogs Aggregate and Publish
+ *
+ * Copyright (C)  2013-2015  CEA/DAM
+ * Henri DOREAU <henri.doreau@cea.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#include <lcap_idl.h>
+#include <queue.h>
+
+/**
+ * Hashed timer wheel. Timers are chained into the slot of their deadline tick
+ * modulo the number of slots, so that arming and cancelling are O(1). Deadlines
+ * further than a full round away simply stay in their slot until due.
+ * Not thread safe.
+ */
+struct tw_timer {
+    struct list_node    tt_node;    /**< Chain node in the wheel slot */
+    uint64_t            tt_expiry;  /**< Deadline, in ticks */
+};
+
+struct timer_wheel {
+    struct list        *tw_slots;
+    uint64_t            tw_mask;    /**< Slot count - 1 */
+    uint64_t            tw_now;     /**< Last processed tick */
+    uint64_t            tw_next;    /**< Earliest deadline, in ticks, early
+                                         if its timer got cancelled */
+    unsigned int        tw_tick;    /**< Tick length, in msec */
+    unsigned int        tw_count;   /**< Number of armed timers */
+};
+
+
+/**
+ * Current time in milliseconds, from the monotonic clock.
+ */
+static inline uint64_t tw_clock_msec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Initialize a wheel of at least \a slots slots of \a tick msec each.
+ */
+static inline int tw_init(struct timer_wheel *tw, unsigned int slots,
+                          unsigned int tick)
+{
+    uint64_t    count = 1;
+
+    while (count < slots)
+        count <<= 1;
+
+    tw->tw_slots = calloc(count, sizeof(*tw->tw_slots));
+    if (tw->tw_slots == NULL)
+        return -ENOMEM;
+
+    tw->tw_mask  = count - 1;
+    tw->tw_tick  = tick;
+    tw->tw_now   = tw_clock_msec() / tick;
+    tw->tw_count = 0;
+    return 0;
+}
+
+static inline void tw_fini(struct timer_wheel *tw)
+{
+    free(tw->tw_slots);
+    tw->tw_slots = NULL;
+}
+
+/**
+ * Arm \a timer to expire \a msec from now.
+ */
+static inline void tw_arm(struct timer_wheel *tw, struct tw_timer *timer,
+                          unsigned int msec)
+{
+    uint64_t    expiry;
+
+    /* Round up, a timer never fires early */
+    expiry = (tw_clock_msec() + msec + tw->tw_tick - 1) / tw->tw_tick;
+    if (expiry <= tw->tw_now)
+        expiry = tw->tw_now + 1;
+
+    timer->tt_expiry = expiry;
+    list_append(&tw->tw_slots[expiry & tw->tw_mask], &timer->tt_node);
+    if (tw->tw_count++ == 0 || expiry < tw->tw_next)
+        tw->tw_next = expiry;
+}
+
+static inline void tw_cancel(struct timer_wheel *tw, struct tw_timer *timer)
+{
+    list_remove(&tw->tw_slots[timer->tt_expiry & tw->tw_mask],
+                &timer->tt_node);
+    tw->tw_count--;
+}
+
+/**
+ * Find the earliest deadline, going over the slots from the current tick on.
+ * The first timer due within a round is found in its slot, later ones require
+ * going over the whole wheel.
+ */
+static inline uint64_t tw_earliest(const struct timer_wheel *tw)
+{
+    struct list_node   *lnode;
+    struct tw_timer    *timer;
+    uint64_t            tick;
+    uint64_t            next = UINT64_MAX;
+
+    for (tick = tw->tw_now + 1; tick <= tw->tw_now + tw->tw_mask + 1; tick++) {
+        lnode = tw->tw_slots[tick & tw->tw_mask].l_first;
+        for (; lnode != NULL; lnode = lnode->ln_next) {
+            timer = list_entry(lnode, struct tw_timer, tt_node);
+            if (timer->tt_expiry == tick)
+                return tick;
+
+            if (timer->tt_expiry < next)
+                next = timer->tt_expiry;
+        }
+    }
+
+    return next;
+}
+
+/**
+ * Move the timers which are due to the \a expired list.
+ */
+static inline void tw_advance(struct timer_wheel *tw, struct list *expired)
+{
+    uint64_t            target = tw_clock_msec() / tw->tw_tick;
+    uint64_t            steps  = target - tw->tw_now;
+    struct list_node   *lnode;
+    struct list_node   *next;
+    struct list        *slot;
+    struct tw_timer    *timer;
+
+    if (tw->tw_count == 0) {
+        tw->tw_now = target;
+        return;
+    }
+
+    /* No need to go over the same slot twice */
+    if (steps > tw->tw_mask + 1)
+        steps = tw->tw_mask + 1;
+
+    while (steps-- > 0) {
+        slot = &tw->tw_slots[++tw->tw_now & tw->tw_mask];
+
+        for (lnode = slot->l_first; lnode != NULL; lnode = next) {
+            next  = lnode->ln_next;
+            timer = list_entry(lnode, struct tw_timer, tt_node);
+
+            if (timer->tt_expiry > target)
+                continue;
+
+            list_remove(slot, lnode);
+            list_append(expired, lnode);
+            tw->tw_count--;
+        }
+    }
+
+    tw->tw_now = target;
+
+    /* Only looked for once the earliest deadline has passed */
+    if (tw->tw_count > 0 && tw->tw_next <= target)
+        tw->tw_next = tw_earliest(tw);
+}
+
+/**
+ * Milliseconds until the earliest deadline, -1 if no timer is armed. Suitable
+ * as a poll timeout.
+ */
+static inline int tw_timeout(const struct timer_wheel *tw)
+{
+    uint64_t    now = tw_clock_msec();
+    uint64_t    deadline = tw->tw_next * tw->tw_tick;
+
+    if (tw->tw_count == 0)
+        return -1;
+
+    if (deadline <= now)
+        return 0;
+
+    return deadline - now > INT_MAX ? INT_MAX : deadline - now;
+}
+
+#endif /* TIMER_WHEEL_H */
@@ -63,7 +63,61 @@ static void lcapnet_req_release(struct lcapnet_request *req)
 
     free(req->lr_remote);
     free(req->lr_forward);
-    free(req->lr_body);
+
+    /* Single frame bodies are not copied */
+    if (req->lr_nframes != 1)
+        free(req->lr_body);
+
+    while (req->lr_nframes > 0)
+        zmq_msg_close(&req->lr_frames[--req->lr_nframes]);
+    free(req->lr_frames);
+}
+
+/**
+ * Keep a body frame as is, its content being moved out of \a zmsg.
+ */
+static int lcapnet_req_keep(struct lcapnet_request *req, zmq_msg_t *zmsg)
+{
+    zmq_msg_t   *frames;
+
+    frames = realloc(req->lr_frames, (req->lr_nframes + 1) * sizeof(*frames));
+    if (frames == NULL)
+        return -ENOMEM;
+
+    req->lr_frames = frames;
+    zmq_msg_init(&frames[req->lr_nframes]);
+    if (zmq_msg_move(&frames[req->lr_nframes], zmsg) < 0)
+        return -errno;
+
+    req->lr_nframes++;
+    return 0;
+}
+
+/**
+ * Point the body of a request received with LCAP_RECV_FRAMES at its frame, or
+ * at a copy of its frames put together if there are several of them.
+ */
+static int lcapnet_req_body(struct lcapnet_request *req)
+{
+    size_t  len = 0;
+    int     i;
+
+    if (req->lr_nframes == 1) {
+        req->lr_body = zmq_msg_data(&req->lr_frames[0]);
+        return 0;
+    }
+
+    req->lr_body = malloc(req->lr_body_len);
+    if (req->lr_body == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < req->lr_nframes; i++) {
+        memcpy((char *)req->lr_body + len, zmq_msg_data(&req->lr_frames[i]),
+               zmq_msg_size(&req->lr_frames[i]));
+        len += zmq_msg_size(&req->lr_frames[i]);
+    }
+
+    return 0;
 }
 
 static int lcapnet_req_update(struct lcapnet_request *req, zmq_msg_t *zmsg)
@@ -75,7 +129,7 @@ static int lcapnet_req_update(struct lcapnet_request *req, zmq_msg_t *zmsg)
     if (frame_len == 0)
         return 0;
 
-    if (req->lr_remote == NULL && !req->lr_flags & LCAP_RECV_NO_ENVELOPE) {
+    if (req->lr_remote == NULL && !(req->lr_flags & LCAP_RECV_NO_ENVELOPE)) {
         req->lr_remote = connection_id_new(frame_bytes, frame_len);
         return req->lr_remote ? 0 : -ENOMEM;
     }
@@ -85,6 +139,11 @@ static int lcapnet_req_update(struct lcapnet_request *req, zmq_msg_t *zmsg)
         return req->lr_forward ? 0 : -ENOMEM;
     }
 
+    if (req->lr_flags & LCAP_RECV_FRAMES) {
+        req->lr_body_len += frame_len;
+        return lcapnet_req_keep(req, zmsg);
+    }
+
     req->lr_body = realloc(req->lr_body, req->lr_body_len + frame_len);
     if (req->lr_body == NULL)
         return -ENOMEM;
@@ -110,6 +169,9 @@ static int lcap_rpc_recv_once(void *zsock, int flags, lcap_rpc_hdl_t cb,
     if (flags & LCAP_RECV_NO_ENVELOPE)
         req->lr_flags |= LCAP_RECV_NO_ENVELOPE;
 
+    if (flags & LCAP_RECV_FRAMES)
+        req->lr_flags |= LCAP_RECV_FRAMES;
+
     if (flags & LCAP_RECV_NONBLOCK)
         zmq_flags |= ZMQ_DONTWAIT;
 
@@ -132,18 +194,20 @@ static int lcap_rpc_recv_once(void *zsock, int flags, lcap_rpc_hdl_t cb,
             goto out_loop;
         }
 
-        rc = lcapnet_req_update(req, &zmsg);
-        if (rc < 0)
-            goto out_loop;
-
+        /* Before the frame content possibly gets moved out */
         stop = !zmq_msg_more(&zmsg);
 
+        rc = lcapnet_req_update(req, &zmsg);
+
 out_loop:
         zmq_msg_close(&zmsg);
         if (stop || rc)
             break;
     }
 
+    if (rc >= 0 && req->lr_body_len > 0 && (req->lr_flags & LCAP_RECV_FRAMES))
+        rc = lcapnet_req_body(req);
+
     if (rc >= 0 && req->lr_body_len > 0) {
         rc = cb(hint, req);
         if (rc < 0)
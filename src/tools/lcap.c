@@ -25,6 +25,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 #include <stdbool.h>
@@ -42,15 +43,18 @@ static inline bool fid_is_zero(const lustre_fid *fid)
 
 void static usage(void)
 {
-    fprintf(stderr, "Usage: lcap [-d] <mdtname>\n");
+    fprintf(stderr, "Usage: lcap [-d|-s|-b|-z|-c] [-t <secs since Epoch>] "
+            "<mdtname>[,<mdtname>...]|all\n");
 }
 
 int main(int ac, char **av)
 {
     struct lcap_cl_ctx      *ctx = NULL;
     const char              *mdtname = NULL;
+    const char              *origin;
     struct changelog_rec    *rec;
     int                      flags = LCAP_CL_BLOCK | LCAP_CL_JOBID;
+    long long                startrec = 0LL;
     int                      c;
     int                      rc;
 
@@ -59,12 +63,33 @@ int main(int ac, char **av)
         return 1;
     }
 
-    while ((c = getopt(ac, av, "d")) != -1) {
+    while ((c = getopt(ac, av, "dsbzct:")) != -1) {
         switch (c) {
             case 'd':
                 flags |= LCAP_CL_DIRECT;
                 break;
 
+            case 's':
+                flags |= LCAP_CL_STREAM;
+                break;
+
+            case 'b':
+                flags |= LCAP_CL_BROADCAST;
+                break;
+
+            case 'z':
+                flags |= LCAP_CL_COMPRESS;
+                break;
+
+            case 'c':
+                flags |= LCAP_CL_COLUMNAR;
+                break;
+
+            case 't':
+                flags   |= LCAP_CL_START_TIME;
+                startrec = strtoll(optarg, NULL, 10) * 1000;
+                break;
+
             case '?':
                 fprintf(stderr, "Unknown option: %s\n", optopt);
                 usage();
@@ -82,7 +107,7 @@ int main(int ac, char **av)
 
     mdtname = av[0];
 
-    rc = lcap_changelog_start(&ctx, flags, mdtname, 0LL);
+    rc = lcap_changelog_start(&ctx, flags, mdtname, startrec);
     if (rc < 0) {
         fprintf(stderr, "lcap_changelog_start: %s\n", zmq_strerror(-rc));
         return 1;
@@ -121,7 +146,11 @@ int main(int ac, char **av)
 
         printf("\n");
 
-        rc = lcap_changelog_clear(ctx, mdtname, "cl1", rec->cr_index);
+        /* Records of merged MDTs are cleared where they come from */
+        if (lcap_changelog_origin(ctx, &origin) < 0)
+            origin = mdtname;
+
+        rc = lcap_changelog_clear(ctx, origin, "cl1", rec->cr_index);
         if (rc < 0) {
             fprintf(stderr, "lcap_changelog_clear: %s\n", zmq_strerror(-rc));
             return 1;